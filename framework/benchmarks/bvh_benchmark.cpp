@@ -0,0 +1,140 @@
+// Measures BVH build time and query throughput on a model (for the demo: resources/environment/MarsBase.obj).
+// Usage: BvhBenchmark <obj file> [number of rays (default 1000000)]
+#include <framework/bvh.h>
+#include <framework/mesh.h>
+#include <framework/thread_pool.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+template <typename F>
+static double timeMilliseconds(F&& func)
+{
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Closest hit distance by testing every triangle.
+static float bruteForceIntersect(std::span<const Mesh> meshes, const Ray& ray)
+{
+    float closest = ray.t;
+    for (const Mesh& mesh : meshes) {
+        for (const glm::uvec3& triangle : mesh.triangles) {
+            const glm::vec3 v0 = mesh.vertices[triangle.x].position;
+            const glm::vec3 edge1 = mesh.vertices[triangle.y].position - v0;
+            const glm::vec3 edge2 = mesh.vertices[triangle.z].position - v0;
+            const glm::vec3 p = glm::cross(ray.direction, edge2);
+            const float determinant = glm::dot(edge1, p);
+            if (std::abs(determinant) <= 1e-12f)
+                continue;
+            const glm::vec3 s = ray.origin - v0;
+            const float u = glm::dot(s, p) / determinant;
+            const glm::vec3 q = glm::cross(s, edge1);
+            const float v = glm::dot(ray.direction, q) / determinant;
+            const float t = glm::dot(edge2, q) / determinant;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 1e-6f && t < closest)
+                closest = t;
+        }
+    }
+    return closest;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: BvhBenchmark <obj file> [number of rays]" << std::endl;
+        return 1;
+    }
+    const size_t numRays = argc > 2 ? std::stoull(argv[2]) : 1'000'000;
+
+    const std::vector<Mesh> meshes = loadMesh(argv[1]);
+    std::unique_ptr<Bvh> pBvh;
+    const double buildTime = timeMilliseconds([&]() { pBvh = std::make_unique<Bvh>(meshes); });
+    std::cout << fmt::format("{} triangles, {} BVH4 nodes, built in {:.1f} ms ({} worker threads)\n",
+        pBvh->numTriangles(), pBvh->numNodes(), buildTime, ThreadPool::global().numThreads());
+
+    // Rays from random points on a sphere around the model towards random points inside its bounding box.
+    glm::vec3 boundsMin { std::numeric_limits<float>::max() }, boundsMax { std::numeric_limits<float>::lowest() };
+    for (const Mesh& mesh : meshes) {
+        for (const Vertex& vertex : mesh.vertices) {
+            boundsMin = glm::min(boundsMin, vertex.position);
+            boundsMax = glm::max(boundsMax, vertex.position);
+        }
+    }
+    const glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+    const float radius = glm::length(boundsMax - center);
+    std::mt19937 rng { 1234 };
+    std::uniform_real_distribution<float> uniform { 0.0f, 1.0f };
+    std::normal_distribution<float> normal;
+    std::vector<Ray> rays(numRays);
+    for (Ray& ray : rays) {
+        ray.origin = center + radius * 1.5f * glm::normalize(glm::vec3(normal(rng), normal(rng), normal(rng)));
+        const glm::vec3 target = glm::mix(boundsMin, boundsMax, glm::vec3(uniform(rng), uniform(rng), uniform(rng)));
+        ray.direction = glm::normalize(target - ray.origin);
+    }
+
+    // Correctness against brute force on a subset.
+    const size_t numVerified = std::min<size_t>(rays.size(), 500);
+    size_t numMismatches = 0;
+    for (size_t i = 0; i < numVerified; i++) {
+        Ray ray = rays[i];
+        BvhHit hit;
+        pBvh->intersectRay(ray, hit);
+        const float expected = bruteForceIntersect(meshes, rays[i]);
+        if (std::abs(ray.t - expected) > 1e-4f * std::max(1.0f, expected))
+            numMismatches++;
+    }
+    std::cout << fmt::format("{} / {} rays match brute force\n", numVerified - numMismatches, numVerified);
+
+    std::atomic<size_t> numHits { 0 };
+    const auto traceRange = [&](size_t begin, size_t end) {
+        size_t hits = 0;
+        for (size_t i = begin; i < end; i++) {
+            Ray ray = rays[i];
+            BvhHit hit;
+            hits += pBvh->intersectRay(ray, hit);
+        }
+        numHits += hits;
+    };
+    const double singleThreadTime = timeMilliseconds([&]() { traceRange(0, rays.size()); });
+    constexpr size_t blockSize = 4096;
+    const double multiThreadTime = timeMilliseconds([&]() {
+        ThreadPool::global().parallelFor((rays.size() + blockSize - 1) / blockSize,
+            [&](size_t block) { traceRange(block * blockSize, std::min(rays.size(), (block + 1) * blockSize)); });
+    });
+    std::cout << fmt::format("rays: {:.2f} Mrays/s single thread, {:.2f} Mrays/s all threads ({:.0f}% hit)\n",
+        double(rays.size()) / singleThreadTime / 1000.0, double(rays.size()) / multiThreadTime / 1000.0,
+        100.0 * double(numHits) / double(2 * rays.size()));
+
+    // Overlap queries with spheres/capsules of 1% of the model size, placed where the rays start to hit.
+    const size_t numQueries = std::min<size_t>(rays.size(), 100'000);
+    const float queryRadius = 0.01f * radius;
+    size_t numOverlaps = 0;
+    const double sphereTime = timeMilliseconds([&]() {
+        for (size_t i = 0; i < numQueries; i++)
+            numOverlaps += pBvh->overlapsSphere(glm::mix(boundsMin, boundsMax, glm::vec3(uniform(rng), uniform(rng), uniform(rng))), queryRadius);
+    });
+    const double capsuleTime = timeMilliseconds([&]() {
+        for (size_t i = 0; i < numQueries; i++) {
+            const glm::vec3 a = glm::mix(boundsMin, boundsMax, glm::vec3(uniform(rng), uniform(rng), uniform(rng)));
+            numOverlaps += pBvh->overlapsCapsule(a, a + 5.0f * queryRadius * glm::vec3(1, 0, 0), queryRadius);
+        }
+    });
+    std::cout << fmt::format("overlap queries: sphere {:.2f} us, capsule {:.2f} us ({} overlaps)\n",
+        1000.0 * sphereTime / double(numQueries), 1000.0 * capsuleTime / double(numQueries), numOverlaps);
+
+    return numMismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+// Measures the throughput of the bulk pixel conversions in image.h on a synthetic image, and the load time of an
+// image file if one is given (for the demo: resources/terrain/Ground050/Ground050_2K-JPG_Color.jpg).
+// Usage: ImageBenchmark [image file] [image size (default 2048)]
+#include <framework/image.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+// Best of a few runs, in milliseconds.
+template <typename F>
+static double timeMilliseconds(F&& func)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0; run < 5; run++) {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static void report(const char* name, double milliseconds, size_t bytesRead, size_t bytesWritten)
+{
+    std::cout << fmt::format("{:<22} {:7.2f} ms {:7.2f} GB/s\n", name, milliseconds, double(bytesRead + bytesWritten) / milliseconds / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        const double loadTime = timeMilliseconds([&]() { Image image { argv[1] }; });
+        const Image image { argv[1] };
+        std::cout << fmt::format("{}: {}x{}x{} loaded in {:.1f} ms\n", argv[1], image.width, image.height, image.channels, loadTime);
+    }
+    const int size = argc > 2 ? std::stoi(argv[2]) : 2048;
+
+    Image rgb { size, size, 3 };
+    Image rgba { size, size, 4 };
+    std::mt19937 rng { 1234 };
+    std::uniform_int_distribution<int> byte { 0, 255 };
+    std::generate(std::begin(rgb.data()), std::end(rgb.data()), [&]() { return uint8_t(byte(rng)); });
+    std::vector<float> floats(rgba.sizeInBytes());
+
+    // Verify against the scalar definitions before timing.
+    convertRgbToRgba(rgb.data(), rgba.data(), 128);
+    bool ok = true;
+    for (size_t pixel = 0; pixel < size_t(size) * size_t(size); pixel++) {
+        for (size_t channel = 0; channel < 3; channel++)
+            ok &= rgba.data()[4 * pixel + channel] == rgb.data()[3 * pixel + channel];
+        ok &= rgba.data()[4 * pixel + 3] == 128;
+    }
+    convertU8ToFloat(rgba.data(), floats);
+    for (size_t i = 0; i < floats.size(); i++)
+        ok &= std::abs(floats[i] - float(rgba.data()[i]) / 255.0f) <= 1e-6f;
+    std::vector<uint8_t> roundTrip(floats.size());
+    convertFloatToU8(floats, roundTrip);
+    ok &= std::equal(std::begin(roundTrip), std::end(roundTrip), std::begin(rgba.data()));
+    std::vector<uint8_t> premultiplied(std::begin(rgba.data()), std::end(rgba.data()));
+    premultiplyAlpha(premultiplied);
+    for (size_t i = 0; i < premultiplied.size(); i++) {
+        const uint8_t alpha = rgba.data()[i | 3];
+        const auto expected = (i & 3) == 3 ? alpha : uint8_t(std::nearbyint(float(rgba.data()[i]) * float(alpha) / 255.0f));
+        ok &= std::abs(int(premultiplied[i]) - int(expected)) <= 1;
+    }
+    std::cout << (ok ? "conversions match the scalar reference\n" : "conversions DO NOT match the scalar reference\n");
+
+    const size_t rgbBytes = rgb.sizeInBytes(), rgbaBytes = rgba.sizeInBytes();
+    report("RGB to RGBA", timeMilliseconds([&]() { convertRgbToRgba(rgb.data(), rgba.data()); }), rgbBytes, rgbaBytes);
+    report("u8 to float", timeMilliseconds([&]() { convertU8ToFloat(rgba.data(), floats); }), rgbaBytes, 4 * rgbaBytes);
+    report("float to u8", timeMilliseconds([&]() { convertFloatToU8(floats, rgba.data()); }), 4 * rgbaBytes, rgbaBytes);
+    report("premultiply alpha", timeMilliseconds([&]() { premultiplyAlpha(rgba.data()); }), rgbaBytes, rgbaBytes);
+    report("sRGB to linear", timeMilliseconds([&]() { convertSrgbToLinear(rgba.data(), floats, 4); }), rgbaBytes, 4 * rgbaBytes);
+    std::vector<float> floatsCopy(floats.size());
+    report("copy (reference)", timeMilliseconds([&]() { std::copy(std::begin(floats), std::end(floats), std::begin(floatsCopy)); }),
+        4 * rgbaBytes, 4 * rgbaBytes);
+    report("mip chain (box)", timeMilliseconds([&]() { static_cast<void>(generateMipChain(rgb, { .filter = MipChainSettings::Filter::Box })); }),
+        rgbBytes, rgbBytes / 3);
+    report("mip chain (Kaiser)", timeMilliseconds([&]() { static_cast<void>(generateMipChain(rgb)); }), rgbBytes, rgbBytes / 3);
+    report("mip chain (normals)", timeMilliseconds([&]() { static_cast<void>(generateMipChain(rgb, { .normalMap = true })); }),
+        rgbBytes, rgbBytes / 3);
+
+    return ok ? 0 : 1;
+}
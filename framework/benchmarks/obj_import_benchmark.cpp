@@ -0,0 +1,107 @@
+// Compares the multithreaded OBJ importer against the tinyobjloader path on a synthetic OBJ file.
+// Usage: ObjImportBenchmark [grid resolution (default 1000)] [repetitions (default 3)]
+#include <framework/mesh.h>
+#include <framework/obj_parser.h>
+#include <framework/thread_pool.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+
+// Height field of resolution x resolution quads with positions, texture coordinates and normals, split over
+// several objects and materials. Mixes absolute and relative indices, triangles and quads.
+static void writeSyntheticObj(const std::filesystem::path& objFile, int resolution)
+{
+    const auto mtlFile = std::filesystem::path(objFile).replace_extension(".mtl");
+    {
+        std::ofstream mtl { mtlFile };
+        for (int i = 0; i < 4; i++)
+            mtl << fmt::format("newmtl material{}\nKd {} 0.5 0.5\nKs 0.2 0.2 0.2\nNs 16\nd 1\n\n", i, 0.25f * float(i));
+    }
+
+    std::ofstream obj { objFile };
+    obj << "mtllib " << mtlFile.filename().string() << "\n";
+
+    std::mt19937 rng { 1234 };
+    std::uniform_real_distribution<float> height { 0.0f, 0.1f };
+    const int verticesPerRow = resolution + 1;
+    for (int z = 0; z < verticesPerRow; z++) {
+        for (int x = 0; x < verticesPerRow; x++) {
+            obj << fmt::format("v {:.6f} {:.6f} {:.6f}\n", float(x) / float(resolution), height(rng), float(z) / float(resolution));
+            obj << fmt::format("vt {:.6f} {:.6f}\n", float(x) / float(resolution), float(z) / float(resolution));
+            obj << fmt::format("vn {:.6f} 1.0 {:.6f}\n", height(rng), height(rng));
+        }
+    }
+
+    for (int z = 0; z < resolution; z++) {
+        if (z % (resolution / 8 + 1) == 0)
+            obj << fmt::format("o strip{}\nusemtl material{}\n", z, z % 4);
+        for (int x = 0; x < resolution; x++) {
+            const int a = z * verticesPerRow + x + 1, b = a + 1, c = a + verticesPerRow, d = c + 1;
+            if (x % 2 == 0)
+                obj << fmt::format("f {0}/{0}/{0} {1}/{1}/{1} {2}/{2}/{2} {3}/{3}/{3}\n", a, c, d, b);
+            else
+                obj << fmt::format("f {0}/{0}/{0} {1}/{1}/{1} {2}/{2}/{2}\nf {0}/{0}/{0} {2}/{2}/{2} {3}/{3}/{3}\n", a, c, d, b);
+        }
+    }
+}
+
+static double bestOf(int repetitions, const std::function<void()>& func)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repetitions; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    const int resolution = argc > 1 ? std::stoi(argv[1]) : 1000;
+    const int repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+
+    const auto objFile = std::filesystem::temp_directory_path() / "cgframework_obj_import_benchmark.obj";
+    writeSyntheticObj(objFile, resolution);
+    const auto fileSize = std::filesystem::file_size(objFile);
+    std::cout << fmt::format("Synthetic OBJ: {} quads, {:.1f} MB, {} worker threads\n",
+        resolution * resolution, double(fileSize) / (1024.0 * 1024.0), ThreadPool::global().numThreads());
+
+    // Both parsers must agree before their timings mean anything.
+    const ObjData reference = parseObjTinyObj(objFile);
+    const ObjData parallel = parseObj(objFile);
+    bool identical = reference.positions.size() == parallel.positions.size() && reference.faceGroups.size() == parallel.faceGroups.size();
+    for (size_t i = 0; identical && i < reference.faceGroups.size(); i++) {
+        const auto& lhs = reference.faceGroups[i];
+        const auto& rhs = parallel.faceGroups[i];
+        identical = lhs.material == rhs.material && lhs.corners.size() == rhs.corners.size()
+            && std::equal(std::begin(lhs.corners), std::end(lhs.corners), std::begin(rhs.corners), [](const ObjIndex& a, const ObjIndex& b) {
+                   return a.position == b.position && a.texCoord == b.texCoord && a.normal == b.normal;
+               });
+    }
+    std::cout << (identical ? "Parsers produce identical face streams\n" : "WARNING: parsers disagree\n");
+
+    const double tinyObjParse = bestOf(repetitions, [&]() { (void)parseObjTinyObj(objFile); });
+    const double parallelParse = bestOf(repetitions, [&]() { (void)parseObj(objFile); });
+    const double tinyObjLoad = bestOf(repetitions, [&]() { (void)loadMesh(objFile, { .useMeshCache = false, .parallelObjParser = false }); });
+    const double parallelLoad = bestOf(repetitions, [&]() { (void)loadMesh(objFile, { .useMeshCache = false, .parallelObjParser = true }); });
+
+    const double megabytes = double(fileSize) / (1024.0 * 1024.0);
+    std::cout << fmt::format("parse    tinyobj {:9.1f} ms ({:7.1f} MB/s)   parallel {:9.1f} ms ({:7.1f} MB/s)   speedup {:.2f}x\n",
+        tinyObjParse, megabytes / (tinyObjParse / 1000.0), parallelParse, megabytes / (parallelParse / 1000.0), tinyObjParse / parallelParse);
+    std::cout << fmt::format("loadMesh tinyobj {:9.1f} ms                   parallel {:9.1f} ms                   speedup {:.2f}x\n",
+        tinyObjLoad, parallelLoad, tinyObjLoad / parallelLoad);
+
+    std::filesystem::remove(objFile);
+    std::filesystem::remove(std::filesystem::path(objFile).replace_extension(".mtl"));
+    return identical ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Measures the speed and quality (PSNR against the source) of the block compression encoders on an image file or, if
+// none is given, on a synthetic image with gradients, edges and noise.
+// Usage: TextureCompressionBenchmark [image file]
+#include <framework/image.h>
+#include <framework/texture_compression.h>
+#include <framework/thread_pool.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
+
+// Reference decoders, following the block layouts of the OpenGL BPTC/RGTC/S3TC specifications.
+using DecodedBlock = std::array<std::array<int, 4>, 16>;
+
+static uint64_t readBits(std::span<const std::byte> block, int first, int numBits)
+{
+    uint64_t out = 0;
+    for (int i = 0; i < numBits; i++)
+        out |= uint64_t((std::to_integer<int>(block[(first + i) / 8]) >> ((first + i) % 8)) & 1) << i;
+    return out;
+}
+
+static void decodeBc1(std::span<const std::byte> block, DecodedBlock& out)
+{
+    const auto color0 = int(readBits(block, 0, 16)), color1 = int(readBits(block, 16, 16));
+    std::array<std::array<int, 4>, 4> palette;
+    for (int i = 0; i < 2; i++) {
+        const int color = i == 0 ? color0 : color1;
+        const int r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+        palette[i] = { r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2, 255 };
+    }
+    for (int channel = 0; channel < 3; channel++) {
+        if (color0 > color1) {
+            palette[2][channel] = (2 * palette[0][channel] + palette[1][channel]) / 3;
+            palette[3][channel] = (palette[0][channel] + 2 * palette[1][channel]) / 3;
+        } else {
+            palette[2][channel] = (palette[0][channel] + palette[1][channel]) / 2;
+            palette[3][channel] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = color0 > color1 ? 255 : 0;
+    for (int i = 0; i < 16; i++)
+        out[i] = palette[readBits(block, 32 + 2 * i, 2)];
+}
+
+static void decodeBc4(std::span<const std::byte> block, int channel, DecodedBlock& out)
+{
+    const auto value0 = int(readBits(block, 0, 8)), value1 = int(readBits(block, 8, 8));
+    std::array<int, 8> palette { value0, value1 };
+    for (int i = 2; i < 8; i++) {
+        if (value0 > value1)
+            palette[i] = ((8 - i) * value0 + (i - 1) * value1) / 7;
+        else
+            palette[i] = i < 6 ? ((6 - i) * value0 + (i - 1) * value1) / 5 : (i == 6 ? 0 : 255);
+    }
+    for (int i = 0; i < 16; i++)
+        out[i][channel] = palette[readBits(block, 16 + 3 * i, 3)];
+}
+
+// Mode 6 only, which is the only mode the encoder writes.
+static bool decodeBc7(std::span<const std::byte> block, DecodedBlock& out)
+{
+    if (readBits(block, 0, 7) != 1 << 6)
+        return false;
+    static constexpr std::array<int, 16> weights { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    const int pBit0 = int(readBits(block, 63, 1)), pBit1 = int(readBits(block, 64, 1));
+    for (int i = 0; i < 16; i++) {
+        const int index = int(i == 0 ? readBits(block, 65, 3) : readBits(block, 64 + 4 * i, 4));
+        for (int channel = 0; channel < 4; channel++) {
+            const int endpoint0 = int(readBits(block, 7 + 14 * channel, 7)) << 1 | pBit0;
+            const int endpoint1 = int(readBits(block, 14 + 14 * channel, 7)) << 1 | pBit1;
+            out[i][channel] = ((64 - weights[index]) * endpoint0 + weights[index] * endpoint1 + 32) >> 6;
+        }
+    }
+    return true;
+}
+
+// PSNR over the channels that the format stores; nullopt if a block could not be decoded.
+static std::optional<double> computePsnr(const Image& image, BlockFormat format, std::span<const std::byte> compressed)
+{
+    const int blocksX = (image.width + 3) / 4;
+    const size_t bytesPerBlock = blockSize(format);
+    const int numChannels = format == BlockFormat::BC1 ? 3 : (format == BlockFormat::BC5 ? 2 : 4);
+    double squaredError = 0.0;
+    for (int y = 0; y < image.height; y += 4) {
+        for (int x = 0; x < image.width; x += 4) {
+            const auto block = compressed.subspan((size_t(y / 4) * size_t(blocksX) + size_t(x / 4)) * bytesPerBlock, bytesPerBlock);
+            DecodedBlock decoded {};
+            switch (format) {
+            case BlockFormat::BC1:
+                decodeBc1(block, decoded);
+                break;
+            case BlockFormat::BC3:
+                decodeBc1(block.subspan(8), decoded);
+                decodeBc4(block.first(8), 3, decoded);
+                break;
+            case BlockFormat::BC5:
+                decodeBc4(block.first(8), 0, decoded);
+                decodeBc4(block.subspan(8), 1, decoded);
+                break;
+            case BlockFormat::BC7:
+                if (!decodeBc7(block, decoded))
+                    return {};
+                break;
+            }
+            for (int i = 0; i < 16; i++) {
+                const int imageX = x + i % 4, imageY = y + i / 4;
+                if (imageX >= image.width || imageY >= image.height)
+                    continue;
+                const uint8_t* pPixel = image.get_data() + (size_t(imageY) * size_t(image.width) + size_t(imageX)) * size_t(image.channels);
+                for (int channel = 0; channel < numChannels; channel++) {
+                    const int expected = channel < image.channels ? pPixel[channel] : (channel == 3 ? 255 : 0);
+                    squaredError += double((decoded[i][channel] - expected) * (decoded[i][channel] - expected));
+                }
+            }
+        }
+    }
+    const double meanSquaredError = squaredError / (double(image.width) * double(image.height) * double(numChannels));
+    return 10.0 * std::log10(255.0 * 255.0 / std::max(meanSquaredError, 1e-10));
+}
+
+int main(int argc, char** argv)
+{
+    std::optional<Image> image;
+    if (argc > 1) {
+        image.emplace(argv[1]);
+    } else {
+        image.emplace(1024, 1024, 4);
+        std::mt19937 rng { 1234 };
+        std::normal_distribution<float> noise { 0.0f, 8.0f };
+        for (int y = 0; y < image->height; y++) {
+            const auto row = image->row(y);
+            for (int x = 0; x < image->width; x++) {
+                const float edge = ((x / 64 + y / 64) % 2) ? 60.0f : 0.0f;
+                const float values[4] { float(x) / 4.0f + edge, float(y) / 4.0f, 128.0f + 100.0f * std::sin(float(x + y) / 40.0f), float(x ^ y) };
+                for (int channel = 0; channel < 4; channel++)
+                    row[size_t(4 * x + channel)] = uint8_t(std::clamp(values[channel] + noise(rng), 0.0f, 255.0f));
+            }
+        }
+    }
+    std::cout << fmt::format("{}x{}x{} image, {} worker threads\n", image->width, image->height, image->channels, ThreadPool::global().numThreads());
+
+    bool ok = true;
+    for (const auto& [format, name] : { std::pair { BlockFormat::BC1, "BC1" }, { BlockFormat::BC3, "BC3" }, { BlockFormat::BC5, "BC5" }, { BlockFormat::BC7, "BC7" } }) {
+        const auto start = std::chrono::steady_clock::now();
+        const std::vector<std::byte> compressed = compressImage(*image, format);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const auto psnr = computePsnr(*image, format, compressed);
+        ok &= psnr.has_value();
+        std::cout << fmt::format("{}: {:7.1f} ms, {:6.1f} Mpixels/s, {:5.2f} dB PSNR, {:.1f}x smaller\n", name, seconds * 1000.0,
+            double(image->width) * double(image->height) / seconds / 1e6, psnr.value_or(0.0), double(image->sizeInBytes()) / double(compressed.size()));
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "mesh.h"
+#include "ray.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+struct BvhHit {
+    // Sub mesh (index into the meshes the BVH was built from) and triangle within it.
+    uint32_t meshIndex;
+    uint32_t triangleIndex;
+    // Weights of the second and third vertex of the triangle at the hit point.
+    glm::vec2 barycentrics;
+};
+
+// Bounding volume hierarchy over the triangles of a set of meshes for ray casts (picking) and overlap tests
+// (collision). The tree is built top-down with binned SAH (surface area heuristic) splits; large subtrees are built in
+// parallel on ThreadPool::global(). The binary tree is then collapsed into a 4-wide tree, so that traversal tests
+// four child boxes, and leaves four triangles, at once (see simd.h).
+class Bvh {
+public:
+    // The positions are copied; the meshes do not have to outlive the BVH.
+    explicit Bvh(std::span<const Mesh> meshes);
+
+    // Closest triangle (either side) hit by ray.origin + t * ray.direction for 0 < t < ray.t. On a hit, ray.t is set
+    // to the distance of the hit and hit describes the triangle.
+    bool intersectRay(Ray& ray, BvhHit& hit) const;
+    // True if any triangle is closer than radius to center.
+    [[nodiscard]] bool overlapsSphere(const glm::vec3& center, float radius) const;
+    // True if any triangle is closer than radius to the line segment from a to b (a sphere swept from a to b).
+    [[nodiscard]] bool overlapsCapsule(const glm::vec3& a, const glm::vec3& b, float radius) const;
+
+    [[nodiscard]] size_t numTriangles() const { return m_triangleIds.size(); }
+    [[nodiscard]] size_t numNodes() const { return m_nodes.size(); }
+
+private:
+    // Child references: inner node index, or for leaves (bit 31 set) the first triangle packet in bits 0-27 and the
+    // number of packets minus one in bits 28-30.
+    static constexpr uint32_t leafFlag = 1u << 31;
+    static constexpr int packetCountShift = 28;
+
+    struct Node {
+        alignas(16) float minX[4];
+        float minY[4];
+        float minZ[4];
+        float maxX[4];
+        float maxY[4];
+        float maxZ[4];
+        uint32_t children[4];
+        uint32_t numChildren;
+    };
+
+    // Four triangles stored as vertex 0 and the two edges from it. Padding lanes are degenerate and have an invalid id.
+    struct TrianglePacket {
+        alignas(16) float v0[3][4];
+        float edge1[3][4];
+        float edge2[3][4];
+        uint32_t ids[4];
+    };
+    static constexpr uint32_t invalidTriangle = 0xFFFFFFFF;
+
+    struct BuildTriangle;
+    struct BuildNode;
+    static std::unique_ptr<BuildNode> buildNode(std::span<BuildTriangle> triangles, uint32_t first, int depth);
+    uint32_t flattenNode(const BuildNode& node, std::span<const BuildTriangle> triangles);
+    uint32_t emitLeaf(const BuildNode& node, std::span<const BuildTriangle> triangles);
+
+    // Depth-first traversal that descends into the children for which overlapsBoxes(node) sets the mask bit and calls
+    // visitTriangle(a, b, c) for the triangles in the leaves it reaches. Stops as soon as visitTriangle returns true.
+    template <typename OverlapsBoxes, typename VisitTriangle>
+    bool findAny(OverlapsBoxes&& overlapsBoxes, VisitTriangle&& visitTriangle) const;
+
+private:
+    std::vector<Node> m_nodes;
+    std::vector<TrianglePacket> m_packets;
+    // (mesh, triangle) of every triangle id.
+    std::vector<std::pair<uint32_t, uint32_t>> m_triangleIds;
+    // Child reference of the root, which is a leaf if there are only a few triangles.
+    uint32_t m_root { 0 };
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include "image.h"
+#include "mapped_file.h"
+#include "texture_compression.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Block-compressed copy of an image file including its full mip chain, baked offline (see tools/texture_baker.cpp).
+//
+// The copy is stored next to the image as "<file>.ktx", a regular KTX 1 container that standard tools can open,
+// and is keyed by a hash of the image file; it is ignored as soon as the image changes.
+// The file is memory-mapped, so the levels can be handed to glCompressedTexImage2D without a copy.
+class CompressedTexture {
+public:
+    // Hash of the image file and the encoder version.
+    [[nodiscard]] static uint64_t computeSourceHash(const std::filesystem::path& file);
+
+    // Map the compressed copy of file if it exists and was generated from an image with the given hash.
+    [[nodiscard]] static std::optional<CompressedTexture> load(const std::filesystem::path& file, uint64_t sourceHash);
+    // Compress the image and its mip chain (see generateMipChain()) and write (or overwrite) the compressed copy of
+    // file. Failures are reported but not fatal.
+    static void store(const std::filesystem::path& file, uint64_t sourceHash, const Image& image, BlockFormat format, const MipChainSettings& mipSettings = {});
+
+    [[nodiscard]] BlockFormat format() const { return m_format; }
+    // Matching OpenGL internal format, e.g. GL_COMPRESSED_RGBA_BPTC_UNORM for BlockFormat::BC7.
+    [[nodiscard]] uint32_t glInternalFormat() const { return m_glInternalFormat; }
+    [[nodiscard]] int width() const { return m_width; }
+    [[nodiscard]] int height() const { return m_height; }
+    // Level 0 is the full image, level i has a size of max(width >> i, 1) by max(height >> i, 1) pixels.
+    [[nodiscard]] std::span<const std::span<const std::byte>> levels() const { return m_levels; }
+
+private:
+    CompressedTexture() = default;
+
+private:
+    MappedFile m_file;
+    BlockFormat m_format;
+    uint32_t m_glInternalFormat;
+    int m_width, m_height;
+    std::vector<std::span<const std::byte>> m_levels;
+};
+
+[[nodiscard]] std::filesystem::path compressedTexturePath(const std::filesystem::path& file);
@@ -0,0 +1,74 @@
+#pragma once
+#include "disable_all_warnings.h"
+#include "opengl_includes.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <vector>
+
+// Captures the default framebuffer to image files without stalling the render loop.
+//
+// Every capture is read into the next buffer of a small ring of pixel pack buffers and guarded by a fence. The copy
+// runs asynchronously on the GPU; a few frames later, once the fence has signaled, update() maps the buffer, copies the
+// pixels out with a single memcpy and hands them to ThreadPool::global(), which flips and encodes them. The render thread only ever blocks when all
+// buffers are still in flight or when too many encodes are queued, both of which are counted in numStalls().
+//
+// The file type follows the extension of the path: ".png" or ".bmp" (much faster to encode, useful for long sequences).
+class FrameCapture {
+public:
+    explicit FrameCapture(size_t numBuffers = 3);
+    FrameCapture(const FrameCapture&) = delete;
+    // Waits for all captures to be written.
+    ~FrameCapture();
+
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Queue a readback of the current contents of the default framebuffer's back buffer. Call after rendering and
+    // before swapping buffers.
+    void capture(const glm::ivec2& size, const std::filesystem::path& filePath);
+    // Record every frame passed to update() as "<filePathPrefix>_000000<extension>", "<filePathPrefix>_000001<extension>", ...
+    void startSequence(const std::filesystem::path& filePathPrefix, const std::filesystem::path& extension = ".bmp");
+    void stopSequence();
+    [[nodiscard]] bool isRecording() const { return m_recording; }
+    [[nodiscard]] uint32_t numSequenceFrames() const { return m_sequenceFrame; }
+
+    // Call once per frame, after rendering and before swapping buffers: captures the frame if a sequence is being
+    // recorded and passes finished readbacks on to the encoders.
+    void update(const glm::ivec2& size);
+    // Wait until all queued captures have been written to disk.
+    void flush();
+
+    // Captures that are still being read back or encoded.
+    [[nodiscard]] size_t numPending() const;
+    [[nodiscard]] size_t numStalls() const { return m_numStalls; }
+
+private:
+    struct Readback {
+        GLuint buffer;
+        GLsync fence { nullptr };
+        glm::ivec2 size;
+        std::filesystem::path filePath;
+    };
+
+    // Readback of the oldest buffer in flight: wait for it if requested, otherwise only if it has already finished.
+    bool retireOldest(bool wait);
+    void encode(Readback& readback);
+
+private:
+    std::vector<Readback> m_readbacks;
+    // Indices into m_readbacks of the buffers in flight, oldest first.
+    std::deque<size_t> m_inFlight;
+    size_t m_nextBuffer { 0 };
+    std::deque<std::future<void>> m_encodes;
+    size_t m_numStalls { 0 };
+
+    bool m_recording { false };
+    std::filesystem::path m_sequencePrefix;
+    std::filesystem::path m_sequenceExtension;
+    uint32_t m_sequenceFrame { 0 };
+};
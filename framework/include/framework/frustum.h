@@ -0,0 +1,66 @@
+#pragma once
+#include "disable_all_warnings.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// View frustum as six inward facing planes (xyz = unit normal, w = offset), extracted from a (model-)view-projection
+// matrix with the method of Gribb and Hartmann. The planes are in the space that the matrix transforms from, so
+// passing projection * view * model yields object space planes.
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        // Rows of the matrix (glm matrices are column major).
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        planes = { rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2] };
+        for (glm::vec4& plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    [[nodiscard]] bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        for (const glm::vec4& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Axis aligned bounding boxes in structure of arrays layout, so that cullBoxes() can test four of them at a time. The
+// arrays are padded to a multiple of four with empty boxes, which no frustum intersects.
+class BoundingBoxes {
+public:
+    void clear();
+    void push_back(const glm::vec3& boxMin, const glm::vec3& boxMax);
+    // Box that bounds the given box after it is transformed by an affine matrix.
+    void push_back(const glm::mat4& transform, const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+    [[nodiscard]] size_t size() const { return m_size; }
+    [[nodiscard]] bool empty() const { return m_size == 0; }
+
+private:
+    friend size_t cullBoxes(const Frustum& frustum, const BoundingBoxes& boxes, std::span<uint8_t> visible);
+
+    size_t m_size { 0 };
+    std::array<std::vector<float>, 3> m_min;
+    std::array<std::vector<float>, 3> m_max;
+};
+
+// Set visible[i] to 1 if box i intersects the frustum and to 0 otherwise; returns the number of visible boxes.
+// visible must have room for boxes.size() entries. Boxes that are not entirely outside of one plane count as visible,
+// so a few boxes near the corners of the frustum are kept although they are outside of it.
+size_t cullBoxes(const Frustum& frustum, const BoundingBoxes& boxes, std::span<uint8_t> visible);
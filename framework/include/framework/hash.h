@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+// Final mixing step of MurmurHash3 (fmix64); spreads every input bit over the whole word.
+constexpr uint64_t hashMix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// Fast non-cryptographic hash for large blobs such as file contents.
+// Consumes 32 bytes per iteration in four independent lanes so it is not bound by multiply latency.
+inline uint64_t hashBytes(std::span<const std::byte> bytes, uint64_t seed = 0)
+{
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15ull;
+    uint64_t lanes[4] = { seed ^ prime, seed + prime, ~seed, seed * prime + 1 };
+
+    const std::byte* pData = bytes.data();
+    size_t remaining = bytes.size();
+    while (remaining >= 32) {
+        for (uint64_t& lane : lanes) {
+            uint64_t word;
+            std::memcpy(&word, pData, sizeof(word));
+            lane = (lane ^ hashMix(word)) * prime;
+            pData += sizeof(word);
+        }
+        remaining -= 32;
+    }
+
+    uint64_t tail[4] = { 0, 0, 0, 0 };
+    if (remaining > 0)
+        std::memcpy(tail, pData, remaining);
+
+    uint64_t hash = bytes.size() * prime;
+    for (int i = 0; i < 4; i++)
+        hash = (hash ^ hashMix(lanes[i] ^ tail[i])) * prime;
+    return hashMix(hash);
+}
+
+inline uint64_t hashBytes(std::string_view str, uint64_t seed = 0)
+{
+    return hashBytes(std::as_bytes(std::span(str.data(), str.size())), seed);
+}
+
+// Hash for short strings such as identifiers; usable at compile time (FNV-1a followed by hashMix()).
+constexpr uint64_t hashString(std::string_view str)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : str)
+        hash = (hash ^ uint64_t(uint8_t(c))) * 0x100000001b3ull;
+    return hashMix(hash);
+}
@@ -7,23 +7,38 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <span>
 #include <vector>
 
 
+// 8-bit image with tightly packed rows, top row first.
 struct Image {
 public:
     explicit Image(const std::filesystem::path& filePath);
+    // Zero-initialized image.
+    Image(int imageWidth, int imageHeight, int imageChannels);
+    Image(const Image&) = delete;
+    Image(Image&&) = default;
 
+    Image& operator=(const Image&) = delete;
+    Image& operator=(Image&&) = default;
 
     void writeBitmapToFile(const std::filesystem::path& filePath);
+    // Lossless, and unlike bitmaps keeps one- and two-channel images as they are. Returns false (and leaves no partial
+    // file behind) if the file could not be written.
+    bool writePngToFile(const std::filesystem::path& filePath) const;
 
 public:
     int width, height, channels;
     template<int image_channels = 3> glm::vec<image_channels, float>get_pixel(const int index) const {
         //Template argument should equal actual image channels
         assert(image_channels == channels);
-        
+
         glm::vec<image_channels, float> pixel;
         for (int channel = 0; channel < image_channels; channel++) {
             pixel[channel] = pixels[index * image_channels + channel] / 255.0f;
@@ -35,16 +50,79 @@ public:
     template<int image_channels = 3> void set_pixel(const int index, glm::vec<image_channels, float> value) {
         //Template argument should equal actual image channels
         assert(image_channels == channels);
-        
+
         for (int channel = 0; channel < image_channels; channel++) {
             pixels[index * image_channels + channel] = (uint8_t) (value[channel] * 255.0f);
         }
     }
 
     uint8_t* get_data() {
-        return pixels.data();
+        return pixels.get();
+    }
+
+    const uint8_t* get_data() const {
+        return pixels.get();
+    }
+
+    // All pixels, or the pixels of one row, for the bulk conversions below.
+    [[nodiscard]] size_t sizeInBytes() const { return size_t(width) * size_t(height) * size_t(channels); }
+    [[nodiscard]] std::span<uint8_t> data() { return { pixels.get(), sizeInBytes() }; }
+    [[nodiscard]] std::span<const uint8_t> data() const { return { pixels.get(), sizeInBytes() }; }
+    [[nodiscard]] std::span<uint8_t> row(int y) { return data().subspan(rowOffset(y), rowSize()); }
+    [[nodiscard]] std::span<const uint8_t> row(int y) const { return data().subspan(rowOffset(y), rowSize()); }
+
+private:
+    [[nodiscard]] size_t rowSize() const { return size_t(width) * size_t(channels); }
+    [[nodiscard]] size_t rowOffset(int y) const
+    {
+        assert(y >= 0 && y < height);
+        return size_t(y) * rowSize();
     }
 
 private:
-    std::vector<uint8_t> pixels;
+    // Owns the buffer returned by stb_image (or allocated by the constructor) without copying it.
+    struct PixelDeleter {
+        void operator()(uint8_t* pPixels) const;
+    };
+    std::unique_ptr<uint8_t[], PixelDeleter> pixels;
 };
+
+// Bulk pixel conversions over whole rows or images, processing four channels per step with Float4 (see simd.h).
+// Sizes are in channels (bytes or floats) unless noted otherwise, and target must be at least as large as required.
+
+// x / 255.
+void convertU8ToFloat(std::span<const uint8_t> source, std::span<float> target);
+// Inverse of convertU8ToFloat: rounds to nearest and saturates to [0, 255].
+void convertFloatToU8(std::span<const float> source, std::span<uint8_t> target);
+// Appends the given alpha to every pixel; target receives 4 * source.size() / 3 bytes.
+void convertRgbToRgba(std::span<const uint8_t> source, std::span<uint8_t> target, uint8_t alpha = 255);
+// Multiplies the color channels of RGBA pixels by their alpha, in place.
+void premultiplyAlpha(std::span<uint8_t> rgbaPixels);
+// Decodes sRGB encoded pixels with the given number of channels to linear floats in [0, 1]. The alpha channel of
+// images with two or four channels is stored linearly and only rescaled.
+void convertSrgbToLinear(std::span<const uint8_t> source, std::span<float> target, int channels);
+
+// Combine the first channel of every source (e.g. single-channel ambient occlusion, roughness and height maps) into
+// one image with a channel per source, in the given order. All sources must have the same size.
+[[nodiscard]] Image packChannels(std::span<const Image* const> sources);
+
+struct MipChainSettings {
+    enum class Filter {
+        // Average of the source pixels covered by a pixel (2x2 for even sizes). Cheap, but slightly blurry and prone to
+        // aliasing.
+        Box,
+        // Windowed sinc (Kaiser window, 3 pixels wide on either side). Keeps the smaller levels sharper.
+        Kaiser
+    };
+    Filter filter { Filter::Kaiser };
+    // The color channels are sRGB encoded and are filtered after conversion to linear. Alpha is always linear.
+    bool srgb { true };
+    // The first three channels store unit vectors as (n + 1) / 2, as in tangent-space normal maps. They are filtered
+    // as vectors and renormalized (this overrides srgb).
+    bool normalMap { false };
+};
+
+// Successively halved copies of the image (rounding down, at least 1x1), starting with the level below the image
+// itself and ending at 1x1. Each level is filtered from the previous one at float precision; rows are processed in
+// parallel on ThreadPool::global(), four channels at a time (see simd.h). Pixels outside the image repeat the edge.
+[[nodiscard]] std::vector<Image> generateMipChain(const Image& image, const MipChainSettings& settings = {});
@@ -0,0 +1,50 @@
+#pragma once
+#include "image.h"
+#include <atomic>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cache of decoded images keyed by canonical file path.
+//
+// Every file is decoded at most once while someone holds on to it: concurrent requests for the same file wait
+// for the first decode instead of starting their own. The cache only keeps weak references, so the pixels are
+// freed as soon as the last user (e.g. a Material or a pending GPU upload) releases its handle.
+class ImageCache {
+public:
+    using ImageFuture = std::shared_future<std::shared_ptr<Image>>;
+
+    // Process-wide cache shared by the loaders in the framework.
+    static ImageCache& global();
+
+    // Return the decoded image, reusing a live copy if there is one. Thread-safe.
+    // A decode that was requested with loadAsync but has not started yet is run on the calling thread, so this never
+    // waits for unrelated work queued on the thread pool (and cannot deadlock when called from a pool task).
+    [[nodiscard]] std::shared_ptr<Image> load(const std::filesystem::path& filePath);
+    // Start decoding on ThreadPool::global() and return immediately. Requesting all images up front and then
+    // calling load() for each decodes them concurrently. The image is kept alive by the returned future.
+    [[nodiscard]] ImageFuture loadAsync(const std::filesystem::path& filePath);
+
+private:
+    // A decode that is run by whichever thread claims it first: a pool worker or a thread calling load().
+    struct DecodeJob {
+        std::filesystem::path filePath;
+        std::string key;
+        std::atomic_flag claimed;
+        std::promise<std::shared_ptr<Image>> promise;
+        ImageFuture future;
+    };
+
+    // Returns the live image for key, or else the job that (will) decode it, creating one if needed.
+    std::shared_ptr<Image> findOrCreateJob(const std::filesystem::path& filePath, std::shared_ptr<DecodeJob>& pJob, bool& isNewJob);
+    void runJob(DecodeJob& job);
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::weak_ptr<Image>> m_images;
+    // Images that are queued for decoding or being decoded.
+    std::unordered_map<std::string, std::shared_ptr<DecodeJob>> m_pending;
+};
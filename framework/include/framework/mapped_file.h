@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+
+struct FileMappingException : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Read-only memory mapping of a file. The mapped bytes stay valid for the lifetime of the object.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::filesystem::path& filePath);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) noexcept;
+    ~MappedFile();
+
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&&) noexcept;
+
+    [[nodiscard]] std::span<const std::byte> data() const { return { m_pData, m_size }; }
+    [[nodiscard]] size_t size() const { return m_size; }
+
+private:
+    void moveInto(MappedFile&&);
+    void unmap();
+
+private:
+    const std::byte* m_pData { nullptr };
+    size_t m_size { 0 };
+#ifdef _WIN32
+    void* m_fileHandle { nullptr };
+    void* m_mappingHandle { nullptr };
+#endif
+};
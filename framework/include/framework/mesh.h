@@ -34,7 +34,11 @@ struct Material
     // if (material.kdTexture) {
     //   material.kdTexture->getTexel(...);
     // }
+    //
+    // Materials that reference the same file share one decoded image (see image_cache.h).
     std::shared_ptr<Image> kdTexture;
+    // File that kdTexture was loaded from (empty if the material is not textured).
+    std::filesystem::path kdTexturePath;
 };
 
 struct Mesh
@@ -51,10 +55,31 @@ struct LoadMeshSettings
 {
     bool normalizeVertexPositions{false};
     bool cacheVertices{true};
+    // Additionally merge vertices with identical attributes that were referenced through different OBJ indices
+    // (e.g. duplicated positions of separate objects that share a material).
+    bool weldVertices{false};
+    // Fill in the tangents and bitangents of the vertices (see meshComputeTangents).
+    bool computeTangents{true};
+    // Reorder triangles and vertices of every sub mesh for vertex cache efficiency and overdraw (see
+    // mesh_optimizer.h) and print the vertex cache statistics before and after.
+    bool optimizeMeshes{false};
+    // Reuse the binary cache of a previous load (see mesh_cache.h) when the sources did not change.
+    bool useMeshCache{true};
+    // Parse with the multithreaded OBJ parser; set to false to use the (slower) tinyobjloader path instead.
+    bool parallelObjParser{true};
+    // Decode the diffuse textures into Material::kdTexture. Turn off if only Material::kdTexturePath is needed, e.g.
+    // when the texture is loaded from its baked or cached copy (see TextureLevels) and the decode would be wasted.
+    bool decodeTextures{true};
 };
 
 [[nodiscard]] std::vector<Mesh> loadMesh(const std::filesystem::path& file, const LoadMeshSettings& settings = {});
 [[nodiscard]] Mesh              mergeMeshes(std::span<const Mesh> meshes);
+// Merge vertices whose attributes are identical (for example after mergeMeshes) and remap the triangles.
+void                            meshWeldVertices(Mesh& mesh);
+// Compute per-vertex tangents and bitangents from the texture coordinates, matching MikkTSpace (the convention that
+// normal maps are baked with): the bitangent is sign * cross(normal, tangent). Vertices shared by triangles with
+// mirrored and non-mirrored texture mapping are split in two. Runs in parallel on ThreadPool::global().
+void                            meshComputeTangents(Mesh& mesh);
 void                            meshFlipX(Mesh& mesh);
 void                            meshFlipY(Mesh& mesh);
 void                            meshFlipZ(Mesh& mesh);
\ No newline at end of file
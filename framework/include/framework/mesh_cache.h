@@ -0,0 +1,43 @@
+#pragma once
+#include "mapped_file.h"
+#include "mesh.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Binary cache of the sub meshes that loadMesh() produces for a model file.
+//
+// The cache is stored next to the model as "<file>.meshcache" and is keyed by a hash of the OBJ file, the
+// MTL files it references and the load settings; it is regenerated whenever any of those change.
+// The file is memory-mapped, so vertex and index data can be handed to glBufferData without a copy.
+class MeshCache {
+public:
+    struct SubMesh {
+        std::span<const Vertex> vertices;
+        std::span<const glm::uvec3> triangles;
+        Material material;
+    };
+
+    // Hash of everything that influences the output of loadMesh(file, settings).
+    [[nodiscard]] static uint64_t computeSourceHash(const std::filesystem::path& file, const LoadMeshSettings& settings);
+
+    // Map the cache belonging to file if it exists and was generated from sources with the given hash.
+    [[nodiscard]] static std::optional<MeshCache> load(const std::filesystem::path& file, uint64_t sourceHash);
+    // Write (or overwrite) the cache belonging to file. Failures are reported but not fatal.
+    static void store(const std::filesystem::path& file, uint64_t sourceHash, std::span<const Mesh> meshes);
+
+    [[nodiscard]] std::span<const SubMesh> subMeshes() const { return m_subMeshes; }
+    // Copy the mapped data into regular meshes, and decode their material textures unless decodeTextures is false.
+    [[nodiscard]] std::vector<Mesh> toMeshes(bool decodeTextures = true) const;
+
+private:
+    MeshCache() = default;
+
+private:
+    MappedFile m_file;
+    std::vector<SubMesh> m_subMeshes;
+};
+
+[[nodiscard]] std::filesystem::path meshCachePath(const std::filesystem::path& file);
@@ -0,0 +1,46 @@
+#pragma once
+#include "mesh.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Post-import optimizations of the index and vertex order of a mesh. None of them change the geometry; they only
+// make the GPU do less work when drawing it:
+//  - optimizeVertexCache reorders triangles so that the post-transform vertex cache is hit more often
+//    (Forsyth, "Linear-Speed Vertex Cache Optimisation").
+//  - optimizeOverdraw reorders clusters of triangles so that outward facing parts are drawn first, without
+//    giving up vertex cache efficiency (Sander et al., "Fast Triangle Reordering for Vertex Locality and
+//    Reduced Overdraw").
+//  - computeVertexFetchRemap orders the vertices by first use, so that vertex fetching reads memory linearly.
+
+struct VertexCacheStatistics {
+    // Average cache miss ratio: transformed vertices per triangle (3 is worst, ~0.5 is optimal for regular grids).
+    float acmr;
+    // Average transformed vertex ratio: transformed vertices per referenced vertex (1 is optimal).
+    float atvr;
+};
+
+struct MeshOptimizationStatistics {
+    VertexCacheStatistics before;
+    VertexCacheStatistics after;
+};
+
+// Simulate a FIFO post-transform cache of the given size (a conservative model of current GPUs).
+[[nodiscard]] VertexCacheStatistics analyzeVertexCache(std::span<const glm::uvec3> triangles, size_t numVertices, unsigned cacheSize = 16);
+
+void optimizeVertexCache(std::span<glm::uvec3> triangles, size_t numVertices);
+// Should run after optimizeVertexCache; the cluster boundaries are derived from the cache behavior of that order.
+void optimizeOverdraw(std::span<glm::uvec3> triangles, std::span<const Vertex> vertices);
+// New index of every vertex (remap[oldIndex]) such that vertices are ordered by their first use in triangles.
+// Vertices that are not referenced are moved to the end.
+[[nodiscard]] std::vector<uint32_t> computeVertexFetchRemap(std::span<const glm::uvec3> triangles, size_t numVertices);
+
+// Run all of the above on the mesh and report the vertex cache efficiency before and after.
+MeshOptimizationStatistics meshOptimize(Mesh& mesh);
+// Reorder the vertices of the mesh according to a remap computed by computeVertexFetchRemap.
+void meshRemapVertices(Mesh& mesh, std::span<const uint32_t> remap);
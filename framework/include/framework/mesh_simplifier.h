@@ -0,0 +1,38 @@
+#pragma once
+#include "mesh.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// Quadric error metric simplification (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics").
+// Edges are collapsed onto one of their existing vertices, so every simplified index buffer can be drawn with the
+// vertex buffer of the original mesh. Vertices on texture/normal seams (several vertices with the same position)
+// never move, so the simplified mesh does not tear along them.
+
+struct SimplifySettings {
+    // Keep every vertex on an open boundary in place. Required when neighbouring meshes (like terrain tiles) are
+    // simplified independently and must keep matching along their shared edges.
+    bool lockBorder { false };
+};
+
+struct MeshLod {
+    std::vector<glm::uvec3> triangles;
+    // Estimated largest distance (in mesh units) between the simplified and the original surface.
+    float error;
+};
+
+// Collapse edges in order of increasing error until at most targetTriangleCount triangles remain or no edge can be
+// collapsed without flipping a triangle. Returns the resulting triangles; pResultError receives their error.
+[[nodiscard]] std::vector<glm::uvec3> simplifyMesh(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices,
+    size_t targetTriangleCount, const SimplifySettings& settings = {}, float* pResultError = nullptr);
+
+// Chain of increasingly coarse levels of detail (excluding the original mesh), each with about reductionPerLevel
+// times the triangles of the previous one. Stops early when a level would not be meaningfully smaller. The levels are
+// optimized for the vertex cache.
+[[nodiscard]] std::vector<MeshLod> generateLodChain(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices,
+    const SimplifySettings& settings = {}, size_t maxLevels = 6, float reductionPerLevel = 0.5f);
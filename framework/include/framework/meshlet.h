@@ -0,0 +1,40 @@
+#pragma once
+#include "mesh.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Contiguous range of triangles in the index buffer of a mesh with bounds for per-cluster culling.
+struct Meshlet {
+    uint32_t firstTriangle;
+    uint32_t numTriangles;
+
+    // Bounding sphere of the vertices.
+    glm::vec3 center;
+    float radius;
+
+    // Normal cone: every triangle faces away from a viewpoint for which isMeshletBackfacing returns true.
+    // coneCutoff is larger than 1 if the normals are spread too far for the cone to ever cull.
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// Split the triangles into meshlets of at most maxTriangles triangles and maxVertices unique vertices, following the
+// existing triangle order (run optimizeVertexCache from mesh_optimizer.h first so that the order is spatially
+// coherent). A meshlet also ends early when a triangle would widen its normal cone beyond 90 degrees.
+[[nodiscard]] std::vector<Meshlet> buildMeshlets(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices,
+    uint32_t maxTriangles = 128, uint32_t maxVertices = 64);
+
+// Conservative: only returns true if all triangles of the meshlet are back-facing as seen from viewpoint, which must
+// be in the same space as the mesh.
+[[nodiscard]] inline bool isMeshletBackfacing(const Meshlet& meshlet, const glm::vec3& viewpoint)
+{
+    const glm::vec3 toCenter = meshlet.center - viewpoint;
+    return glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
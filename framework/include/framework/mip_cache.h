@@ -0,0 +1,44 @@
+#pragma once
+#include "image.h"
+#include "mapped_file.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Binary cache of an image file together with the mip chain that generateMipChain() produces for it.
+//
+// The cache is stored next to the image as "<file>.mipcache" and is keyed by a hash of the image file and the mip
+// settings; it is regenerated whenever either of those change. The file is memory-mapped, so all levels can be
+// handed to glTexImage2D without decoding or filtering anything.
+class MipCache {
+public:
+    struct Level {
+        int width, height;
+        // Tightly packed rows, top row first.
+        std::span<const uint8_t> pixels;
+    };
+
+    // Hash of everything that influences the output of generateMipChain(Image(file), settings).
+    [[nodiscard]] static uint64_t computeSourceHash(const std::filesystem::path& file, const MipChainSettings& settings);
+
+    // Map the cache belonging to file if it exists and was generated from sources with the given hash.
+    [[nodiscard]] static std::optional<MipCache> load(const std::filesystem::path& file, uint64_t sourceHash);
+    // Write (or overwrite) the cache belonging to file. Failures are reported but not fatal.
+    static void store(const std::filesystem::path& file, uint64_t sourceHash, const Image& image, std::span<const Image> mipChain);
+
+    [[nodiscard]] int channels() const { return m_channels; }
+    // Level 0 is the image itself, followed by its mip chain.
+    [[nodiscard]] std::span<const Level> levels() const { return m_levels; }
+
+private:
+    MipCache() = default;
+
+private:
+    MappedFile m_file;
+    int m_channels;
+    std::vector<Level> m_levels;
+};
+
+[[nodiscard]] std::filesystem::path mipCachePath(const std::filesystem::path& file);
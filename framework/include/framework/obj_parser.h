@@ -0,0 +1,48 @@
+#pragma once
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct ObjMaterial {
+    std::string name;
+    glm::vec3 kd { 0.0f };
+    glm::vec3 ks { 0.0f };
+    float shininess { 1.0f };
+    float transparency { 1.0f };
+    std::filesystem::path diffuseTexture; // Empty if the material has no map_Kd.
+};
+
+// Zero-based indices into the attribute arrays of ObjData; -1 if the attribute was not specified.
+struct ObjIndex {
+    int32_t position;
+    int32_t texCoord;
+    int32_t normal;
+};
+
+// All triangles that use the same material, in file order.
+struct ObjFaceGroup {
+    int32_t material; // Index into ObjData::materials or -1 for faces without (a known) material.
+    std::vector<ObjIndex> corners; // Three consecutive corners form a triangle.
+};
+
+struct ObjData {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::vector<ObjMaterial> materials;
+    // One group per material, ordered by first use in the file. Polygons are fan-triangulated.
+    std::vector<ObjFaceGroup> faceGroups;
+};
+
+// Parse an OBJ file (and the MTL files it references) on all cores of the global thread pool.
+// The file is memory-mapped and split into line-aligned chunks that are parsed independently.
+[[nodiscard]] ObjData parseObj(const std::filesystem::path& file);
+// Single-threaded reference implementation on top of tinyobjloader; produces the same ObjData.
+[[nodiscard]] ObjData parseObjTinyObj(const std::filesystem::path& file);
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Draws of one frame, submitted in any order by the systems that produce them and executed in the order of their sort
+// keys. Keys are built with makeOpaqueSortKey() or makeTranslucentSortKey(), so that each pass runs completely before
+// the next one, opaque draws run before translucent ones, and draws within a pass need as few state changes as
+// possible.
+//
+// A draw packet is a sort key and a function that makes the OpenGL calls of the draw. Everything that the function
+// refers to has to stay alive until execute() returns.
+class RenderQueue {
+public:
+    // Called with the data pointer that was submitted along with it.
+    using DrawFunction = void (*)(const void* pData);
+
+    void submit(uint64_t sortKey, DrawFunction draw, const void* pData);
+    // Copies the callable (typically a lambda) into memory that the queue reuses from frame to frame, so that submitting
+    // does not allocate once the queue has seen a frame's worth of draws. It is never destroyed, so it has to be
+    // trivially copyable and destructible, as are lambdas that only capture references and pointers.
+    template <typename Draw>
+    void submit(uint64_t sortKey, const Draw& draw)
+    {
+        static_assert(std::is_trivially_copyable_v<Draw> && std::is_trivially_destructible_v<Draw>);
+        const Draw* pDraw = ::new (allocate(sizeof(Draw), alignof(Draw))) Draw(draw);
+        submit(sortKey, [](const void* pData) { (*static_cast<const Draw*>(pData))(); }, pDraw);
+    }
+    // Sort the packets with a radix sort and run them in order of increasing key; packets with equal keys run in the
+    // order in which they were submitted. Leaves the queue empty, but keeps its memory for the next frame.
+    void execute();
+
+    [[nodiscard]] size_t numPackets() const { return m_packets.size(); }
+
+private:
+    struct Packet {
+        uint64_t sortKey;
+        // Index into m_draws; only the keys and indices are moved around while sorting.
+        uint32_t draw;
+    };
+    struct Draw {
+        DrawFunction function;
+        const void* pData;
+    };
+
+    // Memory for the callables of this frame's packets; released by execute() for the next frame.
+    void* allocate(size_t size, size_t alignment);
+
+private:
+    std::vector<Packet> m_packets;
+    std::vector<Packet> m_scratch;
+    std::vector<Draw> m_draws;
+
+    // Fixed size blocks that are filled one after the other; m_blocks[m_block] is being filled up to m_blockOffset.
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    size_t m_block { 0 };
+    size_t m_blockOffset { 0 };
+};
+
+// Sort keys, from the most significant bit down:
+//   opaque:      pass (4 bits) | 0 | shader (12 bits) | material (15 bits) | depth (32 bits)
+//   translucent: pass (4 bits) | 1 | inverted depth (32 bits) | shader (12 bits) | material (15 bits)
+// Opaque draws are grouped by shader and then by material, and go front to back within a group so that the depth
+// test rejects hidden fragments early. Translucent draws have to be blended back to front, so depth comes first.
+// Shader and material are arbitrary ids (e.g. the program name) of which only the low bits are used; depth is the
+// distance to the viewer, negative values count as 0.
+constexpr uint32_t maxRenderPasses = 16;
+[[nodiscard]] uint64_t makeOpaqueSortKey(uint32_t pass, uint32_t shader, uint32_t material, float depth);
+[[nodiscard]] uint64_t makeTranslucentSortKey(uint32_t pass, uint32_t shader, uint32_t material, float depth);
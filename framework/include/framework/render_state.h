@@ -0,0 +1,78 @@
+#pragma once
+#include "opengl_includes.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Shadow copy of the OpenGL state that the render loop changes most often: the program, the vertex array, the
+// textures bound to each unit, the framebuffer and blend, depth and cull state.
+//
+// Every change that would leave the state as it is is dropped before it reaches the driver. This only works if all
+// changes to the tracked state go through here; code that changes it directly (such as the ImGui renderer, see
+// Window::swapBuffers()) has to call invalidate() afterwards. Deleting a tracked object must be reported with the
+// matching forget function, since OpenGL may hand out the same name again.
+class RenderState {
+public:
+    struct Counters {
+        // State changes passed on to OpenGL and state changes dropped because they had no effect.
+        size_t issued { 0 };
+        size_t elided { 0 };
+    };
+
+    // State of the (single) OpenGL context of the application.
+    static RenderState& global();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+    // Bind a texture to a texture unit (0, 1, ...), selecting the unit only when needed. Targets other than
+    // GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP and units beyond maxTrackedTextureUnits are passed on untracked.
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    // Bind a framebuffer for both drawing and reading.
+    void bindFramebuffer(GLuint framebuffer);
+
+    // Only GL_BLEND, GL_CULL_FACE and GL_DEPTH_TEST are tracked; other capabilities are passed on untracked.
+    void setEnabled(GLenum capability, bool enabled);
+    void blendFunc(GLenum sourceFactor, GLenum destinationFactor);
+    void cullFace(GLenum face);
+    void depthFunc(GLenum func);
+    void depthMask(bool enabled);
+
+    void forgetProgram(GLuint program);
+    void forgetVertexArray(GLuint vertexArray);
+    void forgetTexture(GLuint texture);
+    void forgetFramebuffer(GLuint framebuffer);
+    // Mark all state as unknown, so that the next change of each piece of state is passed on.
+    void invalidate();
+
+    [[nodiscard]] const Counters& counters() const { return m_counters; }
+    void resetCounters() { m_counters = {}; }
+
+    static constexpr GLuint maxTrackedTextureUnits = 16;
+
+private:
+    RenderState();
+
+    // Record whether cached already holds value and update it; returns true if OpenGL has to be called.
+    template <typename T>
+    bool change(T& cached, T value);
+
+private:
+    // Value of any piece of state that is unknown; no OpenGL object or enum uses it.
+    static constexpr GLuint unknown = 0xFFFFFFFF;
+    static constexpr size_t numTrackedCapabilities = 3;
+    static constexpr size_t numTrackedTextureTargets = 2;
+
+    GLuint m_program;
+    GLuint m_vertexArray;
+    GLuint m_activeTextureUnit;
+    std::array<std::array<GLuint, numTrackedTextureTargets>, maxTrackedTextureUnits> m_textures;
+    GLuint m_framebuffer;
+    // 0 or 1 for disabled or enabled, in the order of trackedCapabilities in render_state.cpp.
+    std::array<GLuint, numTrackedCapabilities> m_capabilities;
+    std::array<GLenum, 2> m_blendFunc;
+    GLenum m_cullFace;
+    GLenum m_depthFunc;
+    GLuint m_depthMask;
+
+    Counters m_counters;
+};
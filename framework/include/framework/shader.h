@@ -1,5 +1,6 @@
 #pragma once
 #include "disable_all_warnings.h"
+#include "hash.h"
 #include "opengl_includes.h"
 DISABLE_WARNINGS_PUSH()
 #include <glm/mat3x3.hpp>
@@ -8,14 +9,42 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 struct ShaderLoadingException : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+// Name of a uniform or uniform block. String literals are hashed at compile time, so looking one up in a Shader does
+// no string handling at all. Names that are built at run time have to be converted explicitly.
+struct ShaderName {
+    template <size_t N>
+    consteval ShaderName(const char (&literal)[N])
+        : hash(hashString({ literal, N - 1 }))
+        , name(literal, N - 1)
+    {
+    }
+    explicit constexpr ShaderName(std::string_view runtimeName)
+        : hash(hashString(runtimeName))
+        , name(runtimeName)
+    {
+    }
+
+    uint64_t hash;
+    // Only used for error messages.
+    std::string_view name;
+};
+
 class Shader {
 public:
     Shader();
@@ -29,22 +58,73 @@ public:
     void bind() const;
 
     // Bind the uniform define by the given name to the given buffer and location in its assigned block, 
-    void bindUniformBlock(const std::string& blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const;
+    void bindUniformBlock(ShaderName blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const;
+    // Only assign the block to a binding location (the buffer is bound separately, e.g. once per frame). Does nothing if
+    // the block already uses that location or if the program has no such block.
+    void setUniformBlockBinding(ShaderName blockName, GLuint bindingLocation) const;
 
     // Query an attribute location by its name in the shader
     GLuint getAttributeLocation(const std::string& name) const;
     
-    // Query a uniform location by its name in the shader
+    // Query a uniform location by its name in the shader.
+    // Prefer setUniform(), which skips redundant updates; values set through the location are not tracked.
     GLint getUniformLocation(const std::string& name) const;
 
+    // Set a uniform of this program; it does not need to be bound. The last value of every uniform is remembered, so
+    // setting the value that a uniform already has makes no OpenGL call at all. Uniforms that the program does not
+    // use (or that the compiler removed) are ignored.
+    // Elements of arrays are addressed as "name[i]" and members of structs as "name.member".
+    void setUniform(ShaderName name, bool value) const;
+    void setUniform(ShaderName name, int value) const;
+    void setUniform(ShaderName name, float value) const;
+    void setUniform(ShaderName name, const glm::vec2& value) const;
+    void setUniform(ShaderName name, const glm::vec3& value) const;
+    void setUniform(ShaderName name, const glm::vec4& value) const;
+    void setUniform(ShaderName name, const glm::mat3& value) const;
+    void setUniform(ShaderName name, const glm::mat4& value) const;
+    [[nodiscard]] bool hasUniform(ShaderName name) const;
+
+    // OpenGL name of the program, e.g. to group draws that use the same program.
+    [[nodiscard]] GLuint program() const { return m_program; }
+
 private:
     friend class ShaderBuilder;
     Shader(GLuint program);
 
+    // Active uniform or uniform block, found by the hash of its name.
+    struct Uniform {
+        uint64_t nameHash;
+        GLint location;
+        // Copy of the last value that was set, if any; large enough for a mat4.
+        bool hasValue { false };
+        std::array<std::byte, sizeof(glm::mat4)> value {};
+    };
+    struct UniformBlock {
+        uint64_t nameHash;
+        GLuint index;
+        GLuint binding;
+    };
+
+    // Fill the tables with the active uniforms and uniform blocks of the linked program.
+    void reflect();
+    [[nodiscard]] Uniform* findUniform(uint64_t nameHash) const;
+    [[nodiscard]] UniformBlock* findUniformBlock(uint64_t nameHash) const;
+    template <typename T, typename Upload>
+    void setUniformValue(ShaderName name, const T& value, Upload&& upload) const;
+
 private:
     GLuint m_program;
+    // Sorted by name hash. The tables mirror the state of the program, which the const setters change.
+    mutable std::vector<Uniform> m_uniforms;
+    mutable std::vector<UniformBlock> m_uniformBlocks;
 };
 
+// Compiles and links shader programs.
+//
+// Linked programs are cached as driver-specific binaries next to the last stage's source, in
+// "<file>.<stage hash>.programcache", keyed by a hash of all stage sources, the defines and the OpenGL vendor, renderer and version
+// strings. build() loads the binary with glProgramBinary when it is up to date and falls back to compiling from source
+// when it is missing, stale or rejected by the driver.
 class ShaderBuilder {
 public:
     ShaderBuilder() = default;
@@ -52,12 +132,54 @@ public:
     ShaderBuilder(ShaderBuilder&&) = default;
     ~ShaderBuilder();
 
+    // Read the source of a stage; it is only compiled by build() if there is no cached program binary.
     ShaderBuilder& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+    // Add "#define name value" to every stage, right after its #version directive.
+    ShaderBuilder& addDefine(std::string_view name, int value = 1);
     Shader build();
 
 private:
+    struct Stage {
+        GLuint type;
+        std::filesystem::path file;
+        std::string source;
+    };
+
+    [[nodiscard]] std::filesystem::path programCachePath() const;
+    [[nodiscard]] uint64_t computeSourceHash() const;
+    void compileStages();
     void freeShaders();
 
 private:
+    std::vector<Stage> m_stages;
+    std::string m_defines;
     std::vector<GLuint> m_shaders;
 };
+
+// Variants of one shader program, specialized at compile time by giving a fixed list of preprocessor defines different
+// values. Branches on features that a variant does not use are removed by the compiler instead of being evaluated for
+// every fragment.
+//
+// Variants are compiled the first time they are requested; with the program binary cache (see ShaderBuilder) that only
+// costs a compile once per machine. Variants that are needed right away can be built up front with get() as well.
+class ShaderVariants {
+public:
+    ShaderVariants() = default;
+    ShaderVariants(std::vector<std::pair<GLuint, std::filesystem::path>> stages, std::vector<std::string> defineNames);
+
+    // Variant in which the defines have the given values, in the order of the define names. Throws a
+    // ShaderLoadingException if the variant has to be built and fails to compile.
+    const Shader& get(std::span<const int> defineValues);
+    [[nodiscard]] size_t numVariants() const { return m_variants.size(); }
+
+private:
+    struct Variant {
+        std::vector<int> defineValues;
+        Shader shader;
+    };
+
+    std::vector<std::pair<GLuint, std::filesystem::path>> m_stages;
+    std::vector<std::string> m_defineNames;
+    // Keyed by a hash of the define values; each hash holds the (in practice single) variant with those values.
+    std::unordered_multimap<uint64_t, Variant> m_variants;
+};
@@ -0,0 +1,133 @@
+#pragma once
+// Four floats processed in lock step. Maps to SSE on x86-64 (where SSE2 is always available) and falls back to plain
+// loops, which the compiler is free to vectorize for the target, everywhere else.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAMEWORK_SIMD_SSE 1
+#include <emmintrin.h>
+#else
+#define FRAMEWORK_SIMD_SSE 0
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#endif
+#include <cstdint>
+#include <cstring>
+
+struct Float4 {
+#if FRAMEWORK_SIMD_SSE
+    __m128 value;
+
+    [[nodiscard]] static Float4 load(const float* pSource) { return { _mm_loadu_ps(pSource) }; }
+    [[nodiscard]] static Float4 broadcast(float x) { return { _mm_set1_ps(x) }; }
+    // Four consecutive bytes as floats in [0, 255].
+    [[nodiscard]] static Float4 loadBytes(const uint8_t* pSource)
+    {
+        int32_t bytes;
+        std::memcpy(&bytes, pSource, sizeof(bytes));
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        return { _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)) };
+    }
+    void store(float* pTarget) const { _mm_storeu_ps(pTarget, value); }
+    // Rounds to the nearest integer and saturates to [0, 255].
+    void storeBytes(uint8_t* pTarget) const
+    {
+        const __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(value), _mm_setzero_si128());
+        const int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        std::memcpy(pTarget, &bytes, sizeof(bytes));
+    }
+#else
+    std::array<float, 4> value;
+
+    [[nodiscard]] static Float4 load(const float* pSource) { return { { pSource[0], pSource[1], pSource[2], pSource[3] } }; }
+    [[nodiscard]] static Float4 broadcast(float x) { return { { x, x, x, x } }; }
+    [[nodiscard]] static Float4 loadBytes(const uint8_t* pSource) { return { { float(pSource[0]), float(pSource[1]), float(pSource[2]), float(pSource[3]) } }; }
+    void store(float* pTarget) const
+    {
+        for (int i = 0; i < 4; i++)
+            pTarget[i] = value[i];
+    }
+    void storeBytes(uint8_t* pTarget) const
+    {
+        for (int i = 0; i < 4; i++)
+            pTarget[i] = uint8_t(std::clamp(std::nearbyint(value[i]), 0.0f, 255.0f));
+    }
+#endif
+};
+
+#if FRAMEWORK_SIMD_SSE
+[[nodiscard]] inline Float4 operator+(Float4 lhs, Float4 rhs) { return { _mm_add_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator-(Float4 lhs, Float4 rhs) { return { _mm_sub_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator*(Float4 lhs, Float4 rhs) { return { _mm_mul_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator/(Float4 lhs, Float4 rhs) { return { _mm_div_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 min(Float4 lhs, Float4 rhs) { return { _mm_min_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 max(Float4 lhs, Float4 rhs) { return { _mm_max_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 abs(Float4 x) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), x.value) }; }
+
+// Comparisons return a mask with all bits set in the lanes where they hold (false for NaN).
+[[nodiscard]] inline Float4 operator<(Float4 lhs, Float4 rhs) { return { _mm_cmplt_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator<=(Float4 lhs, Float4 rhs) { return { _mm_cmple_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator>(Float4 lhs, Float4 rhs) { return { _mm_cmpgt_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator>=(Float4 lhs, Float4 rhs) { return { _mm_cmpge_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator&(Float4 lhs, Float4 rhs) { return { _mm_and_ps(lhs.value, rhs.value) }; }
+[[nodiscard]] inline Float4 operator|(Float4 lhs, Float4 rhs) { return { _mm_or_ps(lhs.value, rhs.value) }; }
+// Lanes of ifSet where mask is set and lanes of ifClear elsewhere.
+[[nodiscard]] inline Float4 select(Float4 mask, Float4 ifSet, Float4 ifClear) { return { _mm_or_ps(_mm_and_ps(mask.value, ifSet.value), _mm_andnot_ps(mask.value, ifClear.value)) }; }
+// Bit i is set if lane i of the mask is set.
+[[nodiscard]] inline int moveMask(Float4 mask) { return _mm_movemask_ps(mask.value); }
+// Lane i of x in all four lanes.
+template <int lane>
+[[nodiscard]] inline Float4 broadcastLane(Float4 x) { return { _mm_shuffle_ps(x.value, x.value, _MM_SHUFFLE(lane, lane, lane, lane)) }; }
+#else
+namespace simd_detail {
+template <typename F>
+[[nodiscard]] inline Float4 map(Float4 lhs, Float4 rhs, F&& f)
+{
+    Float4 out;
+    for (int i = 0; i < 4; i++)
+        out.value[i] = f(lhs.value[i], rhs.value[i]);
+    return out;
+}
+[[nodiscard]] inline float maskLane(bool condition) { return std::bit_cast<float>(condition ? ~0u : 0u); }
+[[nodiscard]] inline uint32_t bits(float x) { return std::bit_cast<uint32_t>(x); }
+}
+
+[[nodiscard]] inline Float4 operator+(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return a + b; }); }
+[[nodiscard]] inline Float4 operator-(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return a - b; }); }
+[[nodiscard]] inline Float4 operator*(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return a * b; }); }
+[[nodiscard]] inline Float4 operator/(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return a / b; }); }
+// Same NaN behavior as SSE: the second operand is returned if either is NaN.
+[[nodiscard]] inline Float4 min(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return a < b ? a : b; }); }
+[[nodiscard]] inline Float4 max(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return a > b ? a : b; }); }
+[[nodiscard]] inline Float4 abs(Float4 x) { return simd_detail::map(x, x, [](float a, float) { return std::abs(a); }); }
+
+[[nodiscard]] inline Float4 operator<(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return simd_detail::maskLane(a < b); }); }
+[[nodiscard]] inline Float4 operator<=(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return simd_detail::maskLane(a <= b); }); }
+[[nodiscard]] inline Float4 operator>(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return simd_detail::maskLane(a > b); }); }
+[[nodiscard]] inline Float4 operator>=(Float4 lhs, Float4 rhs) { return simd_detail::map(lhs, rhs, [](float a, float b) { return simd_detail::maskLane(a >= b); }); }
+[[nodiscard]] inline Float4 operator&(Float4 lhs, Float4 rhs)
+{
+    return simd_detail::map(lhs, rhs, [](float a, float b) { return std::bit_cast<float>(simd_detail::bits(a) & simd_detail::bits(b)); });
+}
+[[nodiscard]] inline Float4 operator|(Float4 lhs, Float4 rhs)
+{
+    return simd_detail::map(lhs, rhs, [](float a, float b) { return std::bit_cast<float>(simd_detail::bits(a) | simd_detail::bits(b)); });
+}
+[[nodiscard]] inline Float4 select(Float4 mask, Float4 ifSet, Float4 ifClear)
+{
+    Float4 out;
+    for (int i = 0; i < 4; i++)
+        out.value[i] = (simd_detail::bits(mask.value[i]) >> 31) ? ifSet.value[i] : ifClear.value[i];
+    return out;
+}
+[[nodiscard]] inline int moveMask(Float4 mask)
+{
+    int out = 0;
+    for (int i = 0; i < 4; i++)
+        out |= int(simd_detail::bits(mask.value[i]) >> 31) << i;
+    return out;
+}
+template <int lane>
+[[nodiscard]] inline Float4 broadcastLane(Float4 x) { return Float4::broadcast(x.value[lane]); }
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+#include "image.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Block compression formats, which store 4x4 pixel blocks in a fixed number of bytes and are decoded by the GPU.
+enum class BlockFormat : uint32_t {
+    // RGB in 8 bytes per block (4 bits per pixel); alpha is dropped.
+    BC1,
+    // RGBA in 16 bytes per block: BC1 color and a separately interpolated alpha channel.
+    BC3,
+    // Two independent channels (red and green) in 16 bytes per block. Meant for tangent-space normal maps, whose z is
+    // reconstructed in the shader.
+    BC5,
+    // RGBA in 16 bytes per block with better quality than BC1 and BC3. The encoder only uses mode 6 (a single
+    // line segment through RGBA space with 16 interpolation steps), which suits the smooth content of most textures.
+    BC7
+};
+
+[[nodiscard]] size_t blockSize(BlockFormat format);
+// Size of the blocks covering an image of the given size; partial blocks at the right and bottom edges are padded.
+[[nodiscard]] size_t compressedImageSize(BlockFormat format, int width, int height);
+
+// Compress an image with 1, 3 or 4 channels (expanded like OpenGL does: missing color channels are 0 and missing
+// alpha is 255). Blocks are stored row by row, starting at the first row of the image. Rows of blocks are compressed in
+// parallel on ThreadPool::global(); the pixels of a block are matched against the candidate colors four at a time
+// (see simd.h).
+[[nodiscard]] std::vector<std::byte> compressImage(const Image& image, BlockFormat format);
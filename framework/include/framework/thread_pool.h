@@ -0,0 +1,103 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed-size pool of worker threads that executes submitted tasks in FIFO order.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned numThreads = std::max(1u, std::thread::hardware_concurrency()));
+    ThreadPool(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Process-wide pool shared by the loaders in the framework.
+    static ThreadPool& global();
+
+    [[nodiscard]] unsigned numThreads() const { return static_cast<unsigned>(m_workers.size()); }
+
+    template <typename F>
+    [[nodiscard]] auto submit(F&& task) -> std::future<std::invoke_result_t<std::decay_t<F>>>;
+
+    // Call body(i) for every i in [0, count) and wait for all calls to finish.
+    // The calling thread takes part in the work, so this may safely be called from inside a pool task.
+    // The first exception thrown by body is rethrown on the calling thread.
+    template <typename F>
+    void parallelFor(size_t count, F&& body);
+
+private:
+    void enqueue(std::function<void()>&& task);
+    void workerLoop();
+
+private:
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop { false };
+};
+
+template <typename F>
+auto ThreadPool::submit(F&& task) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+{
+    using Result = std::invoke_result_t<std::decay_t<F>>;
+    // std::function requires a copyable callable, std::packaged_task is move-only.
+    auto pTask = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+    std::future<Result> out = pTask->get_future();
+    enqueue([pTask]() { (*pTask)(); });
+    return out;
+}
+
+template <typename F>
+void ThreadPool::parallelFor(size_t count, F&& body)
+{
+    if (count == 0)
+        return;
+
+    struct State {
+        std::atomic<size_t> next { 0 };
+        std::atomic<size_t> finished { 0 };
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::exception_ptr error;
+    };
+    auto pState = std::make_shared<State>();
+
+    // Helpers that start after all work was claimed return immediately without touching body.
+    const auto work = [pState, &body, count]() {
+        for (size_t i = pState->next++; i < count; i = pState->next++) {
+            try {
+                body(i);
+            } catch (...) {
+                std::lock_guard lock { pState->mutex };
+                if (!pState->error)
+                    pState->error = std::current_exception();
+            }
+            if (++pState->finished == count) {
+                std::lock_guard lock { pState->mutex };
+                pState->condition.notify_all();
+            }
+        }
+    };
+
+    const size_t numHelpers = std::min(count - 1, static_cast<size_t>(numThreads()));
+    for (size_t i = 0; i < numHelpers; i++)
+        enqueue(work);
+    work();
+
+    std::unique_lock lock { pState->mutex };
+    pState->condition.wait(lock, [&]() { return pState->finished == count; });
+    if (pState->error)
+        std::rethrow_exception(pState->error);
+}
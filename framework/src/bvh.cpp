@@ -0,0 +1,545 @@
+#include "bvh.h"
+#include "simd.h"
+#include "thread_pool.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+// Subtrees with more triangles than this build their two children in parallel.
+static constexpr size_t parallelBuildThreshold = 16 * 1024;
+static constexpr uint32_t maxLeafSize = 8;
+static constexpr int numSahBins = 16;
+// Below this depth the SAH may split as unevenly as it likes; deeper nodes are split at the median, which bounds the
+// depth (and thus the traversal stack) for pathological inputs.
+static constexpr int maxSahDepth = 48;
+static constexpr int traversalStackSize = 256;
+
+struct Bvh::BuildTriangle {
+    glm::vec3 vertices[3];
+    glm::vec3 boundsMin, boundsMax;
+    glm::vec3 centroid;
+    uint32_t id;
+};
+
+struct Bvh::BuildNode {
+    glm::vec3 boundsMin { std::numeric_limits<float>::max() };
+    glm::vec3 boundsMax { std::numeric_limits<float>::lowest() };
+    // Both set for inner nodes, both empty for leaves.
+    std::unique_ptr<BuildNode> children[2];
+    // Range of the triangles of a leaf.
+    uint32_t first { 0 };
+    uint32_t count { 0 };
+
+    [[nodiscard]] bool isLeaf() const { return !children[0]; }
+};
+
+static float surfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    const glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+std::unique_ptr<Bvh::BuildNode> Bvh::buildNode(std::span<BuildTriangle> triangles, uint32_t first, int depth)
+{
+    auto pNode = std::make_unique<BuildNode>();
+    glm::vec3 centroidMin { std::numeric_limits<float>::max() }, centroidMax { std::numeric_limits<float>::lowest() };
+    for (const BuildTriangle& triangle : triangles) {
+        pNode->boundsMin = glm::min(pNode->boundsMin, triangle.boundsMin);
+        pNode->boundsMax = glm::max(pNode->boundsMax, triangle.boundsMax);
+        centroidMin = glm::min(centroidMin, triangle.centroid);
+        centroidMax = glm::max(centroidMax, triangle.centroid);
+    }
+    const auto count = uint32_t(triangles.size());
+    if (count <= 2) {
+        pNode->first = first;
+        pNode->count = count;
+        return pNode;
+    }
+
+    // Evaluate the SAH cost (intersection cost relative to a traversal step) at the bin boundaries of every axis.
+    struct Bin {
+        glm::vec3 boundsMin { std::numeric_limits<float>::max() };
+        glm::vec3 boundsMax { std::numeric_limits<float>::lowest() };
+        uint32_t count { 0 };
+    };
+    const auto binOf = [&](const BuildTriangle& triangle, int axis) {
+        const float relative = (triangle.centroid[axis] - centroidMin[axis]) / (centroidMax[axis] - centroidMin[axis]);
+        return std::min(numSahBins - 1, int(relative * numSahBins));
+    };
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1, bestSplit = 0;
+    for (int axis = 0; axis < 3 && depth < maxSahDepth; axis++) {
+        if (centroidMax[axis] <= centroidMin[axis])
+            continue;
+        std::array<Bin, numSahBins> bins;
+        for (const BuildTriangle& triangle : triangles) {
+            Bin& bin = bins[binOf(triangle, axis)];
+            bin.boundsMin = glm::min(bin.boundsMin, triangle.boundsMin);
+            bin.boundsMax = glm::max(bin.boundsMax, triangle.boundsMax);
+            bin.count++;
+        }
+        // rightCost[i]: cost of the bins i + 1 and up.
+        std::array<float, numSahBins> rightCost {};
+        Bin right;
+        for (int i = numSahBins - 1; i > 0; i--) {
+            right.boundsMin = glm::min(right.boundsMin, bins[i].boundsMin);
+            right.boundsMax = glm::max(right.boundsMax, bins[i].boundsMax);
+            right.count += bins[i].count;
+            rightCost[i - 1] = float(right.count) * surfaceArea(right.boundsMin, right.boundsMax);
+        }
+        Bin left;
+        for (int i = 0; i < numSahBins - 1; i++) {
+            left.boundsMin = glm::min(left.boundsMin, bins[i].boundsMin);
+            left.boundsMax = glm::max(left.boundsMax, bins[i].boundsMax);
+            left.count += bins[i].count;
+            if (left.count == 0 || left.count == count)
+                continue;
+            const float cost = float(left.count) * surfaceArea(left.boundsMin, left.boundsMax) + rightCost[i];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    const float area = surfaceArea(pNode->boundsMin, pNode->boundsMax);
+    const bool splitIsCheaper = bestAxis >= 0 && area > 0.0f && 1.0f + bestCost / area < float(count);
+    if (!splitIsCheaper && count <= maxLeafSize) {
+        pNode->first = first;
+        pNode->count = count;
+        return pNode;
+    }
+
+    size_t numLeft;
+    if (bestAxis >= 0) {
+        const auto middle = std::partition(std::begin(triangles), std::end(triangles),
+            [&](const BuildTriangle& triangle) { return binOf(triangle, bestAxis) <= bestSplit; });
+        numLeft = size_t(middle - std::begin(triangles));
+    } else {
+        // All centroids coincide or the tree is too deep: split at the median of the largest axis.
+        const glm::vec3 extent = centroidMax - centroidMin;
+        const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        numLeft = triangles.size() / 2;
+        std::nth_element(std::begin(triangles), std::begin(triangles) + numLeft, std::end(triangles),
+            [&](const BuildTriangle& lhs, const BuildTriangle& rhs) { return lhs.centroid[axis] < rhs.centroid[axis]; });
+    }
+
+    const auto buildChild = [&](size_t i) {
+        const auto childTriangles = i == 0 ? triangles.first(numLeft) : triangles.subspan(numLeft);
+        pNode->children[i] = buildNode(childTriangles, first + (i == 0 ? 0 : uint32_t(numLeft)), depth + 1);
+    };
+    if (triangles.size() > parallelBuildThreshold) {
+        ThreadPool::global().parallelFor(2, buildChild);
+    } else {
+        buildChild(0);
+        buildChild(1);
+    }
+    return pNode;
+}
+
+uint32_t Bvh::emitLeaf(const BuildNode& node, std::span<const BuildTriangle> triangles)
+{
+    const auto firstPacket = uint32_t(m_packets.size());
+    const uint32_t numPackets = (node.count + 3) / 4;
+    assert(numPackets >= 1 && numPackets <= 8 && firstPacket < (1u << packetCountShift));
+    for (uint32_t packetIdx = 0; packetIdx < numPackets; packetIdx++) {
+        TrianglePacket& packet = m_packets.emplace_back();
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            const uint32_t i = 4 * packetIdx + lane;
+            if (i >= node.count) {
+                // Degenerate: zero edges never pass the determinant test.
+                for (int axis = 0; axis < 3; axis++) {
+                    packet.v0[axis][lane] = 0.0f;
+                    packet.edge1[axis][lane] = 0.0f;
+                    packet.edge2[axis][lane] = 0.0f;
+                }
+                packet.ids[lane] = invalidTriangle;
+                continue;
+            }
+            const BuildTriangle& triangle = triangles[node.first + i];
+            for (int axis = 0; axis < 3; axis++) {
+                packet.v0[axis][lane] = triangle.vertices[0][axis];
+                packet.edge1[axis][lane] = triangle.vertices[1][axis] - triangle.vertices[0][axis];
+                packet.edge2[axis][lane] = triangle.vertices[2][axis] - triangle.vertices[0][axis];
+            }
+            packet.ids[lane] = triangle.id;
+        }
+    }
+    return leafFlag | ((numPackets - 1) << packetCountShift) | firstPacket;
+}
+
+uint32_t Bvh::flattenNode(const BuildNode& node, std::span<const BuildTriangle> triangles)
+{
+    // Pull grandchildren up until there are four children, opening the largest inner child first.
+    std::array<const BuildNode*, 4> children { node.children[0].get(), node.children[1].get(), nullptr, nullptr };
+    uint32_t numChildren = 2;
+    while (numChildren < 4) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (uint32_t i = 0; i < numChildren; i++) {
+            const float area = surfaceArea(children[i]->boundsMin, children[i]->boundsMax);
+            if (!children[i]->isLeaf() && area > largestArea) {
+                largest = int(i);
+                largestArea = area;
+            }
+        }
+        if (largest < 0)
+            break;
+        const BuildNode* pOpened = children[largest];
+        children[largest] = pOpened->children[0].get();
+        children[numChildren++] = pOpened->children[1].get();
+    }
+
+    const auto nodeIdx = uint32_t(m_nodes.size());
+    m_nodes.emplace_back();
+    std::array<uint32_t, 4> childRefs {};
+    for (uint32_t i = 0; i < numChildren; i++)
+        childRefs[i] = children[i]->isLeaf() ? emitLeaf(*children[i], triangles) : flattenNode(*children[i], triangles);
+
+    // Children are flattened first because they may reallocate m_nodes.
+    Node& out = m_nodes[nodeIdx];
+    for (uint32_t i = 0; i < 4; i++) {
+        const bool used = i < numChildren;
+        const glm::vec3 boundsMin = used ? children[i]->boundsMin : glm::vec3(std::numeric_limits<float>::max());
+        const glm::vec3 boundsMax = used ? children[i]->boundsMax : glm::vec3(std::numeric_limits<float>::lowest());
+        out.minX[i] = boundsMin.x;
+        out.minY[i] = boundsMin.y;
+        out.minZ[i] = boundsMin.z;
+        out.maxX[i] = boundsMax.x;
+        out.maxY[i] = boundsMax.y;
+        out.maxZ[i] = boundsMax.z;
+        out.children[i] = childRefs[i];
+    }
+    out.numChildren = numChildren;
+    return nodeIdx;
+}
+
+Bvh::Bvh(std::span<const Mesh> meshes)
+{
+    std::vector<BuildTriangle> buildTriangles;
+    for (uint32_t meshIdx = 0; meshIdx < meshes.size(); meshIdx++) {
+        const Mesh& mesh = meshes[meshIdx];
+        for (uint32_t triangleIdx = 0; triangleIdx < mesh.triangles.size(); triangleIdx++) {
+            const glm::uvec3& triangle = mesh.triangles[triangleIdx];
+            BuildTriangle& buildTriangle = buildTriangles.emplace_back();
+            for (int i = 0; i < 3; i++)
+                buildTriangle.vertices[i] = mesh.vertices[triangle[i]].position;
+            buildTriangle.boundsMin = glm::min(glm::min(buildTriangle.vertices[0], buildTriangle.vertices[1]), buildTriangle.vertices[2]);
+            buildTriangle.boundsMax = glm::max(glm::max(buildTriangle.vertices[0], buildTriangle.vertices[1]), buildTriangle.vertices[2]);
+            buildTriangle.centroid = (buildTriangle.vertices[0] + buildTriangle.vertices[1] + buildTriangle.vertices[2]) / 3.0f;
+            buildTriangle.id = uint32_t(m_triangleIds.size());
+            m_triangleIds.emplace_back(meshIdx, triangleIdx);
+        }
+    }
+    if (buildTriangles.empty()) {
+        // A root without children.
+        m_nodes.emplace_back().numChildren = 0;
+        m_root = 0;
+        return;
+    }
+
+    const auto pRoot = buildNode(buildTriangles, 0, 0);
+    m_root = pRoot->isLeaf() ? emitLeaf(*pRoot, buildTriangles) : flattenNode(*pRoot, buildTriangles);
+}
+
+namespace {
+// Ray (or line segment for t up to tMax) prepared for slab tests against four boxes at once.
+struct RayBoxTester {
+    Float4 origin[3];
+    Float4 inverseDirection[3];
+
+    RayBoxTester(const glm::vec3& rayOrigin, const glm::vec3& direction)
+    {
+        for (int axis = 0; axis < 3; axis++) {
+            // Zero components would produce 0 * inf = NaN for boxes touching the ray origin.
+            const float d = std::abs(direction[axis]) > 1e-20f ? direction[axis] : std::copysign(1e-20f, direction[axis]);
+            origin[axis] = Float4::broadcast(rayOrigin[axis]);
+            inverseDirection[axis] = Float4::broadcast(1.0f / d);
+        }
+    }
+
+    // Boxes are grown by expand on all sides. tNear receives the entry distances.
+    template <typename Node>
+    int test(const Node& node, float tMax, float expand, Float4& tNear) const
+    {
+        const Float4 grow = Float4::broadcast(expand);
+        const Float4 t0x = (Float4::load(node.minX) - grow - origin[0]) * inverseDirection[0];
+        const Float4 t1x = (Float4::load(node.maxX) + grow - origin[0]) * inverseDirection[0];
+        const Float4 t0y = (Float4::load(node.minY) - grow - origin[1]) * inverseDirection[1];
+        const Float4 t1y = (Float4::load(node.maxY) + grow - origin[1]) * inverseDirection[1];
+        const Float4 t0z = (Float4::load(node.minZ) - grow - origin[2]) * inverseDirection[2];
+        const Float4 t1z = (Float4::load(node.maxZ) + grow - origin[2]) * inverseDirection[2];
+        tNear = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), Float4::broadcast(0.0f)));
+        const Float4 tFar = min(min(max(t0x, t1x), max(t0y, t1y)), min(max(t0z, t1z), Float4::broadcast(tMax)));
+        return moveMask(tNear <= tFar) & ((1 << node.numChildren) - 1);
+    }
+};
+}
+
+// Ericson, "Real-Time Collision Detection", 5.1.5.
+static glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+        return a;
+    const glm::vec3 bp = p - b;
+    const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+        return b;
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        return a + ab * (d1 / (d1 - d3));
+    const glm::vec3 cp = p - c;
+    const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+        return c;
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        return a + ac * (d2 / (d2 - d6));
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    const float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+// Ericson, "Real-Time Collision Detection", 5.1.9.
+static float segmentSegmentDistanceSquared(const glm::vec3& p1, const glm::vec3& q1, const glm::vec3& p2, const glm::vec3& q2)
+{
+    constexpr float epsilon = 1e-12f;
+    const glm::vec3 d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+    const float a = glm::dot(d1, d1), e = glm::dot(d2, d2), f = glm::dot(d2, r);
+    float s, t;
+    if (a <= epsilon && e <= epsilon) {
+        s = t = 0.0f;
+    } else if (a <= epsilon) {
+        s = 0.0f;
+        t = std::clamp(f / e, 0.0f, 1.0f);
+    } else {
+        const float c = glm::dot(d1, r);
+        if (e <= epsilon) {
+            t = 0.0f;
+            s = std::clamp(-c / a, 0.0f, 1.0f);
+        } else {
+            const float b = glm::dot(d1, d2);
+            const float denominator = a * e - b * b;
+            s = denominator != 0.0f ? std::clamp((b * f - c * e) / denominator, 0.0f, 1.0f) : 0.0f;
+            t = (b * s + f) / e;
+            if (t < 0.0f) {
+                t = 0.0f;
+                s = std::clamp(-c / a, 0.0f, 1.0f);
+            } else if (t > 1.0f) {
+                t = 1.0f;
+                s = std::clamp((b - c) / a, 0.0f, 1.0f);
+            }
+        }
+    }
+    const glm::vec3 offset = (p1 + d1 * s) - (p2 + d2 * t);
+    return glm::dot(offset, offset);
+}
+
+static bool segmentIntersectsTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+{
+    const glm::vec3 direction = b - a, edge1 = v1 - v0, edge2 = v2 - v0;
+    const glm::vec3 p = glm::cross(direction, edge2);
+    const float determinant = glm::dot(edge1, p);
+    if (std::abs(determinant) < 1e-12f)
+        return false;
+    const float inverseDeterminant = 1.0f / determinant;
+    const glm::vec3 s = a - v0;
+    const float u = glm::dot(s, p) * inverseDeterminant;
+    const glm::vec3 q = glm::cross(s, edge1);
+    const float v = glm::dot(direction, q) * inverseDeterminant;
+    const float t = glm::dot(edge2, q) * inverseDeterminant;
+    return u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t <= 1.0f;
+}
+
+template <typename OverlapsBoxes, typename VisitTriangle>
+bool Bvh::findAny(OverlapsBoxes&& overlapsBoxes, VisitTriangle&& visitTriangle) const
+{
+    std::array<uint32_t, traversalStackSize> stack;
+    int stackSize = 0;
+    stack[stackSize++] = m_root;
+    while (stackSize > 0) {
+        const uint32_t ref = stack[--stackSize];
+        if (ref & leafFlag) {
+            const uint32_t firstPacket = ref & ((1u << packetCountShift) - 1);
+            const uint32_t numPackets = ((ref & ~leafFlag) >> packetCountShift) + 1;
+            for (uint32_t packetIdx = firstPacket; packetIdx < firstPacket + numPackets; packetIdx++) {
+                const TrianglePacket& packet = m_packets[packetIdx];
+                for (int lane = 0; lane < 4; lane++) {
+                    if (packet.ids[lane] == invalidTriangle)
+                        continue;
+                    const glm::vec3 v0 { packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane] };
+                    const glm::vec3 edge1 { packet.edge1[0][lane], packet.edge1[1][lane], packet.edge1[2][lane] };
+                    const glm::vec3 edge2 { packet.edge2[0][lane], packet.edge2[1][lane], packet.edge2[2][lane] };
+                    if (visitTriangle(v0, v0 + edge1, v0 + edge2))
+                        return true;
+                }
+            }
+            continue;
+        }
+
+        const Node& node = m_nodes[ref];
+        for (int mask = overlapsBoxes(node); mask != 0; mask &= mask - 1) {
+            assert(stackSize < traversalStackSize);
+            stack[stackSize++] = node.children[std::countr_zero(unsigned(mask))];
+        }
+    }
+    return false;
+}
+
+bool Bvh::intersectRay(Ray& ray, BvhHit& hit) const
+{
+    // Hits closer than this are ignored, so that rays cast from a surface do not hit it again.
+    constexpr float minDistance = 1e-6f;
+
+    const RayBoxTester boxTester { ray.origin, ray.direction };
+    Float4 origin[3], direction[3];
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = Float4::broadcast(ray.origin[axis]);
+        direction[axis] = Float4::broadcast(ray.direction[axis]);
+    }
+    const auto cross = [](const Float4 a[3], const Float4 b[3], Float4 out[3]) {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+    };
+    const auto dot = [](const Float4 a[3], const Float4 b[3]) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; };
+
+    // Closest-first traversal; entries remember their entry distance so that they can be skipped once a closer hit
+    // was found.
+    struct StackEntry {
+        uint32_t ref;
+        float tNear;
+    };
+    std::array<StackEntry, traversalStackSize> stack;
+    int stackSize = 0;
+    stack[stackSize++] = { m_root, 0.0f };
+    bool anyHit = false;
+    while (stackSize > 0) {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.tNear > ray.t)
+            continue;
+
+        if (entry.ref & leafFlag) {
+            const uint32_t firstPacket = entry.ref & ((1u << packetCountShift) - 1);
+            const uint32_t numPackets = ((entry.ref & ~leafFlag) >> packetCountShift) + 1;
+            for (uint32_t packetIdx = firstPacket; packetIdx < firstPacket + numPackets; packetIdx++) {
+                // Möller-Trumbore for four triangles at once.
+                const TrianglePacket& packet = m_packets[packetIdx];
+                Float4 v0[3], edge1[3], edge2[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    v0[axis] = Float4::load(packet.v0[axis]);
+                    edge1[axis] = Float4::load(packet.edge1[axis]);
+                    edge2[axis] = Float4::load(packet.edge2[axis]);
+                }
+                Float4 p[3], s[3], q[3];
+                cross(direction, edge2, p);
+                const Float4 determinant = dot(edge1, p);
+                const Float4 inverseDeterminant = Float4::broadcast(1.0f) / determinant;
+                for (int axis = 0; axis < 3; axis++)
+                    s[axis] = origin[axis] - v0[axis];
+                const Float4 u = dot(s, p) * inverseDeterminant;
+                cross(s, edge1, q);
+                const Float4 v = dot(direction, q) * inverseDeterminant;
+                const Float4 t = dot(edge2, q) * inverseDeterminant;
+                const Float4 zero = Float4::broadcast(0.0f);
+                const Float4 valid = (abs(determinant) > Float4::broadcast(1e-12f)) & (u >= zero) & (v >= zero)
+                    & (u + v <= Float4::broadcast(1.0f)) & (t > Float4::broadcast(minDistance)) & (t < Float4::broadcast(ray.t));
+                int mask = moveMask(valid);
+                if (mask == 0)
+                    continue;
+
+                float ts[4], us[4], vs[4];
+                t.store(ts);
+                u.store(us);
+                v.store(vs);
+                for (; mask != 0; mask &= mask - 1) {
+                    const int lane = std::countr_zero(unsigned(mask));
+                    if (ts[lane] < ray.t) {
+                        ray.t = ts[lane];
+                        const auto [meshIdx, triangleIdx] = m_triangleIds[packet.ids[lane]];
+                        hit = BvhHit { .meshIndex = meshIdx, .triangleIndex = triangleIdx, .barycentrics = glm::vec2(us[lane], vs[lane]) };
+                        anyHit = true;
+                    }
+                }
+            }
+            continue;
+        }
+
+        const Node& node = m_nodes[entry.ref];
+        Float4 tNear;
+        int mask = boxTester.test(node, ray.t, 0.0f, tNear);
+        float tNears[4];
+        tNear.store(tNears);
+        // Push the farthest child first so that the closest one is visited next.
+        std::array<StackEntry, 4> children;
+        int numChildren = 0;
+        for (; mask != 0; mask &= mask - 1) {
+            const int lane = std::countr_zero(unsigned(mask));
+            children[numChildren++] = { node.children[lane], tNears[lane] };
+        }
+        std::sort(std::begin(children), std::begin(children) + numChildren,
+            [](const StackEntry& lhs, const StackEntry& rhs) { return lhs.tNear > rhs.tNear; });
+        for (int i = 0; i < numChildren; i++) {
+            assert(stackSize < traversalStackSize);
+            stack[stackSize++] = children[i];
+        }
+    }
+    return anyHit;
+}
+
+bool Bvh::overlapsSphere(const glm::vec3& center, float radius) const
+{
+    const Float4 centerX = Float4::broadcast(center.x), centerY = Float4::broadcast(center.y), centerZ = Float4::broadcast(center.z);
+    const Float4 radiusSquared = Float4::broadcast(radius * radius);
+    const Float4 zero = Float4::broadcast(0.0f);
+    const auto overlapsBoxes = [&](const Node& node) {
+        // Squared distance from the center to each box.
+        const Float4 dx = max(max(Float4::load(node.minX) - centerX, centerX - Float4::load(node.maxX)), zero);
+        const Float4 dy = max(max(Float4::load(node.minY) - centerY, centerY - Float4::load(node.maxY)), zero);
+        const Float4 dz = max(max(Float4::load(node.minZ) - centerZ, centerZ - Float4::load(node.maxZ)), zero);
+        return moveMask(dx * dx + dy * dy + dz * dz <= radiusSquared) & ((1 << node.numChildren) - 1);
+    };
+    return findAny(overlapsBoxes, [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        const glm::vec3 offset = closestPointOnTriangle(center, a, b, c) - center;
+        return glm::dot(offset, offset) <= radius * radius;
+    });
+}
+
+bool Bvh::overlapsCapsule(const glm::vec3& a, const glm::vec3& b, float radius) const
+{
+    // The segment against the boxes grown by the radius (a superset of the boxes swept by the sphere).
+    const RayBoxTester boxTester { a, b - a };
+    const auto overlapsBoxes = [&](const Node& node) {
+        Float4 tNear;
+        return boxTester.test(node, 1.0f, radius, tNear);
+    };
+    const float radiusSquared = radius * radius;
+    return findAny(overlapsBoxes, [&](const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) {
+        // The closest points of a segment and a triangle are either an intersection, an end point of the segment and
+        // its closest point on the triangle, or the closest points of the segment and a triangle edge.
+        if (segmentIntersectsTriangle(a, b, v0, v1, v2))
+            return true;
+        for (const glm::vec3& endPoint : { a, b }) {
+            const glm::vec3 offset = closestPointOnTriangle(endPoint, v0, v1, v2) - endPoint;
+            if (glm::dot(offset, offset) <= radiusSquared)
+                return true;
+        }
+        return segmentSegmentDistanceSquared(a, b, v0, v1) <= radiusSquared
+            || segmentSegmentDistanceSquared(a, b, v1, v2) <= radiusSquared
+            || segmentSegmentDistanceSquared(a, b, v2, v0) <= radiusSquared;
+    });
+}
@@ -0,0 +1,214 @@
+#include "compressed_texture.h"
+#include "hash.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+// Bump whenever the output of compressImage() or generateMipChain() changes.
+static constexpr uint64_t encoderVersion = 2;
+
+// File layout of KTX version 1: https://registry.khronos.org/KTX/specs/1.0/ktxspec.v1.html
+static constexpr std::array<uint8_t, 12> ktxIdentifier { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+static constexpr uint32_t ktxEndianness = 0x04030201;
+// Key/value entry holding the source hash as 16 hexadecimal digits.
+static constexpr std::string_view sourceHashKey = "CGFramework.sourceHash";
+
+struct KtxHeader {
+    std::array<uint8_t, 12> identifier;
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+static_assert(sizeof(KtxHeader) == 64);
+
+// The S3TC formats come from EXT_texture_compression_s3tc; RGTC is core since OpenGL 3.0 and BPTC since 4.2.
+struct GLFormat {
+    BlockFormat format;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+};
+static constexpr std::array<GLFormat, 4> glFormats { {
+    { BlockFormat::BC1, 0x83F0 /* GL_COMPRESSED_RGB_S3TC_DXT1_EXT */, 0x1907 /* GL_RGB */ },
+    { BlockFormat::BC3, 0x83F3 /* GL_COMPRESSED_RGBA_S3TC_DXT5_EXT */, 0x1908 /* GL_RGBA */ },
+    { BlockFormat::BC5, 0x8DBD /* GL_COMPRESSED_RG_RGTC2 */, 0x8227 /* GL_RG */ },
+    { BlockFormat::BC7, 0x8E8C /* GL_COMPRESSED_RGBA_BPTC_UNORM */, 0x1908 /* GL_RGBA */ },
+} };
+
+static uint32_t alignUp4(uint32_t offset)
+{
+    return (offset + 3u) & ~3u;
+}
+
+static std::string formatSourceHash(uint64_t sourceHash)
+{
+    std::string out(16, '0');
+    for (size_t i = 0; i < out.size(); i++)
+        out[i] = "0123456789abcdef"[(sourceHash >> (60 - 4 * i)) & 0xF];
+    return out;
+}
+
+std::filesystem::path compressedTexturePath(const std::filesystem::path& file)
+{
+    std::filesystem::path out = file;
+    out += ".ktx";
+    return out;
+}
+
+uint64_t CompressedTexture::computeSourceHash(const std::filesystem::path& file)
+{
+    return hashBytes(MappedFile(file).data(), encoderVersion);
+}
+
+std::optional<CompressedTexture> CompressedTexture::load(const std::filesystem::path& file, uint64_t sourceHash)
+{
+    const auto ktxFile = compressedTexturePath(file);
+    if (!std::filesystem::exists(ktxFile))
+        return {};
+
+    CompressedTexture out;
+    try {
+        out.m_file = MappedFile(ktxFile);
+    } catch (const FileMappingException& e) {
+        std::cerr << e.what() << std::endl;
+        return {};
+    }
+
+    const auto bytes = out.m_file.data();
+    const auto inBounds = [&](uint64_t offset, uint64_t size) {
+        return offset <= bytes.size() && size <= bytes.size() - offset;
+    };
+    const auto readU32 = [&](uint64_t offset) {
+        uint32_t value;
+        std::memcpy(&value, bytes.data() + offset, sizeof(value));
+        return value;
+    };
+
+    if (!inBounds(0, sizeof(KtxHeader)))
+        return {};
+    KtxHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    // Only files as written by store() are accepted: native endianness, a single 2D image and block-compressed data.
+    const auto glFormat = std::find_if(std::begin(glFormats), std::end(glFormats),
+        [&](const GLFormat& candidate) { return candidate.glInternalFormat == header.glInternalFormat; });
+    if (header.identifier != ktxIdentifier || header.endianness != ktxEndianness || header.glType != 0 || header.glFormat != 0
+        || glFormat == std::end(glFormats) || header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0
+        || header.numberOfArrayElements != 0 || header.numberOfFaces != 1 || header.numberOfMipmapLevels == 0
+        || header.pixelWidth > (1u << 16) || header.pixelHeight > (1u << 16) || header.numberOfMipmapLevels > 17)
+        return {};
+
+    // Look for the source hash in the key/value data.
+    const uint64_t keyValueEnd = sizeof(KtxHeader) + uint64_t(header.bytesOfKeyValueData);
+    if (!inBounds(sizeof(KtxHeader), header.bytesOfKeyValueData))
+        return {};
+    bool hashMatches = false;
+    for (uint64_t offset = sizeof(KtxHeader); offset + sizeof(uint32_t) <= keyValueEnd;) {
+        const uint32_t keyAndValueSize = readU32(offset);
+        offset += sizeof(uint32_t);
+        if (keyAndValueSize > keyValueEnd - offset)
+            return {};
+        const std::string_view keyAndValue { reinterpret_cast<const char*>(bytes.data() + offset), keyAndValueSize };
+        if (const size_t separator = keyAndValue.find('\0'); separator != std::string_view::npos && keyAndValue.substr(0, separator) == sourceHashKey) {
+            const auto value = keyAndValue.substr(separator + 1);
+            hashMatches = value.substr(0, value.find('\0')) == formatSourceHash(sourceHash);
+        }
+        offset += alignUp4(keyAndValueSize);
+    }
+    if (!hashMatches)
+        return {};
+
+    out.m_format = glFormat->format;
+    out.m_glInternalFormat = glFormat->glInternalFormat;
+    out.m_width = int(header.pixelWidth);
+    out.m_height = int(header.pixelHeight);
+    uint64_t offset = keyValueEnd;
+    for (uint32_t level = 0; level < header.numberOfMipmapLevels; level++) {
+        const size_t levelSize = compressedImageSize(out.m_format, std::max(out.m_width >> level, 1), std::max(out.m_height >> level, 1));
+        if (!inBounds(offset, sizeof(uint32_t)) || readU32(offset) != levelSize || !inBounds(offset + sizeof(uint32_t), levelSize)) {
+            std::cerr << "Compressed texture " << ktxFile << " is corrupt; ignoring it." << std::endl;
+            return {};
+        }
+        out.m_levels.push_back(bytes.subspan(offset + sizeof(uint32_t), levelSize));
+        // Block sizes are multiples of 4 bytes, so no mip padding is needed.
+        offset += sizeof(uint32_t) + levelSize;
+    }
+    return out;
+}
+
+void CompressedTexture::store(const std::filesystem::path& file, uint64_t sourceHash, const Image& image, BlockFormat format, const MipChainSettings& mipSettings)
+{
+    std::vector<std::vector<std::byte>> levels;
+    levels.push_back(compressImage(image, format));
+    for (const Image& mipLevel : generateMipChain(image, mipSettings))
+        levels.push_back(compressImage(mipLevel, format));
+
+    std::string keyAndValue { sourceHashKey };
+    keyAndValue += '\0';
+    keyAndValue += formatSourceHash(sourceHash);
+    keyAndValue += '\0';
+    const auto keyAndValueSize = uint32_t(keyAndValue.size());
+    keyAndValue.resize(alignUp4(keyAndValueSize), '\0');
+
+    const auto glFormat = *std::find_if(std::begin(glFormats), std::end(glFormats),
+        [&](const GLFormat& candidate) { return candidate.format == format; });
+    KtxHeader header {};
+    header.identifier = ktxIdentifier;
+    header.endianness = ktxEndianness;
+    // Compressed data: no type and no (uncompressed) format; glTypeSize must be 1.
+    header.glTypeSize = 1;
+    header.glInternalFormat = glFormat.glInternalFormat;
+    header.glBaseInternalFormat = glFormat.glBaseInternalFormat;
+    header.pixelWidth = uint32_t(image.width);
+    header.pixelHeight = uint32_t(image.height);
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = uint32_t(levels.size());
+    header.bytesOfKeyValueData = uint32_t(sizeof(uint32_t) + keyAndValue.size());
+
+    // Write to a temporary file first so that an interrupted write never leaves a truncated file behind.
+    const auto ktxFile = compressedTexturePath(file);
+    auto tmpFile = ktxFile;
+    tmpFile += ".tmp";
+    {
+        std::ofstream stream { tmpFile, std::ios::binary | std::ios::trunc };
+        const auto write = [&](const void* pData, size_t size) {
+            stream.write(static_cast<const char*>(pData), static_cast<std::streamsize>(size));
+        };
+        write(&header, sizeof(header));
+        write(&keyAndValueSize, sizeof(keyAndValueSize));
+        write(keyAndValue.data(), keyAndValue.size());
+        for (const auto& level : levels) {
+            const auto levelSize = uint32_t(level.size());
+            write(&levelSize, sizeof(levelSize));
+            write(level.data(), level.size());
+        }
+
+        if (!stream) {
+            std::cerr << "Could not write compressed texture " << ktxFile << std::endl;
+            stream.close();
+            std::error_code error;
+            std::filesystem::remove(tmpFile, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpFile, ktxFile, error);
+    if (error) {
+        std::cerr << "Could not write compressed texture " << ktxFile << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpFile, error);
+    }
+}
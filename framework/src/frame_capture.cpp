@@ -0,0 +1,173 @@
+#include "frame_capture.h"
+#include "image.h"
+#include "thread_pool.h"
+// Suppress warnings in third-party code.
+#include "disable_all_warnings.h"
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+// Encodes that may be queued on the thread pool before the render thread waits for the oldest one; bounds the memory
+// held by frames that were read back faster than they can be written.
+static size_t maxQueuedEncodes()
+{
+    return 2 * size_t(ThreadPool::global().numThreads());
+}
+
+FrameCapture::FrameCapture(size_t numBuffers)
+    : m_readbacks(std::max(numBuffers, size_t(1)))
+{
+    for (Readback& readback : m_readbacks)
+        glGenBuffers(1, &readback.buffer);
+}
+
+FrameCapture::~FrameCapture()
+{
+    flush();
+    for (Readback& readback : m_readbacks)
+        glDeleteBuffers(1, &readback.buffer);
+}
+
+void FrameCapture::capture(const glm::ivec2& size, const std::filesystem::path& filePath)
+{
+    if (size.x <= 0 || size.y <= 0)
+        return;
+
+    // Reuse the oldest buffer once all of them are in flight.
+    Readback& readback = m_readbacks[m_nextBuffer];
+    if (readback.fence) {
+        m_numStalls++;
+        retireOldest(true);
+    }
+    assert(!readback.fence);
+    readback.size = size;
+    readback.filePath = filePath;
+
+    GLint readFramebuffer, packBuffer, packAlignment;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &packBuffer);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    // Orphan the previous storage so that the driver never has to synchronize with an earlier readback.
+    glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(4) * size.x * size.y, nullptr, GL_STREAM_READ);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    // With a pack buffer bound the last argument is an offset into the buffer and glReadPixels returns immediately.
+    glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, GLuint(packBuffer));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(readFramebuffer));
+
+    m_inFlight.push_back(m_nextBuffer);
+    m_nextBuffer = (m_nextBuffer + 1) % m_readbacks.size();
+}
+
+void FrameCapture::startSequence(const std::filesystem::path& filePathPrefix, const std::filesystem::path& extension)
+{
+    m_recording = true;
+    m_sequencePrefix = filePathPrefix;
+    m_sequenceExtension = extension;
+    m_sequenceFrame = 0;
+}
+
+void FrameCapture::stopSequence()
+{
+    m_recording = false;
+}
+
+void FrameCapture::update(const glm::ivec2& size)
+{
+    if (m_recording) {
+        auto filePath = m_sequencePrefix;
+        filePath += fmt::format("_{:06}", m_sequenceFrame++);
+        filePath += m_sequenceExtension;
+        capture(size, filePath);
+    }
+
+    // Readbacks finish in the order in which they were issued.
+    while (retireOldest(false)) { }
+    while (!m_encodes.empty() && m_encodes.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        m_encodes.front().get();
+        m_encodes.pop_front();
+    }
+}
+
+void FrameCapture::flush()
+{
+    while (retireOldest(true)) { }
+    for (auto& encode : m_encodes)
+        encode.get();
+    m_encodes.clear();
+}
+
+size_t FrameCapture::numPending() const
+{
+    return m_inFlight.size() + m_encodes.size();
+}
+
+bool FrameCapture::retireOldest(bool wait)
+{
+    if (m_inFlight.empty())
+        return false;
+
+    Readback& readback = m_readbacks[m_inFlight.front()];
+    // The first wait flushes the command stream, otherwise the fence might never be submitted to the GPU.
+    const GLuint64 timeout = wait ? GL_TIMEOUT_IGNORED : 0;
+    const GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    if (status == GL_WAIT_FAILED)
+        std::cerr << "Waiting for the readback of " << readback.filePath << " failed" << std::endl;
+    else
+        encode(readback);
+
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+    m_inFlight.pop_front();
+    return true;
+}
+
+void FrameCapture::encode(Readback& readback)
+{
+    GLint packBuffer;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &packBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+
+    // Copy the mapped buffer out in one go; flipping it is left to the encode task.
+    auto pImage = std::make_shared<Image>(readback.size.x, readback.size.y, 4);
+    const GLsizeiptr bufferSize = GLsizeiptr(pImage->sizeInBytes());
+    if (const auto* pPixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bufferSize, GL_MAP_READ_BIT)) {
+        std::memcpy(pImage->data().data(), pPixels, pImage->sizeInBytes());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        std::cerr << "Could not map the readback of " << readback.filePath << std::endl;
+        pImage.reset();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, GLuint(packBuffer));
+    if (!pImage)
+        return;
+
+    if (m_encodes.size() >= maxQueuedEncodes()) {
+        m_numStalls++;
+        m_encodes.front().get();
+        m_encodes.pop_front();
+    }
+    m_encodes.push_back(ThreadPool::global().submit([pImage, filePath = readback.filePath]() {
+        // OpenGL returns the bottom row first.
+        for (int y = 0; y < pImage->height / 2; y++)
+            std::ranges::swap_ranges(pImage->row(y), pImage->row(pImage->height - 1 - y));
+        if (filePath.extension() == ".bmp")
+            pImage->writeBitmapToFile(filePath);
+        else
+            pImage->writePngToFile(filePath);
+    }));
+}
@@ -0,0 +1,72 @@
+#include "frustum.h"
+#include "simd.h"
+#include <cassert>
+#include <limits>
+
+static constexpr size_t boxesPerBatch = 4;
+
+void BoundingBoxes::clear()
+{
+    m_size = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        m_min[axis].clear();
+        m_max[axis].clear();
+    }
+}
+
+void BoundingBoxes::push_back(const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    if (m_size % boxesPerBatch == 0) {
+        // Minimum above maximum: every plane has the empty box entirely on its outside.
+        for (int axis = 0; axis < 3; axis++) {
+            m_min[axis].resize(m_size + boxesPerBatch, std::numeric_limits<float>::max());
+            m_max[axis].resize(m_size + boxesPerBatch, std::numeric_limits<float>::lowest());
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        m_min[axis][m_size] = boxMin[axis];
+        m_max[axis][m_size] = boxMax[axis];
+    }
+    m_size++;
+}
+
+void BoundingBoxes::push_back(const glm::mat4& transform, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    // Arvo, "Transforming Axis-Aligned Bounding Boxes": every matrix element contributes its smaller product with the
+    // box extent along that column to the minimum and its larger one to the maximum.
+    glm::vec3 transformedMin = glm::vec3(transform[3]), transformedMax = glm::vec3(transform[3]);
+    for (int column = 0; column < 3; column++) {
+        const glm::vec3 a = glm::vec3(transform[column]) * boxMin[column];
+        const glm::vec3 b = glm::vec3(transform[column]) * boxMax[column];
+        transformedMin += glm::min(a, b);
+        transformedMax += glm::max(a, b);
+    }
+    push_back(transformedMin, transformedMax);
+}
+
+size_t cullBoxes(const Frustum& frustum, const BoundingBoxes& boxes, std::span<uint8_t> visible)
+{
+    assert(visible.size() >= boxes.size());
+
+    size_t numVisible = 0;
+    for (size_t first = 0; first < boxes.size(); first += boxesPerBatch) {
+        Float4 outside = Float4::broadcast(0.0f);
+        for (const glm::vec4& plane : frustum.planes) {
+            // Signed distance of the corner that is furthest along the plane normal; the box is outside of the plane
+            // if even that corner is. Which corner that is only depends on the plane, not on the box.
+            Float4 distance = Float4::broadcast(plane.w);
+            for (int axis = 0; axis < 3; axis++) {
+                const std::vector<float>& corner = plane[axis] >= 0.0f ? boxes.m_max[axis] : boxes.m_min[axis];
+                distance = distance + Float4::broadcast(plane[axis]) * Float4::load(&corner[first]);
+            }
+            outside = outside | (distance < Float4::broadcast(0.0f));
+        }
+
+        const int outsideMask = moveMask(outside);
+        for (size_t i = 0; i < boxesPerBatch && first + i < boxes.size(); i++) {
+            visible[first + i] = uint8_t(((outsideMask >> i) & 1) ^ 1);
+            numVisible += visible[first + i];
+        }
+    }
+    return numVisible;
+}
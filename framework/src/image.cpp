@@ -1,4 +1,6 @@
 #include "image.h"
+#include "simd.h"
+#include "thread_pool.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
@@ -7,17 +9,37 @@ DISABLE_WARNINGS_PUSH()
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <exception>
 #include <iostream>
+#include <new>
+#include <numbers>
 #include <string>
+#include <vector>
 
 
 // write image to a file
 void Image::writeBitmapToFile(const std::filesystem::path& filePath)
 {
     std::string filePathString = filePath.string();
-    stbi_write_bmp(filePathString.c_str(), width, height, channels, pixels.data());
+    stbi_write_bmp(filePathString.c_str(), width, height, channels, pixels.get());
+}
+
+bool Image::writePngToFile(const std::filesystem::path& filePath) const
+{
+    const std::string filePathString = filePath.string();
+    if (!stbi_write_png(filePathString.c_str(), width, height, channels, pixels.get(), width * channels)) {
+        std::cerr << "Failed to write image " << filePath << std::endl;
+        std::error_code error;
+        std::filesystem::remove(filePath, error);
+        return false;
+    }
+    return true;
 }
 
 // Image constructor, create image from file
@@ -29,14 +51,374 @@ Image::Image(const std::filesystem::path& filePath)
     }
 
     const auto filePathStr = filePath.string(); // Create l-value so c_str() is safe.
-    stbi_uc* stbPixels = stbi_load(filePathStr.c_str(), &width, &height, &channels, STBI_default);
+    pixels.reset(stbi_load(filePathStr.c_str(), &width, &height, &channels, STBI_default));
 
-    if (!stbPixels) {
+    if (!pixels) {
         std::cerr << "Failed to read texture " << filePath << " using stb_image.h" << std::endl;
         throw std::exception();
     }
+}
+
+// Allocated like the buffers of stb_image so that both are released by the same deleter.
+Image::Image(int imageWidth, int imageHeight, int imageChannels)
+    : width(imageWidth)
+    , height(imageHeight)
+    , channels(imageChannels)
+    , pixels(static_cast<uint8_t*>(STBI_MALLOC(sizeInBytes())))
+{
+    if (!pixels)
+        throw std::bad_alloc();
+    std::fill(std::begin(data()), std::end(data()), uint8_t(0));
+}
+
+void Image::PixelDeleter::operator()(uint8_t* pPixels) const
+{
+    stbi_image_free(pPixels);
+}
+
+void convertU8ToFloat(std::span<const uint8_t> source, std::span<float> target)
+{
+    assert(target.size() >= source.size());
+    const Float4 scale = Float4::broadcast(1.0f / 255.0f);
+    size_t i = 0;
+    for (; i + 16 <= source.size(); i += 16) {
+        (Float4::loadBytes(&source[i + 0]) * scale).store(&target[i + 0]);
+        (Float4::loadBytes(&source[i + 4]) * scale).store(&target[i + 4]);
+        (Float4::loadBytes(&source[i + 8]) * scale).store(&target[i + 8]);
+        (Float4::loadBytes(&source[i + 12]) * scale).store(&target[i + 12]);
+    }
+    for (; i < source.size(); i++)
+        target[i] = float(source[i]) * (1.0f / 255.0f);
+}
+
+void convertFloatToU8(std::span<const float> source, std::span<uint8_t> target)
+{
+    assert(target.size() >= source.size());
+    const Float4 scale = Float4::broadcast(255.0f);
+    size_t i = 0;
+    for (; i + 4 <= source.size(); i += 4)
+        (Float4::load(&source[i]) * scale).storeBytes(&target[i]);
+    for (; i < source.size(); i++)
+        target[i] = uint8_t(std::clamp(std::nearbyint(source[i] * 255.0f), 0.0f, 255.0f));
+}
+
+void convertRgbToRgba(std::span<const uint8_t> source, std::span<uint8_t> target, uint8_t alpha)
+{
+    // A byte shuffle; written as whole 32-bit stores so that the compiler does not have to merge four byte stores.
+    assert(source.size() % 3 == 0 && target.size() >= source.size() / 3 * 4);
+    const size_t numPixels = source.size() / 3;
+    const uint32_t alphaBits = uint32_t(alpha) << 24;
+    size_t pixel = 0;
+    // Reading four bytes per pixel is safe for all but the last pixel.
+    for (; pixel + 1 < numPixels; pixel++) {
+        uint32_t bits;
+        std::memcpy(&bits, &source[3 * pixel], sizeof(bits));
+        if constexpr (std::endian::native == std::endian::little)
+            bits = (bits & 0x00FFFFFF) | alphaBits;
+        else
+            bits = (bits & 0xFFFFFF00) | alpha;
+        std::memcpy(&target[4 * pixel], &bits, sizeof(bits));
+    }
+    for (; pixel < numPixels; pixel++) {
+        for (size_t channel = 0; channel < 3; channel++)
+            target[4 * pixel + channel] = source[3 * pixel + channel];
+        target[4 * pixel + 3] = alpha;
+    }
+}
+
+void premultiplyAlpha(std::span<uint8_t> rgbaPixels)
+{
+    assert(rgbaPixels.size() % 4 == 0);
+    // max(alpha / 255, (0, 0, 0, 1)) is (alpha / 255, alpha / 255, alpha / 255, 1), which leaves alpha unchanged.
+    constexpr float keepAlpha[4] { 0.0f, 0.0f, 0.0f, 1.0f };
+    const Float4 keepAlphaMask = Float4::load(keepAlpha);
+    const Float4 scale = Float4::broadcast(1.0f / 255.0f);
+    for (size_t i = 0; i < rgbaPixels.size(); i += 4) {
+        const Float4 pixel = Float4::loadBytes(&rgbaPixels[i]);
+        (pixel * max(broadcastLane<3>(pixel) * scale, keepAlphaMask)).storeBytes(&rgbaPixels[i]);
+    }
+}
+
+// Every byte value decoded once; a lookup is cheaper than evaluating the transfer function in SIMD.
+struct ByteToFloatTables {
+    std::array<float, 256> srgb;
+    std::array<float, 256> linear;
+};
+static const ByteToFloatTables& byteToFloatTables()
+{
+    static const ByteToFloatTables tables = []() {
+        ByteToFloatTables out;
+        for (size_t i = 0; i < 256; i++) {
+            const float value = float(i) / 255.0f;
+            out.srgb[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+            out.linear[i] = value;
+        }
+        return out;
+    }();
+    return tables;
+}
+
+void convertSrgbToLinear(std::span<const uint8_t> source, std::span<float> target, int channels)
+{
+    assert(channels >= 1 && channels <= 4 && source.size() % size_t(channels) == 0 && target.size() >= source.size());
+    const auto& tables = byteToFloatTables();
+    std::array<const float*, 4> channelTables;
+    for (int channel = 0; channel < channels; channel++) {
+        const bool isAlpha = (channels == 2 || channels == 4) && channel == channels - 1;
+        channelTables[size_t(channel)] = isAlpha ? tables.linear.data() : tables.srgb.data();
+    }
+    const auto numChannels = size_t(channels);
+    for (size_t i = 0; i < source.size(); i += numChannels) {
+        for (size_t channel = 0; channel < numChannels; channel++)
+            target[i + channel] = channelTables[channel][source[i + channel]];
+    }
+}
+
+Image packChannels(std::span<const Image* const> sources)
+{
+    assert(!sources.empty() && sources.size() <= 4);
+    const Image& first = *sources[0];
+    for (const Image* pSource : sources) {
+        if (pSource->width != first.width || pSource->height != first.height) {
+            std::cerr << "Cannot pack the channels of images with different sizes" << std::endl;
+            throw std::exception();
+        }
+    }
+
+    Image out { first.width, first.height, int(sources.size()) };
+    const size_t numPixels = size_t(first.width) * size_t(first.height);
+    for (size_t channel = 0; channel < sources.size(); channel++) {
+        const auto source = sources[channel]->data();
+        const auto stride = size_t(sources[channel]->channels);
+        auto target = out.data();
+        for (size_t pixel = 0; pixel < numPixels; pixel++)
+            target[pixel * sources.size() + channel] = source[pixel * stride];
+    }
+    return out;
+}
+
+// Image with four floats per pixel (missing channels are 0) in linear space, which is what the mip filters work on.
+struct FloatImage {
+    int width, height;
+    std::vector<float> pixels;
+};
+
+// Source pixels and weights that make up each target pixel when resampling one dimension.
+struct FilterTaps {
+    std::vector<size_t> offsets; // Into sources and weights; one more than the number of target pixels.
+    std::vector<int> sources;
+    std::vector<float> weights;
+};
+
+static float sinc(float x)
+{
+    const float pix = std::numbers::pi_v<float> * x;
+    return std::abs(pix) < 1e-4f ? 1.0f : std::sin(pix) / pix;
+}
+
+// Zeroth order modified Bessel function of the first kind, by its power series.
+static float besselI0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 32 && term > sum * 1e-7f; k++) {
+        term *= (x * x) / (4.0f * float(k * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// t is the distance to the target pixel center in target pixels.
+static FilterTaps computeFilterTaps(MipChainSettings::Filter filter, int sourceSize, int targetSize)
+{
+    constexpr float kaiserRadius = 3.0f, kaiserAlpha = 4.0f;
+    const float radius = filter == MipChainSettings::Filter::Box ? 0.5f : kaiserRadius;
+    const auto kernel = [&](float t) {
+        if (filter == MipChainSettings::Filter::Box)
+            return 1.0f;
+        const float window = t / kaiserRadius;
+        return sinc(t) * besselI0(kaiserAlpha * std::sqrt(std::max(1.0f - window * window, 0.0f))) / besselI0(kaiserAlpha);
+    };
+
+    FilterTaps out;
+    const float scale = float(sourceSize) / float(targetSize);
+    for (int target = 0; target < targetSize; target++) {
+        out.offsets.push_back(out.sources.size());
+        const float center = (float(target) + 0.5f) * scale;
+        float sum = 0.0f;
+        for (int source = int(std::floor(center - radius * scale)); source <= int(std::ceil(center + radius * scale)); source++) {
+            const float t = (float(source) + 0.5f - center) / scale;
+            if (std::abs(t) >= radius)
+                continue;
+            out.sources.push_back(std::clamp(source, 0, sourceSize - 1));
+            out.weights.push_back(kernel(t));
+            sum += out.weights.back();
+        }
+        for (size_t i = out.offsets.back(); i < out.weights.size(); i++)
+            out.weights[i] /= sum;
+    }
+    out.offsets.push_back(out.sources.size());
+    return out;
+}
+
+// Separable: rows are resampled into an intermediate image first, then its columns into the target.
+// loadRow(y, pScratch) returns the source row y as four floats per pixel, optionally converting it into pScratch.
+template <typename F>
+static FloatImage downsample(int sourceWidth, int sourceHeight, F&& loadRow, MipChainSettings::Filter filter)
+{
+    const int width = std::max(sourceWidth / 2, 1), height = std::max(sourceHeight / 2, 1);
+    const FilterTaps horizontalTaps = computeFilterTaps(filter, sourceWidth, width);
+    const FilterTaps verticalTaps = computeFilterTaps(filter, sourceHeight, height);
+
+    FloatImage horizontal { width, sourceHeight, std::vector<float>(size_t(width) * size_t(sourceHeight) * 4) };
+    ThreadPool::global().parallelFor(size_t(sourceHeight), [&](size_t y) {
+        thread_local std::vector<float> scratch;
+        scratch.resize(size_t(sourceWidth) * 4);
+        const float* pSourceRow = loadRow(y, scratch.data());
+        float* pTargetRow = &horizontal.pixels[y * size_t(width) * 4];
+        for (size_t x = 0; x < size_t(width); x++) {
+            Float4 sum = Float4::broadcast(0.0f);
+            for (size_t tap = horizontalTaps.offsets[x]; tap < horizontalTaps.offsets[x + 1]; tap++)
+                sum = sum + Float4::load(&pSourceRow[size_t(horizontalTaps.sources[tap]) * 4]) * Float4::broadcast(horizontalTaps.weights[tap]);
+            sum.store(&pTargetRow[x * 4]);
+        }
+    });
+
+    FloatImage out { width, height, std::vector<float>(size_t(width) * size_t(height) * 4) };
+    const size_t rowSize = size_t(width) * 4;
+    ThreadPool::global().parallelFor(size_t(height), [&](size_t y) {
+        float* pTargetRow = &out.pixels[y * rowSize];
+        for (size_t tap = verticalTaps.offsets[y]; tap < verticalTaps.offsets[y + 1]; tap++) {
+            const float* pSourceRow = &horizontal.pixels[size_t(verticalTaps.sources[tap]) * rowSize];
+            const Float4 weight = Float4::broadcast(verticalTaps.weights[tap]);
+            for (size_t i = 0; i < rowSize; i += 4)
+                (Float4::load(&pTargetRow[i]) + Float4::load(&pSourceRow[i]) * weight).store(&pTargetRow[i]);
+        }
+    });
+    return out;
+}
 
-    for (size_t i = 0UL; i < width * height * channels; i++) { pixels.emplace_back(stbPixels[i]); }
+// How each channel is stored in the 8-bit image.
+enum class ChannelEncoding { Linear, Srgb, SignedUnit };
+static std::array<ChannelEncoding, 4> channelEncodings(int channels, const MipChainSettings& settings)
+{
+    std::array<ChannelEncoding, 4> out;
+    for (int channel = 0; channel < 4; channel++) {
+        const bool isAlpha = (channels == 2 || channels == 4) && channel == channels - 1;
+        if (settings.normalMap && channels >= 3 && channel < 3)
+            out[size_t(channel)] = ChannelEncoding::SignedUnit;
+        else if (settings.srgb && !isAlpha)
+            out[size_t(channel)] = ChannelEncoding::Srgb;
+        else
+            out[size_t(channel)] = ChannelEncoding::Linear;
+    }
+    return out;
+}
+
+// Decoded value of every byte, for each channel.
+using ChannelTables = std::array<std::array<float, 256>, 4>;
+static ChannelTables decodingTables(const std::array<ChannelEncoding, 4>& encodings)
+{
+    const auto& tables = byteToFloatTables();
+    ChannelTables out;
+    for (size_t channel = 0; channel < 4; channel++) {
+        for (size_t value = 0; value < 256; value++) {
+            switch (encodings[channel]) {
+            case ChannelEncoding::Linear:
+                out[channel][value] = tables.linear[value];
+                break;
+            case ChannelEncoding::Srgb:
+                out[channel][value] = tables.srgb[value];
+                break;
+            case ChannelEncoding::SignedUnit:
+                out[channel][value] = tables.linear[value] * 2.0f - 1.0f;
+                break;
+            }
+        }
+    }
+    return out;
+}
+
+static void decodeRow(const Image& image, int y, const ChannelTables& tables, float* pTarget)
+{
+    const auto row = image.row(y);
+    const auto numChannels = size_t(image.channels);
+    for (size_t x = 0; x < size_t(image.width); x++) {
+        float pixel[4] { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (size_t channel = 0; channel < numChannels; channel++)
+            pixel[channel] = tables[channel][row[x * numChannels + channel]];
+        Float4::load(pixel).store(&pTarget[x * 4]);
+    }
+}
+
+// Inverse of the sRGB table in byteToFloatTables(), indexed by linear values quantized to 16 bits, which is fine
+// enough to resolve the darkest sRGB steps.
+static const std::array<uint8_t, 65536>& linearToSrgbTable()
+{
+    static const std::array<uint8_t, 65536> table = []() {
+        std::array<uint8_t, 65536> out;
+        for (size_t i = 0; i < out.size(); i++) {
+            const float value = float(i) / 65535.0f;
+            const float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+            out[i] = uint8_t(std::nearbyint(std::clamp(srgb, 0.0f, 1.0f) * 255.0f));
+        }
+        return out;
+    }();
+    return table;
+}
+
+static Image encodeFromFloat(const FloatImage& image, int channels, const std::array<ChannelEncoding, 4>& encodings)
+{
+    const auto& srgbTable = linearToSrgbTable();
+    Image out { image.width, image.height, channels };
+    const auto numChannels = size_t(channels);
+    const bool isNormalMap = encodings[0] == ChannelEncoding::SignedUnit;
+    ThreadPool::global().parallelFor(size_t(image.height), [&](size_t y) {
+        const auto row = out.row(int(y));
+        const float* pSource = &image.pixels[y * size_t(image.width) * 4];
+        for (size_t x = 0; x < size_t(image.width); x++) {
+            float pixel[4];
+            // Unit vectors are renormalized, and then mapped to [0, 1] like linear channels.
+            Float4 linear = Float4::load(&pSource[x * 4]);
+            if (isNormalMap) {
+                linear.store(pixel);
+                const float length = std::sqrt(pixel[0] * pixel[0] + pixel[1] * pixel[1] + pixel[2] * pixel[2]);
+                const float normalize[4] { 0.5f / std::max(length, 1e-6f), 0.5f / std::max(length, 1e-6f), 0.5f / std::max(length, 1e-6f), 1.0f };
+                constexpr float offset[4] { 0.5f, 0.5f, 0.5f, 0.0f };
+                linear = linear * Float4::load(normalize) + Float4::load(offset);
+            }
+            (min(max(linear, Float4::broadcast(0.0f)), Float4::broadcast(1.0f)) * Float4::broadcast(255.0f)).store(pixel);
+            for (size_t channel = 0; channel < numChannels; channel++) {
+                if (encodings[channel] == ChannelEncoding::Srgb)
+                    row[x * numChannels + channel] = srgbTable[size_t(pixel[channel] * (65535.0f / 255.0f) + 0.5f)];
+                else
+                    row[x * numChannels + channel] = uint8_t(pixel[channel] + 0.5f);
+            }
+        }
+    });
+    return out;
+}
 
-    stbi_image_free(stbPixels);
+std::vector<Image> generateMipChain(const Image& image, const MipChainSettings& settings)
+{
+    if (image.width <= 1 && image.height <= 1)
+        return {};
+
+    // The first level is filtered straight from the 8-bit image, later levels from the previous (float) level.
+    const auto encodings = channelEncodings(image.channels, settings);
+    const ChannelTables tables = decodingTables(encodings);
+    std::vector<Image> out;
+    FloatImage level = downsample(
+        image.width, image.height, [&](size_t y, float* pScratch) {
+            decodeRow(image, int(y), tables, pScratch);
+            return static_cast<const float*>(pScratch);
+        },
+        settings.filter);
+    out.push_back(encodeFromFloat(level, image.channels, encodings));
+    while (level.width > 1 || level.height > 1) {
+        const FloatImage& source = level;
+        level = downsample(
+            source.width, source.height, [&](size_t y, float*) { return &source.pixels[y * size_t(source.width) * 4]; }, settings.filter);
+        out.push_back(encodeFromFloat(level, image.channels, encodings));
+    }
+    return out;
 }
@@ -0,0 +1,85 @@
+#include "image_cache.h"
+#include "thread_pool.h"
+#include <exception>
+#include <system_error>
+
+ImageCache& ImageCache::global()
+{
+    static ImageCache cache;
+    return cache;
+}
+
+std::shared_ptr<Image> ImageCache::findOrCreateJob(const std::filesystem::path& filePath, std::shared_ptr<DecodeJob>& pJob, bool& isNewJob)
+{
+    // Different spellings of the same file (relative paths, "..", symlinks) should share one entry.
+    std::error_code error;
+    auto canonicalPath = std::filesystem::weakly_canonical(filePath, error);
+    std::string key = (error ? filePath : canonicalPath).generic_string();
+
+    std::lock_guard lock { m_mutex };
+    if (auto iter = m_images.find(key); iter != std::end(m_images)) {
+        if (auto pImage = iter->second.lock())
+            return pImage;
+        m_images.erase(iter);
+    }
+    isNewJob = false;
+    if (auto iter = m_pending.find(key); iter != std::end(m_pending)) {
+        pJob = iter->second;
+        return nullptr;
+    }
+
+    pJob = std::make_shared<DecodeJob>();
+    pJob->filePath = filePath;
+    pJob->key = std::move(key);
+    pJob->future = pJob->promise.get_future().share();
+    m_pending[pJob->key] = pJob;
+    isNewJob = true;
+    return nullptr;
+}
+
+void ImageCache::runJob(DecodeJob& job)
+{
+    if (job.claimed.test_and_set())
+        return;
+
+    // Decode outside of the lock so that other files can be loaded in parallel.
+    try {
+        auto pImage = std::make_shared<Image>(job.filePath);
+        std::lock_guard lock { m_mutex };
+        m_images[job.key] = pImage;
+        m_pending.erase(job.key);
+        job.promise.set_value(std::move(pImage));
+    } catch (...) {
+        std::lock_guard lock { m_mutex };
+        m_pending.erase(job.key);
+        job.promise.set_exception(std::current_exception());
+    }
+}
+
+std::shared_ptr<Image> ImageCache::load(const std::filesystem::path& filePath)
+{
+    std::shared_ptr<DecodeJob> pJob;
+    bool isNewJob;
+    if (auto pImage = findOrCreateJob(filePath, pJob, isNewJob))
+        return pImage;
+
+    // Either decodes the image here, or waits for the thread that already started decoding it.
+    runJob(*pJob);
+    return pJob->future.get();
+}
+
+ImageCache::ImageFuture ImageCache::loadAsync(const std::filesystem::path& filePath)
+{
+    std::shared_ptr<DecodeJob> pJob;
+    bool isNewJob;
+    if (auto pImage = findOrCreateJob(filePath, pJob, isNewJob)) {
+        std::promise<std::shared_ptr<Image>> promise;
+        promise.set_value(std::move(pImage));
+        return promise.get_future().share();
+    }
+
+    // The job keeps itself alive until it ran; errors are reported through its future.
+    if (isNewJob)
+        static_cast<void>(ThreadPool::global().submit([this, pJob]() { runJob(*pJob); }));
+    return pJob->future;
+}
@@ -0,0 +1,114 @@
+#include "mapped_file.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <utility>
+
+MappedFile::MappedFile(const std::filesystem::path& filePath)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw FileMappingException(fmt::format("Could not open file {}", filePath.string()));
+    m_fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        unmap();
+        throw FileMappingException(fmt::format("Could not query size of file {}", filePath.string()));
+    }
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+    if (m_size == 0)
+        return; // Empty files cannot be mapped; data() returns an empty span.
+
+    m_mappingHandle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mappingHandle)
+        m_pData = static_cast<const std::byte*>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!m_pData) {
+        unmap();
+        throw FileMappingException(fmt::format("Could not map file {}", filePath.string()));
+    }
+#else
+    const int file = open(filePath.c_str(), O_RDONLY);
+    if (file == -1)
+        throw FileMappingException(fmt::format("Could not open file {}", filePath.string()));
+
+    struct stat fileStatus;
+    if (fstat(file, &fileStatus) != 0) {
+        ::close(file);
+        throw FileMappingException(fmt::format("Could not query size of file {}", filePath.string()));
+    }
+    m_size = static_cast<size_t>(fileStatus.st_size);
+    if (m_size == 0) {
+        ::close(file);
+        return; // Empty files cannot be mapped; data() returns an empty span.
+    }
+
+    void* pMapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file); // The mapping keeps its own reference to the file.
+    if (pMapping == MAP_FAILED) {
+        m_size = 0;
+        throw FileMappingException(fmt::format("Could not map file {}", filePath.string()));
+    }
+    m_pData = static_cast<const std::byte*>(pMapping);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    moveInto(std::move(other));
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        unmap();
+        moveInto(std::move(other));
+    }
+    return *this;
+}
+
+void MappedFile::moveInto(MappedFile&& other)
+{
+    m_pData = std::exchange(other.m_pData, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+#ifdef _WIN32
+    m_fileHandle = std::exchange(other.m_fileHandle, nullptr);
+    m_mappingHandle = std::exchange(other.m_mappingHandle, nullptr);
+#endif
+}
+
+void MappedFile::unmap()
+{
+#ifdef _WIN32
+    if (m_pData)
+        UnmapViewOfFile(m_pData);
+    if (m_mappingHandle)
+        CloseHandle(m_mappingHandle);
+    if (m_fileHandle)
+        CloseHandle(m_fileHandle);
+    m_fileHandle = m_mappingHandle = nullptr;
+#else
+    if (m_pData)
+        munmap(const_cast<std::byte*>(m_pData), m_size);
+#endif
+    m_pData = nullptr;
+    m_size = 0;
+}
@@ -1,30 +1,32 @@
 #include "mesh.h"
+#include "hash.h"
+#include "image_cache.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+#include "thread_pool.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
-#include <tinyobjloader/tiny_obj_loader.h>
 DISABLE_WARNINGS_POP()
 #include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cmath>
 #include <exception>
 #include <iostream>
+#include <limits>
 #include <numeric>
 #include <span>
 #include <stack>
 #include <string>
-#include <tuple>
-#include <map>
+#include <vector>
 
 static void centerAndScaleToUnitMesh(std::span<Mesh> meshes);
 
-static glm::vec3 construct_vec3(const float* pFloats)
-{
-    return glm::vec3(pFloats[0], pFloats[1], pFloats[2]);
-}
-
 // https://stackoverflow.com/questions/2590677/how-do-i-combine-hash-values-in-c0x
 template <class T>
 static void hash_combine(std::size_t& seed, const T& v)
@@ -49,104 +51,171 @@ struct VertexHash {
     }
 };
 
-std::vector<Mesh> loadMesh(const std::filesystem::path& file, const LoadMeshSettings& settings)
+// Open-addressing (linear probing) table that maps keys to the index of the first vertex with that key.
+// The keys themselves live in the caller's vertex array; the table only stores indices and hashes, so it is
+// allocated once (sized for the maximum number of entries) and never rehashes or allocates per entry.
+class VertexDedupTable {
+public:
+    explicit VertexDedupTable(size_t maxEntries)
+        : m_slots(std::bit_ceil(std::max<size_t>(2 * maxEntries, 16)), Slot { 0, empty })
+        , m_mask(m_slots.size() - 1)
+    {
+    }
+
+    // Return the index of an existing vertex for which isEqual(index) holds, or store and return newIndex.
+    template <typename F>
+    uint32_t findOrInsert(uint64_t hash, uint32_t newIndex, F&& isEqual)
+    {
+        const auto shortHash = static_cast<uint32_t>(hash >> 32);
+        for (size_t slotIdx = hash & m_mask;; slotIdx = (slotIdx + 1) & m_mask) {
+            Slot& slot = m_slots[slotIdx];
+            if (slot.index == empty) {
+                slot = { shortHash, newIndex };
+                return newIndex;
+            }
+            if (slot.hash == shortHash && isEqual(slot.index))
+                return slot.index;
+        }
+    }
+
+private:
+    static constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+    struct Slot {
+        uint32_t hash;
+        uint32_t index;
+    };
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+};
+
+static uint64_t hashObjIndex(const ObjIndex& index)
 {
-    if (!std::filesystem::exists(file)) {
-        std::cerr << "File " << file << " does not exist." << std::endl;
-        throw std::exception();
+    const uint64_t attributes = (uint64_t(uint32_t(index.texCoord)) << 32) | uint32_t(index.normal);
+    return hashMix(hashMix(uint32_t(index.position)) ^ attributes);
+}
+
+static Mesh buildMesh(const ObjData& obj, const ObjFaceGroup& faceGroup, const LoadMeshSettings& settings)
+{
+    assert(faceGroup.corners.size() % 3 == 0);
+
+    Mesh mesh;
+    mesh.triangles.reserve(faceGroup.corners.size() / 3);
+    // Map the index triplet of a vertex as loaded from the OBJ file to its index in the generated mesh.
+    // vertexKeys[i] holds the triplet that created mesh.vertices[i].
+    VertexDedupTable vertexCache { settings.cacheVertices ? faceGroup.corners.size() : 0 };
+    std::vector<ObjIndex> vertexKeys;
+    for (size_t i = 0; i != faceGroup.corners.size(); i += 3) {
+        const glm::vec3 v0 = obj.positions[faceGroup.corners[i + 0].position];
+        const glm::vec3 v1 = obj.positions[faceGroup.corners[i + 1].position];
+        const glm::vec3 v2 = obj.positions[faceGroup.corners[i + 2].position];
+        const auto geometricNormal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+
+        // Load the triangle indices and lazily create the vertices.
+        glm::uvec3 triangle;
+        for (unsigned j = 0; j < 3; j++) {
+            const ObjIndex& objIndex = faceGroup.corners[i + j];
+            Vertex vertex{
+                .position = obj.positions[objIndex.position],
+                .normal = glm::vec3(0),
+                .texCoord = glm::vec2(0)
+            };
+            if (objIndex.normal != -1)
+                vertex.normal = obj.normals[objIndex.normal];
+            else
+                vertex.normal = geometricNormal;
+            if (objIndex.texCoord != -1)
+                vertex.texCoord = obj.texCoords[objIndex.texCoord];
+
+            const auto newIndex = (uint32_t)mesh.vertices.size();
+            if (settings.cacheVertices) {
+                // Already visited this vertex? Reuse it!
+                triangle[j] = vertexCache.findOrInsert(hashObjIndex(objIndex), newIndex, [&](uint32_t existing) {
+                    const ObjIndex& key = vertexKeys[existing];
+                    return key.position == objIndex.position && key.normal == objIndex.normal && key.texCoord == objIndex.texCoord;
+                });
+                if (triangle[j] != newIndex)
+                    continue;
+                vertexKeys.push_back(objIndex);
+            }
+            // New vertex? Create it (it was stored in the vertex cache above).
+            triangle[j] = newIndex;
+            mesh.vertices.push_back(vertex);
+        }
+        mesh.triangles.push_back(triangle);
     }
 
-    const auto baseDir = file.parent_path();
+    if (settings.weldVertices)
+        meshWeldVertices(mesh);
 
-    tinyobj::attrib_t inAttrib;
-    std::vector<tinyobj::shape_t> inShapes;
-    std::vector<tinyobj::material_t> inMaterials;
+    if (faceGroup.material == -1) {
+        mesh.material.kd = glm::vec3(1.0f);
+        mesh.material.ks = glm::vec3(0.0f);
+        mesh.material.shininess = 1.0f;
+    } else {
+        const ObjMaterial& objMaterial = obj.materials[faceGroup.material];
+        mesh.material.kd = objMaterial.kd;
+        if (!objMaterial.diffuseTexture.empty()) {
+            mesh.material.kdTexturePath = objMaterial.diffuseTexture;
+            if (settings.decodeTextures)
+                mesh.material.kdTexture = ImageCache::global().load(mesh.material.kdTexturePath);
+        }
+        mesh.material.ks = objMaterial.ks;
+        mesh.material.shininess = objMaterial.shininess;
+        mesh.material.transparency = objMaterial.transparency;
+    }
+    return mesh;
+}
 
-    std::string warn, error;
-    bool ret = tinyobj::LoadObj(&inAttrib, &inShapes, &inMaterials, &warn, &error, file.string().c_str(), baseDir.string().c_str());
-    if (!ret) {
-        std::cerr << "Failed to load mesh " << file << std::endl;
+std::vector<Mesh> loadMesh(const std::filesystem::path& file, const LoadMeshSettings& settings)
+{
+    if (!std::filesystem::exists(file)) {
+        std::cerr << "File " << file << " does not exist." << std::endl;
         throw std::exception();
     }
 
-    std::vector<Mesh> out;
-    for (const auto& shape : inShapes) {
-        assert(shape.mesh.indices.size() % 3 == 0);
+    // Skip parsing altogether if a cache generated from the same sources exists.
+    std::optional<uint64_t> sourceHash;
+    if (settings.useMeshCache) {
+        sourceHash = MeshCache::computeSourceHash(file, settings);
+        if (auto cache = MeshCache::load(file, *sourceHash))
+            return cache->toMeshes(settings.decodeTextures);
+    }
 
-        size_t startTriangle = 0;
-        auto prevMaterialID = shape.mesh.material_ids[0];
-        for (size_t endTriangle = 0; endTriangle < shape.mesh.indices.size() / 3; ++endTriangle) {
-            // tinyobjloader does not automatically split the mesh into smaller sub meshes according to material so we have to do it ourselves.
-            if (endTriangle == shape.mesh.indices.size() / 3 - 1)
-                ++endTriangle; // End of the tinyobj.shape; write remaining mesh.
-            else if (shape.mesh.material_ids[endTriangle] == prevMaterialID)
-                continue;
-            else
-                prevMaterialID = shape.mesh.material_ids[endTriangle];
-
-            Mesh mesh;
-            using CacheKey = std::tuple<uint32_t, uint32_t, uint32_t>;
-            std::map<CacheKey, uint32_t> vertexCache; // Map the index of a vertex as loaded by tinyobjloader to its index in the generated mesh
-            for (size_t i = startTriangle * 3; i != endTriangle * 3; i += 3) {
-                const glm::vec3 v0 = construct_vec3(&inAttrib.vertices[3 * shape.mesh.indices[i + 0].vertex_index]);
-                const glm::vec3 v1 = construct_vec3(&inAttrib.vertices[3 * shape.mesh.indices[i + 1].vertex_index]);
-                const glm::vec3 v2 = construct_vec3(&inAttrib.vertices[3 * shape.mesh.indices[i + 2].vertex_index]);
-                const auto geometricNormal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
-
-                // Load the triangle indices and lazily create the vertices.
-                glm::uvec3 triangle;
-                for (unsigned j = 0; j < 3; j++) {
-                    const auto& tinyObjIndex = shape.mesh.indices[i + j];
-                    Vertex vertex{
-                        .position = construct_vec3(&inAttrib.vertices[3 * tinyObjIndex.vertex_index]),
-                        .normal = glm::vec3(0),
-                        .texCoord = glm::vec2(0)
-                    };
-                    if (tinyObjIndex.normal_index != -1 && !inAttrib.normals.empty())
-                        vertex.normal = glm::vec3(inAttrib.normals[3 * tinyObjIndex.normal_index + 0], inAttrib.normals[3 * tinyObjIndex.normal_index + 1], inAttrib.normals[3 * tinyObjIndex.normal_index + 2]);
-                    else
-                        vertex.normal = geometricNormal;
-                    if (tinyObjIndex.texcoord_index != -1 && !inAttrib.texcoords.empty())
-                        vertex.texCoord = glm::vec2(inAttrib.texcoords[2 * tinyObjIndex.texcoord_index + 0], inAttrib.texcoords[2 * tinyObjIndex.texcoord_index + 1]);
-
-                    const CacheKey cacheKey{ tinyObjIndex.vertex_index, tinyObjIndex.normal_index, tinyObjIndex.texcoord_index };
-                    if (auto iter = vertexCache.find(cacheKey); settings.cacheVertices && iter != std::end(vertexCache)) {
-                        // Already visited this vertex? Reuse it!
-                        triangle[j] = iter->second;
-                    } else {
-                        // New vertex? Create it and store it in the vertex cache.
-                        vertexCache[cacheKey] = triangle[j] = (unsigned)mesh.vertices.size();
-                        mesh.vertices.push_back(vertex);
-                    }
-                }
-                mesh.triangles.push_back(triangle);
-            }
+    const ObjData obj = settings.parallelObjParser ? parseObj(file) : parseObjTinyObj(file);
 
-            const auto materialID = shape.mesh.material_ids[startTriangle];
-            if (materialID == -1) {
-                mesh.material.kd = glm::vec3(1.0f);
-                mesh.material.ks = glm::vec3(0.0f);
-                mesh.material.shininess = 1.0f;
-            } else {
-                const auto& objMaterial = inMaterials[materialID];
-                mesh.material.kd = construct_vec3(objMaterial.diffuse);
-                if (!objMaterial.diffuse_texname.empty()) {
-                    mesh.material.kdTexture = std::make_shared<Image>(baseDir / objMaterial.diffuse_texname);
-                }
-                mesh.material.ks = construct_vec3(objMaterial.specular);
-                mesh.material.shininess = objMaterial.shininess;
-                mesh.material.transparency = objMaterial.dissolve;
-            }
+    // Decode the textures of the used materials while the sub meshes are built; buildMesh picks them up through the
+    // cache (the futures keep them alive until then).
+    std::vector<ImageCache::ImageFuture> textures;
+    for (const ObjFaceGroup& faceGroup : obj.faceGroups) {
+        if (settings.decodeTextures && faceGroup.material != -1 && !obj.materials[faceGroup.material].diffuseTexture.empty())
+            textures.push_back(ImageCache::global().loadAsync(obj.materials[faceGroup.material].diffuseTexture));
+    }
 
-            out.push_back(std::move(mesh));
+    // Every face group becomes one sub mesh; the groups are independent so build them in parallel.
+    std::vector<Mesh> out(obj.faceGroups.size());
+    std::vector<MeshOptimizationStatistics> optimizationStatistics(out.size());
+    ThreadPool::global().parallelFor(out.size(), [&](size_t i) {
+        out[i] = buildMesh(obj, obj.faceGroups[i], settings);
+        if (settings.computeTangents)
+            meshComputeTangents(out[i]);
+        if (settings.optimizeMeshes)
+            optimizationStatistics[i] = meshOptimize(out[i]);
+    });
 
-            startTriangle = endTriangle;
+    if (settings.optimizeMeshes) {
+        for (size_t i = 0; i < out.size(); i++) {
+            const auto& [before, after] = optimizationStatistics[i];
+            std::cout << file.filename().string() << " sub mesh " << i << " (" << out[i].triangles.size() << " triangles): ACMR "
+                      << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
         }
     }
 
     if (settings.normalizeVertexPositions)
         centerAndScaleToUnitMesh(out);
 
+    if (sourceHash)
+        MeshCache::store(file, *sourceHash, out);
+
     return out;
 }
 
@@ -193,6 +262,135 @@ Mesh mergeMeshes(std::span<const Mesh> meshes)
     return out;
 }
 
+void meshWeldVertices(Mesh& mesh)
+{
+    VertexDedupTable table { mesh.vertices.size() };
+    std::vector<uint32_t> remap(mesh.vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        const Vertex& vertex = mesh.vertices[i];
+        remap[i] = table.findOrInsert(hashMix(VertexHash {}(vertex)), (uint32_t)welded.size(),
+            [&](uint32_t existing) { return welded[existing] == vertex; });
+        if (remap[i] == welded.size())
+            welded.push_back(vertex);
+    }
+
+    for (auto& tri : mesh.triangles)
+        tri = glm::uvec3(remap[tri.x], remap[tri.y], remap[tri.z]);
+    mesh.vertices = std::move(welded);
+}
+
+void meshComputeTangents(Mesh& mesh)
+{
+    // The pool hands out blocks of triangles/vertices, a single one per task would be dominated by scheduling.
+    constexpr size_t blockSize = 4096;
+    const auto parallelForBlocks = [](size_t count, const auto& body) {
+        ThreadPool::global().parallelFor((count + blockSize - 1) / blockSize, [&](size_t block) {
+            const size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; i++)
+                body(i);
+        });
+    };
+    const auto anyPerpendicular = [](const glm::vec3& normal) {
+        const glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+        return glm::normalize(axis - normal * glm::dot(normal, axis));
+    };
+
+    // Like MikkTSpace, the tangent of every triangle corner is the texture space tangent of the triangle projected
+    // into the tangent plane of the vertex normal, weighted by the angle of the corner. Corners of triangles whose
+    // texture mapping is mirrored are kept apart from the others.
+    struct CornerTangent {
+        glm::vec3 weightedTangent;
+        bool orientationPreserving;
+    };
+    std::vector<CornerTangent> corners(3 * mesh.triangles.size());
+    parallelForBlocks(mesh.triangles.size(), [&](size_t triangleIdx) {
+        const glm::uvec3 triangle = mesh.triangles[triangleIdx];
+        const Vertex* triangleVertices[3] = { &mesh.vertices[triangle.x], &mesh.vertices[triangle.y], &mesh.vertices[triangle.z] };
+        const glm::vec3 dp1 = triangleVertices[1]->position - triangleVertices[0]->position;
+        const glm::vec3 dp2 = triangleVertices[2]->position - triangleVertices[0]->position;
+        const glm::vec2 duv1 = triangleVertices[1]->texCoord - triangleVertices[0]->texCoord;
+        const glm::vec2 duv2 = triangleVertices[2]->texCoord - triangleVertices[0]->texCoord;
+        const float signedUVArea = duv1.x * duv2.y - duv1.y * duv2.x;
+        const glm::vec3 faceTangent = signedUVArea != 0.0f ? (dp1 * duv2.y - dp2 * duv1.y) / signedUVArea : glm::vec3(0.0f);
+        const glm::vec3 faceNormal = glm::cross(dp1, dp2);
+
+        for (int corner = 0; corner < 3; corner++) {
+            CornerTangent& out = corners[3 * triangleIdx + corner];
+            out = CornerTangent { .weightedTangent = glm::vec3(0.0f), .orientationPreserving = signedUVArea >= 0.0f };
+
+            const glm::vec3 vertexNormal = triangleVertices[corner]->normal;
+            const glm::vec3 normal = glm::normalize(glm::dot(vertexNormal, vertexNormal) > 0.0f ? vertexNormal : faceNormal);
+            const glm::vec3 tangent = faceTangent - normal * glm::dot(normal, faceTangent);
+            const glm::vec3 edge0 = triangleVertices[(corner + 1) % 3]->position - triangleVertices[corner]->position;
+            const glm::vec3 edge1 = triangleVertices[(corner + 2) % 3]->position - triangleVertices[corner]->position;
+            const glm::vec3 projectedEdge0 = edge0 - normal * glm::dot(normal, edge0);
+            const glm::vec3 projectedEdge1 = edge1 - normal * glm::dot(normal, edge1);
+            const float lengths = glm::length(projectedEdge0) * glm::length(projectedEdge1);
+            if (glm::dot(tangent, tangent) == 0.0f || lengths == 0.0f || !std::isfinite(lengths))
+                continue;
+            const float angle = std::acos(std::clamp(glm::dot(projectedEdge0, projectedEdge1) / lengths, -1.0f, 1.0f));
+            out.weightedTangent = glm::normalize(tangent) * angle;
+        }
+    });
+
+    // Corners around every vertex.
+    const size_t numVertices = mesh.vertices.size();
+    std::vector<uint32_t> vertexCornerOffsets(numVertices + 1, 0);
+    for (const glm::uvec3& triangle : mesh.triangles) {
+        for (int corner = 0; corner < 3; corner++)
+            vertexCornerOffsets[triangle[corner] + 1]++;
+    }
+    std::partial_sum(std::begin(vertexCornerOffsets), std::end(vertexCornerOffsets), std::begin(vertexCornerOffsets));
+    std::vector<uint32_t> vertexCorners(corners.size());
+    {
+        std::vector<uint32_t> cursor { std::begin(vertexCornerOffsets), std::end(vertexCornerOffsets) - 1 };
+        for (uint32_t cornerIdx = 0; cornerIdx < corners.size(); cornerIdx++)
+            vertexCorners[cursor[mesh.triangles[cornerIdx / 3][cornerIdx % 3]]++] = cornerIdx;
+    }
+
+    // Sum per vertex and orientation ([0] = mirrored, [1] = orientation preserving).
+    struct VertexTangents {
+        glm::vec3 sum[2];
+        uint32_t numCorners[2];
+    };
+    std::vector<VertexTangents> vertexTangents(numVertices);
+    parallelForBlocks(numVertices, [&](size_t vertexIdx) {
+        VertexTangents& out = vertexTangents[vertexIdx];
+        out = VertexTangents { .sum = { glm::vec3(0.0f), glm::vec3(0.0f) }, .numCorners = { 0, 0 } };
+        for (uint32_t i = vertexCornerOffsets[vertexIdx]; i < vertexCornerOffsets[vertexIdx + 1]; i++) {
+            const CornerTangent& corner = corners[vertexCorners[i]];
+            out.sum[corner.orientationPreserving] += corner.weightedTangent;
+            out.numCorners[corner.orientationPreserving]++;
+        }
+    });
+
+    const auto assignTangent = [&](Vertex& vertex, const glm::vec3& sum, bool orientationPreserving) {
+        const glm::vec3 normal = glm::dot(vertex.normal, vertex.normal) > 0.0f ? glm::normalize(vertex.normal) : glm::vec3(0, 0, 1);
+        const glm::vec3 tangent = sum - normal * glm::dot(normal, sum);
+        vertex.tangent = glm::dot(tangent, tangent) > 0.0f ? glm::normalize(tangent) : anyPerpendicular(normal);
+        vertex.bitangent = (orientationPreserving ? 1.0f : -1.0f) * glm::cross(normal, vertex.tangent);
+    };
+    for (uint32_t vertexIdx = 0; vertexIdx < numVertices; vertexIdx++) {
+        const VertexTangents& tangents = vertexTangents[vertexIdx];
+        const bool majority = tangents.numCorners[1] >= tangents.numCorners[0];
+        assignTangent(mesh.vertices[vertexIdx], tangents.sum[majority], majority);
+
+        // Vertices on a mirror seam get one copy per orientation, as a single tangent frame cannot serve both.
+        if (tangents.numCorners[!majority] == 0)
+            continue;
+        const auto splitVertexIdx = (uint32_t)mesh.vertices.size();
+        mesh.vertices.push_back(mesh.vertices[vertexIdx]);
+        assignTangent(mesh.vertices.back(), tangents.sum[!majority], !majority);
+        for (uint32_t i = vertexCornerOffsets[vertexIdx]; i < vertexCornerOffsets[vertexIdx + 1]; i++) {
+            const uint32_t cornerIdx = vertexCorners[i];
+            if (corners[cornerIdx].orientationPreserving != majority)
+                mesh.triangles[cornerIdx / 3][cornerIdx % 3] = splitVertexIdx;
+        }
+    }
+}
+
 void meshFlipX(Mesh& mesh)
 {
     for (auto& v : mesh.vertices) {
@@ -0,0 +1,252 @@
+#include "mesh_cache.h"
+#include "hash.h"
+#include "image_cache.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+// Bump whenever the layout of the cache file or the output of loadMesh() changes.
+static constexpr uint32_t cacheVersion = 3;
+static constexpr uint64_t cacheMagic = 0x48434d5346474346ull; // "FCGFSMCH"
+static constexpr uint64_t dataAlignment = 16;
+
+struct CacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t vertexSize;
+    uint64_t sourceHash;
+    uint64_t subMeshCount;
+};
+
+struct CacheRecord {
+    uint64_t vertexOffset;
+    uint64_t vertexCount;
+    uint64_t triangleOffset;
+    uint64_t triangleCount;
+    uint64_t texturePathOffset;
+    uint64_t texturePathLength;
+    glm::vec3 kd;
+    glm::vec3 ks;
+    float shininess;
+    float transparency;
+};
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + dataAlignment - 1) & ~(dataAlignment - 1);
+}
+
+// Collect the material libraries referenced by "mtllib" statements in an OBJ file.
+static std::vector<std::filesystem::path> findMaterialLibraries(std::string_view obj, const std::filesystem::path& baseDir)
+{
+    constexpr std::string_view keyword = "mtllib";
+    std::vector<std::filesystem::path> out;
+    for (size_t pos = obj.find(keyword); pos != std::string_view::npos; pos = obj.find(keyword, pos + keyword.size())) {
+        // Only accept the keyword at the start of a line (ignoring indentation).
+        size_t lineStart = pos;
+        while (lineStart > 0 && (obj[lineStart - 1] == ' ' || obj[lineStart - 1] == '\t'))
+            --lineStart;
+        if (lineStart != 0 && obj[lineStart - 1] != '\n')
+            continue;
+
+        const size_t lineEnd = std::min(obj.find('\n', pos), obj.size());
+        std::string_view arguments = obj.substr(pos + keyword.size(), lineEnd - pos - keyword.size());
+        while (!arguments.empty()) {
+            const auto isSpace = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+            const auto tokenBegin = std::find_if_not(std::begin(arguments), std::end(arguments), isSpace);
+            const auto tokenEnd = std::find_if(tokenBegin, std::end(arguments), isSpace);
+            if (tokenBegin != tokenEnd)
+                out.push_back(baseDir / std::string(tokenBegin, tokenEnd));
+            arguments.remove_prefix(static_cast<size_t>(tokenEnd - std::begin(arguments)));
+        }
+    }
+    return out;
+}
+
+std::filesystem::path meshCachePath(const std::filesystem::path& file)
+{
+    std::filesystem::path out = file;
+    out += ".meshcache";
+    return out;
+}
+
+uint64_t MeshCache::computeSourceHash(const std::filesystem::path& file, const LoadMeshSettings& settings)
+{
+    const MappedFile obj { file };
+    const auto objBytes = obj.data();
+
+    uint64_t hash = hashBytes(objBytes, cacheVersion);
+    const std::string_view objText { reinterpret_cast<const char*>(objBytes.data()), objBytes.size() };
+    for (const auto& mtlFile : findMaterialLibraries(objText, file.parent_path())) {
+        // A missing MTL file is a valid state too (the faces fall back to the default material).
+        if (std::filesystem::exists(mtlFile))
+            hash = hashBytes(MappedFile(mtlFile).data(), hash);
+        else
+            hash = hashBytes(mtlFile.generic_string(), hash);
+    }
+
+    const std::array<bool, 5> settingBits { settings.normalizeVertexPositions, settings.cacheVertices, settings.weldVertices, settings.computeTangents, settings.optimizeMeshes };
+    return hashBytes(std::as_bytes(std::span(settingBits)), hash);
+}
+
+std::optional<MeshCache> MeshCache::load(const std::filesystem::path& file, uint64_t sourceHash)
+{
+    const auto cacheFile = meshCachePath(file);
+    if (!std::filesystem::exists(cacheFile))
+        return {};
+
+    MeshCache out;
+    try {
+        out.m_file = MappedFile(cacheFile);
+    } catch (const FileMappingException& e) {
+        std::cerr << e.what() << std::endl;
+        return {};
+    }
+
+    const auto bytes = out.m_file.data();
+    const auto inBounds = [&](uint64_t offset, uint64_t size) {
+        return offset <= bytes.size() && size <= bytes.size() - offset;
+    };
+
+    if (!inBounds(0, sizeof(CacheHeader)))
+        return {};
+    CacheHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != cacheMagic || header.version != cacheVersion || header.vertexSize != sizeof(Vertex) || header.sourceHash != sourceHash)
+        return {};
+    if (header.subMeshCount > (bytes.size() - sizeof(CacheHeader)) / sizeof(CacheRecord))
+        return {};
+
+    out.m_subMeshes.reserve(header.subMeshCount);
+    for (uint64_t i = 0; i < header.subMeshCount; i++) {
+        CacheRecord record;
+        std::memcpy(&record, bytes.data() + sizeof(CacheHeader) + i * sizeof(CacheRecord), sizeof(record));
+        if (!inBounds(record.vertexOffset, record.vertexCount * sizeof(Vertex))
+            || !inBounds(record.triangleOffset, record.triangleCount * sizeof(glm::uvec3))
+            || !inBounds(record.texturePathOffset, record.texturePathLength)
+            || record.vertexOffset % dataAlignment != 0 || record.triangleOffset % dataAlignment != 0) {
+            std::cerr << "Mesh cache " << meshCachePath(file) << " is corrupt; regenerating it." << std::endl;
+            return {};
+        }
+
+        SubMesh& subMesh = out.m_subMeshes.emplace_back();
+        subMesh.vertices = { reinterpret_cast<const Vertex*>(bytes.data() + record.vertexOffset), record.vertexCount };
+        subMesh.triangles = { reinterpret_cast<const glm::uvec3*>(bytes.data() + record.triangleOffset), record.triangleCount };
+        subMesh.material.kd = record.kd;
+        subMesh.material.ks = record.ks;
+        subMesh.material.shininess = record.shininess;
+        subMesh.material.transparency = record.transparency;
+        if (record.texturePathLength > 0) {
+            // Texture paths are stored relative to the model so that the cache survives moving the resource folder.
+            const auto* pPath = reinterpret_cast<const char8_t*>(bytes.data() + record.texturePathOffset);
+            subMesh.material.kdTexturePath = file.parent_path() / std::u8string(pPath, record.texturePathLength);
+        }
+    }
+    return out;
+}
+
+void MeshCache::store(const std::filesystem::path& file, uint64_t sourceHash, std::span<const Mesh> meshes)
+{
+    // Lay out the file: header, one record per sub mesh, followed by the (aligned) data blocks.
+    std::vector<CacheRecord> records;
+    std::vector<std::u8string> texturePaths;
+    uint64_t offset = sizeof(CacheHeader) + meshes.size() * sizeof(CacheRecord);
+    for (const Mesh& mesh : meshes) {
+        CacheRecord& record = records.emplace_back();
+        record.vertexOffset = offset = alignUp(offset);
+        record.vertexCount = mesh.vertices.size();
+        offset += record.vertexCount * sizeof(Vertex);
+        record.triangleOffset = offset = alignUp(offset);
+        record.triangleCount = mesh.triangles.size();
+        offset += record.triangleCount * sizeof(glm::uvec3);
+
+        if (mesh.material.kdTexturePath.empty())
+            texturePaths.emplace_back();
+        else
+            texturePaths.push_back(mesh.material.kdTexturePath.lexically_relative(file.parent_path()).generic_u8string());
+        record.texturePathOffset = offset;
+        record.texturePathLength = texturePaths.back().size();
+        offset += record.texturePathLength;
+
+        record.kd = mesh.material.kd;
+        record.ks = mesh.material.ks;
+        record.shininess = mesh.material.shininess;
+        record.transparency = mesh.material.transparency;
+    }
+
+    // Write to a temporary file first so that an interrupted write never leaves a truncated cache behind.
+    const auto cacheFile = meshCachePath(file);
+    auto tmpFile = cacheFile;
+    tmpFile += ".tmp";
+    {
+        std::ofstream stream { tmpFile, std::ios::binary | std::ios::trunc };
+        if (!stream) {
+            std::cerr << "Could not write mesh cache " << cacheFile << std::endl;
+            return;
+        }
+
+        uint64_t written = 0;
+        const auto write = [&](const void* pData, uint64_t size) {
+            stream.write(static_cast<const char*>(pData), static_cast<std::streamsize>(size));
+            written += size;
+        };
+        const auto pad = [&](uint64_t target) {
+            static constexpr std::array<char, dataAlignment> zeros {};
+            write(zeros.data(), target - written);
+        };
+
+        const CacheHeader header { cacheMagic, cacheVersion, sizeof(Vertex), sourceHash, meshes.size() };
+        write(&header, sizeof(header));
+        write(records.data(), records.size() * sizeof(CacheRecord));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            pad(records[i].vertexOffset);
+            write(meshes[i].vertices.data(), records[i].vertexCount * sizeof(Vertex));
+            pad(records[i].triangleOffset);
+            write(meshes[i].triangles.data(), records[i].triangleCount * sizeof(glm::uvec3));
+            write(texturePaths[i].data(), texturePaths[i].size());
+        }
+
+        if (!stream) {
+            std::cerr << "Could not write mesh cache " << cacheFile << std::endl;
+            stream.close();
+            std::error_code error;
+            std::filesystem::remove(tmpFile, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpFile, cacheFile, error);
+    if (error) {
+        std::cerr << "Could not write mesh cache " << cacheFile << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpFile, error);
+    }
+}
+
+std::vector<Mesh> MeshCache::toMeshes(bool decodeTextures) const
+{
+    // Decode all textures concurrently before they are picked up one by one below.
+    std::vector<ImageCache::ImageFuture> textures;
+    for (const SubMesh& subMesh : m_subMeshes) {
+        if (decodeTextures && !subMesh.material.kdTexturePath.empty())
+            textures.push_back(ImageCache::global().loadAsync(subMesh.material.kdTexturePath));
+    }
+
+    std::vector<Mesh> out;
+    out.reserve(m_subMeshes.size());
+    for (const SubMesh& subMesh : m_subMeshes) {
+        Mesh& mesh = out.emplace_back();
+        mesh.vertices.assign(std::begin(subMesh.vertices), std::end(subMesh.vertices));
+        mesh.triangles.assign(std::begin(subMesh.triangles), std::end(subMesh.triangles));
+        mesh.material = subMesh.material;
+        if (decodeTextures && !mesh.material.kdTexturePath.empty())
+            mesh.material.kdTexture = ImageCache::global().load(mesh.material.kdTexturePath);
+    }
+    return out;
+}
@@ -0,0 +1,286 @@
+#include "mesh_optimizer.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+VertexCacheStatistics analyzeVertexCache(std::span<const glm::uvec3> triangles, size_t numVertices, unsigned cacheSize)
+{
+    // Timestamp at which each vertex entered the FIFO; it is a hit while fewer than cacheSize vertices entered since.
+    std::vector<uint32_t> cacheTime(numVertices, 0);
+    std::vector<bool> referenced(numVertices, false);
+    uint32_t time = cacheSize + 1;
+    size_t numTransformed = 0, numReferenced = 0;
+    for (const glm::uvec3& triangle : triangles) {
+        for (int i = 0; i < 3; i++) {
+            const uint32_t vertex = triangle[i];
+            if (time - cacheTime[vertex] > cacheSize) {
+                cacheTime[vertex] = time++;
+                numTransformed++;
+            }
+            if (!referenced[vertex]) {
+                referenced[vertex] = true;
+                numReferenced++;
+            }
+        }
+    }
+
+    return VertexCacheStatistics {
+        .acmr = triangles.empty() ? 0.0f : float(numTransformed) / float(triangles.size()),
+        .atvr = numReferenced == 0 ? 0.0f : float(numTransformed) / float(numReferenced)
+    };
+}
+
+namespace {
+// Size of the LRU cache modeled by the score function; larger than any real cache on purpose (see Forsyth).
+constexpr int maxCacheSize = 32;
+constexpr size_t maxValence = 32;
+
+// Score of a vertex given its position in the modeled cache (-1 if not in the cache).
+float cachePositionScore(int position)
+{
+    if (position < 0)
+        return 0.0f;
+    // The last triangle's vertices get a fixed score so that the next triangle does not always reuse its edge,
+    // which would produce long thin strips.
+    if (position < 3)
+        return 0.75f;
+    return std::pow(1.0f - float(position - 3) / float(maxCacheSize - 3), 1.5f);
+}
+
+// Vertices with few remaining triangles are preferred so that no lonely triangles are left behind.
+float valenceScore(size_t remainingTriangles)
+{
+    return remainingTriangles == 0 ? 0.0f : 2.0f / std::sqrt(float(remainingTriangles));
+}
+
+struct ScoreTables {
+    std::array<float, maxCacheSize + 1> cache; // Index 0 is "not in cache".
+    std::array<float, maxValence> valence;
+    ScoreTables()
+    {
+        for (int i = 0; i <= maxCacheSize; i++)
+            cache[i] = cachePositionScore(i - 1);
+        for (size_t i = 0; i < maxValence; i++)
+            valence[i] = valenceScore(i);
+    }
+    float operator()(int cachePosition, size_t remainingTriangles) const
+    {
+        const float valenceTerm = remainingTriangles < maxValence ? valence[remainingTriangles] : valenceScore(remainingTriangles);
+        return cache[cachePosition + 1] + valenceTerm;
+    }
+};
+}
+
+void optimizeVertexCache(std::span<glm::uvec3> triangles, size_t numVertices)
+{
+    const size_t numTriangles = triangles.size();
+    if (numTriangles == 0)
+        return;
+    static const ScoreTables vertexScore;
+
+    // Triangles adjacent to every vertex (CSR layout). Emitted triangles are swapped out of a vertex's range so
+    // that the first remaining[v] entries are the triangles that still have to be drawn.
+    std::vector<uint32_t> remaining(numVertices, 0);
+    for (const glm::uvec3& triangle : triangles) {
+        for (int i = 0; i < 3; i++)
+            remaining[triangle[i]]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(numVertices + 1, 0);
+    std::inclusive_scan(std::begin(remaining), std::end(remaining), std::begin(adjacencyOffsets) + 1);
+    std::vector<uint32_t> adjacency(adjacencyOffsets.back());
+    {
+        std::vector<uint32_t> fill(std::begin(adjacencyOffsets), std::end(adjacencyOffsets) - 1);
+        for (uint32_t t = 0; t < numTriangles; t++) {
+            for (int i = 0; i < 3; i++)
+                adjacency[fill[triangles[t][i]]++] = t;
+        }
+    }
+
+    std::vector<float> score(numVertices);
+    for (size_t v = 0; v < numVertices; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+    std::vector<float> triangleScore(numTriangles);
+    for (size_t t = 0; t < numTriangles; t++)
+        triangleScore[t] = score[triangles[t].x] + score[triangles[t].y] + score[triangles[t].z];
+    std::vector<bool> emitted(numTriangles, false);
+
+    std::vector<glm::uvec3> output;
+    output.reserve(numTriangles);
+    std::vector<uint32_t> cache, newCache;
+    cache.reserve(maxCacheSize + 3);
+    newCache.reserve(maxCacheSize + 3);
+
+    size_t bestTriangle = std::distance(std::begin(triangleScore), std::max_element(std::begin(triangleScore), std::end(triangleScore)));
+    size_t deadEndCursor = 0;
+    while (true) {
+        const glm::uvec3 triangle = triangles[bestTriangle];
+        emitted[bestTriangle] = true;
+        output.push_back(triangle);
+        if (output.size() == numTriangles)
+            break;
+
+        // Move the triangle's vertices to the front of the cache and drop the triangle from their adjacency.
+        newCache.clear();
+        for (int i = 0; i < 3; i++) {
+            const uint32_t vertex = triangle[i];
+            if (std::find(std::begin(newCache), std::end(newCache), vertex) == std::end(newCache))
+                newCache.push_back(vertex);
+
+            const auto first = std::begin(adjacency) + adjacencyOffsets[vertex];
+            const auto last = first + remaining[vertex];
+            std::iter_swap(std::find(first, last, uint32_t(bestTriangle)), last - 1);
+            remaining[vertex]--;
+        }
+        for (uint32_t vertex : cache) {
+            if (vertex != triangle.x && vertex != triangle.y && vertex != triangle.z)
+                newCache.push_back(vertex);
+        }
+        // Vertices that fall out of the modeled cache lose their cache score.
+        for (size_t i = maxCacheSize; i < newCache.size(); i++)
+            score[newCache[i]] = vertexScore(-1, remaining[newCache[i]]);
+        newCache.resize(std::min<size_t>(newCache.size(), maxCacheSize));
+        std::swap(cache, newCache);
+
+        // Only triangles that touch the cache changed score; the best of those is drawn next.
+        for (size_t i = 0; i < cache.size(); i++)
+            score[cache[i]] = vertexScore(int(i), remaining[cache[i]]);
+        float bestScore = -1.0f;
+        for (uint32_t vertex : cache) {
+            const auto first = std::begin(adjacency) + adjacencyOffsets[vertex];
+            for (auto iter = first; iter != first + remaining[vertex]; ++iter) {
+                const glm::uvec3& adjacent = triangles[*iter];
+                triangleScore[*iter] = score[adjacent.x] + score[adjacent.y] + score[adjacent.z];
+                if (triangleScore[*iter] > bestScore) {
+                    bestScore = triangleScore[*iter];
+                    bestTriangle = *iter;
+                }
+            }
+        }
+
+        // Dead end: none of the cached vertices has triangles left, continue with the next one in input order.
+        if (bestScore < 0.0f) {
+            while (emitted[deadEndCursor])
+                deadEndCursor++;
+            bestTriangle = deadEndCursor;
+        }
+    }
+
+    std::copy(std::begin(output), std::end(output), std::begin(triangles));
+}
+
+void optimizeOverdraw(std::span<glm::uvec3> triangles, std::span<const Vertex> vertices)
+{
+    if (triangles.empty())
+        return;
+
+    // A new cluster starts at every triangle whose vertices all miss the (simulated) cache. Those triangles are
+    // cache misses in any order, so reordering the clusters does not make the vertex cache efficiency worse.
+    constexpr uint32_t cacheSize = 16;
+    std::vector<uint32_t> cacheTime(vertices.size(), 0);
+    uint32_t time = cacheSize + 1;
+    std::vector<size_t> clusterStarts;
+    for (size_t t = 0; t < triangles.size(); t++) {
+        int misses = 0;
+        for (int i = 0; i < 3; i++) {
+            const uint32_t vertex = triangles[t][i];
+            if (time - cacheTime[vertex] > cacheSize) {
+                cacheTime[vertex] = time++;
+                misses++;
+            }
+        }
+        if (misses == 3)
+            clusterStarts.push_back(t);
+    }
+    clusterStarts.push_back(triangles.size());
+
+    // Clusters that face away from the center of the mesh are likely to occlude the others, so draw them first.
+    struct Cluster {
+        size_t begin, end;
+        glm::vec3 centroid { 0.0f };
+        glm::vec3 normal { 0.0f };
+        float sortKey { 0.0f };
+    };
+    std::vector<Cluster> clusters;
+    clusters.reserve(clusterStarts.size() - 1);
+    glm::vec3 meshCentroid { 0.0f };
+    float meshArea = 0.0f;
+    for (size_t c = 0; c + 1 < clusterStarts.size(); c++) {
+        Cluster& cluster = clusters.emplace_back(Cluster { .begin = clusterStarts[c], .end = clusterStarts[c + 1] });
+        float clusterArea = 0.0f;
+        for (size_t t = cluster.begin; t < cluster.end; t++) {
+            const glm::vec3 p0 = vertices[triangles[t].x].position;
+            const glm::vec3 p1 = vertices[triangles[t].y].position;
+            const glm::vec3 p2 = vertices[triangles[t].z].position;
+            // Area weighted, the length of the cross product is twice the triangle area.
+            const glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+            const float area = glm::length(areaNormal);
+            cluster.normal += areaNormal;
+            cluster.centroid += (p0 + p1 + p2) * (area / 3.0f);
+            clusterArea += area;
+        }
+        meshCentroid += cluster.centroid;
+        meshArea += clusterArea;
+        cluster.centroid = clusterArea > 0.0f ? cluster.centroid / clusterArea : vertices[triangles[cluster.begin].x].position;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+    for (Cluster& cluster : clusters) {
+        const float normalLength = glm::length(cluster.normal);
+        cluster.sortKey = normalLength > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / normalLength) : 0.0f;
+    }
+    std::stable_sort(std::begin(clusters), std::end(clusters), [](const Cluster& lhs, const Cluster& rhs) { return lhs.sortKey > rhs.sortKey; });
+
+    std::vector<glm::uvec3> output;
+    output.reserve(triangles.size());
+    for (const Cluster& cluster : clusters)
+        output.insert(std::end(output), std::begin(triangles) + cluster.begin, std::begin(triangles) + cluster.end);
+    std::copy(std::begin(output), std::end(output), std::begin(triangles));
+}
+
+std::vector<uint32_t> computeVertexFetchRemap(std::span<const glm::uvec3> triangles, size_t numVertices)
+{
+    constexpr uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(numVertices, unused);
+    uint32_t next = 0;
+    for (const glm::uvec3& triangle : triangles) {
+        for (int i = 0; i < 3; i++) {
+            if (remap[triangle[i]] == unused)
+                remap[triangle[i]] = next++;
+        }
+    }
+    for (uint32_t& index : remap) {
+        if (index == unused)
+            index = next++;
+    }
+    return remap;
+}
+
+void meshRemapVertices(Mesh& mesh, std::span<const uint32_t> remap)
+{
+    assert(remap.size() == mesh.vertices.size());
+    std::vector<Vertex> vertices(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++)
+        vertices[remap[i]] = mesh.vertices[i];
+    mesh.vertices = std::move(vertices);
+    for (glm::uvec3& triangle : mesh.triangles)
+        triangle = glm::uvec3(remap[triangle.x], remap[triangle.y], remap[triangle.z]);
+}
+
+MeshOptimizationStatistics meshOptimize(Mesh& mesh)
+{
+    MeshOptimizationStatistics out;
+    out.before = analyzeVertexCache(mesh.triangles, mesh.vertices.size());
+    optimizeVertexCache(mesh.triangles, mesh.vertices.size());
+    optimizeOverdraw(mesh.triangles, mesh.vertices);
+    meshRemapVertices(mesh, computeVertexFetchRemap(mesh.triangles, mesh.vertices.size()));
+    out.after = analyzeVertexCache(mesh.triangles, mesh.vertices.size());
+    return out;
+}
@@ -0,0 +1,331 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <tuple>
+
+namespace {
+// Symmetric 4x4 matrix (A, b, c) of the sum of squared distances to a set of planes, each weighted by the area of the
+// triangle it came from. Doubles, because the terms cancel out almost completely for points close to the planes.
+struct Quadric {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+enum class VertexKind : uint8_t {
+    Interior,
+    // On an open boundary; may only slide along it.
+    Border,
+    // Seam, non-manifold or (with SimplifySettings::lockBorder) border vertex.
+    Locked
+};
+
+struct Collapse {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+};
+}
+
+static Quadric planeQuadric(const glm::vec3& normal, const glm::vec3& pointOnPlane, double weight)
+{
+    const double nx = normal.x, ny = normal.y, nz = normal.z;
+    const double d = -glm::dot(normal, pointOnPlane);
+    return Quadric {
+        .a00 = weight * nx * nx, .a01 = weight * nx * ny, .a02 = weight * nx * nz,
+        .a11 = weight * ny * ny, .a12 = weight * ny * nz, .a22 = weight * nz * nz,
+        .b0 = weight * nx * d, .b1 = weight * ny * d, .b2 = weight * nz * d,
+        .c = weight * d * d,
+        .weight = weight
+    };
+}
+
+static void addQuadric(Quadric& lhs, const Quadric& rhs)
+{
+    lhs.a00 += rhs.a00;
+    lhs.a01 += rhs.a01;
+    lhs.a02 += rhs.a02;
+    lhs.a11 += rhs.a11;
+    lhs.a12 += rhs.a12;
+    lhs.a22 += rhs.a22;
+    lhs.b0 += rhs.b0;
+    lhs.b1 += rhs.b1;
+    lhs.b2 += rhs.b2;
+    lhs.c += rhs.c;
+    lhs.weight += rhs.weight;
+}
+
+// Weighted mean of the squared distances from point to the planes of the quadric.
+static double evaluateQuadric(const Quadric& q, const glm::vec3& point)
+{
+    const double x = point.x, y = point.y, z = point.z;
+    const double error = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+        + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+        + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+    return q.weight > 0.0 ? std::max(error, 0.0) / q.weight : 0.0;
+}
+
+static uint64_t edgeKey(uint32_t a, uint32_t b)
+{
+    return (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+}
+
+static std::vector<VertexKind> classifyVertices(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices, const SimplifySettings& settings)
+{
+    std::vector<VertexKind> kinds(vertices.size(), VertexKind::Interior);
+
+    // Vertices that share their position with another one lie on an attribute seam.
+    std::vector<uint32_t> byPosition(vertices.size());
+    std::iota(std::begin(byPosition), std::end(byPosition), 0);
+    const auto positionLess = [&](uint32_t lhs, uint32_t rhs) {
+        const glm::vec3& a = vertices[lhs].position;
+        const glm::vec3& b = vertices[rhs].position;
+        return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+    };
+    std::sort(std::begin(byPosition), std::end(byPosition), positionLess);
+    for (size_t i = 1; i < byPosition.size(); i++) {
+        if (vertices[byPosition[i - 1]].position == vertices[byPosition[i]].position) {
+            kinds[byPosition[i - 1]] = VertexKind::Locked;
+            kinds[byPosition[i]] = VertexKind::Locked;
+        }
+    }
+
+    // Edges that are used by a single triangle are on the border; edges shared by more than two are non-manifold.
+    std::vector<uint64_t> edges;
+    edges.reserve(3 * triangles.size());
+    for (const glm::uvec3& triangle : triangles) {
+        for (int i = 0; i < 3; i++)
+            edges.push_back(edgeKey(triangle[i], triangle[(i + 1) % 3]));
+    }
+    std::sort(std::begin(edges), std::end(edges));
+    for (size_t first = 0; first < edges.size();) {
+        size_t last = first + 1;
+        while (last < edges.size() && edges[last] == edges[first])
+            last++;
+        const size_t numUses = last - first;
+        if (numUses != 2) {
+            const VertexKind kind = (numUses > 2 || settings.lockBorder) ? VertexKind::Locked : VertexKind::Border;
+            for (const uint32_t vertex : { uint32_t(edges[first] >> 32), uint32_t(edges[first]) }) {
+                if (kinds[vertex] != VertexKind::Locked)
+                    kinds[vertex] = kind;
+            }
+        }
+        first = last;
+    }
+    return kinds;
+}
+
+static std::vector<Quadric> computeVertexQuadrics(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices)
+{
+    // Border edges get an additional plane perpendicular to their triangle, so that moving a border vertex off the
+    // border line is penalized as well.
+    constexpr double borderWeight = 10.0;
+
+    std::vector<uint64_t> edges;
+    edges.reserve(3 * triangles.size());
+    for (const glm::uvec3& triangle : triangles) {
+        for (int i = 0; i < 3; i++)
+            edges.push_back(edgeKey(triangle[i], triangle[(i + 1) % 3]));
+    }
+    std::sort(std::begin(edges), std::end(edges));
+    const auto isBorderEdge = [&](uint32_t a, uint32_t b) {
+        const auto [first, last] = std::equal_range(std::begin(edges), std::end(edges), edgeKey(a, b));
+        return last - first == 1;
+    };
+
+    std::vector<Quadric> quadrics(vertices.size(), Quadric {});
+    for (const glm::uvec3& triangle : triangles) {
+        const glm::vec3 p0 = vertices[triangle.x].position;
+        const glm::vec3 cross = glm::cross(vertices[triangle.y].position - p0, vertices[triangle.z].position - p0);
+        const float doubleArea = glm::length(cross);
+        if (doubleArea == 0.0f)
+            continue;
+        const glm::vec3 normal = cross / doubleArea;
+
+        const Quadric quadric = planeQuadric(normal, p0, 0.5 * doubleArea);
+        for (int i = 0; i < 3; i++)
+            addQuadric(quadrics[triangle[i]], quadric);
+
+        for (int i = 0; i < 3; i++) {
+            const uint32_t a = triangle[i], b = triangle[(i + 1) % 3];
+            if (!isBorderEdge(a, b))
+                continue;
+            const glm::vec3 edge = vertices[b].position - vertices[a].position;
+            const float edgeLength = glm::length(edge);
+            if (edgeLength == 0.0f)
+                continue;
+            const glm::vec3 borderNormal = glm::normalize(glm::cross(edge / edgeLength, normal));
+            Quadric borderQuadric = planeQuadric(borderNormal, vertices[a].position, borderWeight * edgeLength * edgeLength);
+            // Only the surface area counts towards the mean, so the penalty is not averaged away.
+            borderQuadric.weight = 0.0;
+            addQuadric(quadrics[a], borderQuadric);
+            addQuadric(quadrics[b], borderQuadric);
+        }
+    }
+    return quadrics;
+}
+
+std::vector<glm::uvec3> simplifyMesh(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices, size_t targetTriangleCount, const SimplifySettings& settings, float* pResultError)
+{
+    const size_t numVertices = vertices.size();
+    const std::vector<VertexKind> kinds = classifyVertices(triangles, vertices, settings);
+    std::vector<Quadric> quadrics = computeVertexQuadrics(triangles, vertices);
+
+    std::vector<glm::uvec3> result { std::begin(triangles), std::end(triangles) };
+    double maxCost = 0.0;
+
+    std::vector<uint32_t> vertexTriangleOffsets(numVertices + 1);
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<uint64_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(numVertices);
+    std::vector<bool> touched(numVertices);
+
+    // Every pass collapses a set of independent edges (no two collapses touch the same triangles), cheapest first.
+    while (result.size() > targetTriangleCount) {
+        // Triangles around every vertex.
+        std::fill(std::begin(vertexTriangleOffsets), std::end(vertexTriangleOffsets), 0);
+        for (const glm::uvec3& triangle : result) {
+            for (int i = 0; i < 3; i++)
+                vertexTriangleOffsets[triangle[i] + 1]++;
+        }
+        std::partial_sum(std::begin(vertexTriangleOffsets), std::end(vertexTriangleOffsets), std::begin(vertexTriangleOffsets));
+        vertexTriangles.resize(3 * result.size());
+        {
+            std::vector<uint32_t> cursor { std::begin(vertexTriangleOffsets), std::end(vertexTriangleOffsets) - 1 };
+            for (uint32_t triangleIdx = 0; triangleIdx < result.size(); triangleIdx++) {
+                for (int i = 0; i < 3; i++)
+                    vertexTriangles[cursor[result[triangleIdx][i]]++] = triangleIdx;
+            }
+        }
+
+        // Cheapest allowed direction of every edge.
+        edges.clear();
+        for (const glm::uvec3& triangle : result) {
+            for (int i = 0; i < 3; i++)
+                edges.push_back(edgeKey(triangle[i], triangle[(i + 1) % 3]));
+        }
+        std::sort(std::begin(edges), std::end(edges));
+        collapses.clear();
+        for (size_t first = 0; first < edges.size();) {
+            size_t last = first + 1;
+            while (last < edges.size() && edges[last] == edges[first])
+                last++;
+            const bool isBorderEdge = last - first == 1;
+            const uint32_t a = uint32_t(edges[first] >> 32), b = uint32_t(edges[first]);
+            if (last - first <= 2) {
+                Collapse best { .cost = -1.0, .from = a, .to = b };
+                for (const auto& [from, to] : { std::pair { a, b }, std::pair { b, a } }) {
+                    const bool allowed = kinds[from] == VertexKind::Interior || (kinds[from] == VertexKind::Border && isBorderEdge);
+                    if (!allowed)
+                        continue;
+                    Quadric combined = quadrics[from];
+                    addQuadric(combined, quadrics[to]);
+                    const double cost = evaluateQuadric(combined, vertices[to].position);
+                    if (best.cost < 0.0 || cost < best.cost)
+                        best = Collapse { .cost = cost, .from = from, .to = to };
+                }
+                if (best.cost >= 0.0)
+                    collapses.push_back(best);
+            }
+            first = last;
+        }
+        std::sort(std::begin(collapses), std::end(collapses), [](const Collapse& lhs, const Collapse& rhs) { return lhs.cost < rhs.cost; });
+
+        std::iota(std::begin(remap), std::end(remap), 0);
+        std::fill(std::begin(touched), std::end(touched), false);
+        const size_t numTrianglesToRemove = result.size() - targetTriangleCount;
+        size_t numTrianglesRemoved = 0, numCollapses = 0;
+        for (const Collapse& collapse : collapses) {
+            if (numTrianglesRemoved >= numTrianglesToRemove)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            const auto fromTriangles = std::span(vertexTriangles).subspan(vertexTriangleOffsets[collapse.from],
+                vertexTriangleOffsets[collapse.from + 1] - vertexTriangleOffsets[collapse.from]);
+
+            // Reject collapses that flip (or turn a triangle into a sliver whose normal differs by more than ~75
+            // degrees) any of the triangles that remain.
+            size_t numCollapsedTriangles = 0;
+            bool flips = false;
+            for (const uint32_t triangleIdx : fromTriangles) {
+                const glm::uvec3& triangle = result[triangleIdx];
+                if (triangle.x == collapse.to || triangle.y == collapse.to || triangle.z == collapse.to) {
+                    numCollapsedTriangles++;
+                    continue;
+                }
+                glm::vec3 positions[3];
+                for (int i = 0; i < 3; i++)
+                    positions[i] = vertices[triangle[i]].position;
+                const glm::vec3 oldNormal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+                for (int i = 0; i < 3; i++) {
+                    if (triangle[i] == collapse.from)
+                        positions[i] = vertices[collapse.to].position;
+                }
+                const glm::vec3 newNormal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+                if (glm::dot(oldNormal, newNormal) <= 0.25f * glm::length(oldNormal) * glm::length(newNormal)) {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+            for (const uint32_t triangleIdx : fromTriangles) {
+                for (int i = 0; i < 3; i++)
+                    touched[result[triangleIdx][i]] = true;
+            }
+            maxCost = std::max(maxCost, collapse.cost);
+            numTrianglesRemoved += numCollapsedTriangles;
+            numCollapses++;
+        }
+        if (numCollapses == 0)
+            break;
+
+        for (glm::uvec3& triangle : result)
+            triangle = glm::uvec3(remap[triangle.x], remap[triangle.y], remap[triangle.z]);
+        std::erase_if(result, [](const glm::uvec3& triangle) {
+            return triangle.x == triangle.y || triangle.y == triangle.z || triangle.z == triangle.x;
+        });
+    }
+
+    if (pResultError)
+        *pResultError = float(std::sqrt(maxCost));
+    return result;
+}
+
+std::vector<MeshLod> generateLodChain(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices, const SimplifySettings& settings, size_t maxLevels, float reductionPerLevel)
+{
+    std::vector<MeshLod> lods;
+    lods.reserve(maxLevels);
+
+    std::span<const glm::uvec3> previousTriangles = triangles;
+    float previousError = 0.0f;
+    while (lods.size() < maxLevels) {
+        const size_t targetTriangleCount = size_t(float(previousTriangles.size()) * reductionPerLevel);
+        float error = 0.0f;
+        std::vector<glm::uvec3> lodTriangles = simplifyMesh(previousTriangles, vertices, targetTriangleCount, settings, &error);
+        // Not worth the extra index data (this also happens when most of the mesh is locked by seams).
+        if (lodTriangles.empty() || 10 * lodTriangles.size() > 9 * previousTriangles.size())
+            break;
+
+        optimizeVertexCache(lodTriangles, vertices.size());
+        // Each level is simplified from the previous one, so the errors add up.
+        lods.push_back(MeshLod { .triangles = std::move(lodTriangles), .error = previousError + error });
+        previousTriangles = lods.back().triangles;
+        previousError = lods.back().error;
+    }
+    return lods;
+}
@@ -0,0 +1,102 @@
+#include "meshlet.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static glm::vec3 triangleNormal(std::span<const Vertex> vertices, const glm::uvec3& triangle)
+{
+    const glm::vec3 p0 = vertices[triangle.x].position;
+    const glm::vec3 normal = glm::cross(vertices[triangle.y].position - p0, vertices[triangle.z].position - p0);
+    const float length = glm::length(normal);
+    return length > 0.0f ? normal / length : glm::vec3(0.0f);
+}
+
+static void computeMeshletBounds(Meshlet& meshlet, std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices)
+{
+    const auto meshletTriangles = triangles.subspan(meshlet.firstTriangle, meshlet.numTriangles);
+
+    // Sphere around the center of the bounding box; not minimal, but cheap and tight enough for small clusters.
+    glm::vec3 aabbMin { std::numeric_limits<float>::max() }, aabbMax { std::numeric_limits<float>::lowest() };
+    for (const glm::uvec3& triangle : meshletTriangles) {
+        for (int i = 0; i < 3; i++) {
+            aabbMin = glm::min(aabbMin, vertices[triangle[i]].position);
+            aabbMax = glm::max(aabbMax, vertices[triangle[i]].position);
+        }
+    }
+    meshlet.center = 0.5f * (aabbMin + aabbMax);
+    float radiusSquared = 0.0f;
+    for (const glm::uvec3& triangle : meshletTriangles) {
+        for (int i = 0; i < 3; i++) {
+            const glm::vec3 offset = vertices[triangle[i]].position - meshlet.center;
+            radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+        }
+    }
+    meshlet.radius = std::sqrt(radiusSquared);
+
+    // The cone axis is the average normal; the cone's opening angle is determined by the normal furthest from it.
+    glm::vec3 normalSum { 0.0f };
+    for (const glm::uvec3& triangle : meshletTriangles)
+        normalSum += triangleNormal(vertices, triangle);
+    const float normalSumLength = glm::length(normalSum);
+    meshlet.coneAxis = normalSumLength > 0.0f ? normalSum / normalSumLength : glm::vec3(0.0f, 0.0f, 1.0f);
+    float minDot = 1.0f;
+    for (const glm::uvec3& triangle : meshletTriangles)
+        minDot = std::min(minDot, glm::dot(triangleNormal(vertices, triangle), meshlet.coneAxis));
+
+    // The meshlet is back-facing when the view direction lies within 90 degrees minus the spread of the normals of
+    // the axis; the cutoff is the cosine of that angle. Nearly flat spreads are not worth testing.
+    meshlet.coneCutoff = (normalSumLength == 0.0f || minDot <= 0.1f) ? 2.0f : std::sqrt(1.0f - minDot * minDot);
+}
+
+std::vector<Meshlet> buildMeshlets(std::span<const glm::uvec3> triangles, std::span<const Vertex> vertices, uint32_t maxTriangles, uint32_t maxVertices)
+{
+    // Only small meshlets are allowed to break the normal cone rule, so tiny fragments are avoided.
+    constexpr uint32_t minTrianglesBeforeConeSplit = 16;
+
+    std::vector<Meshlet> out;
+    // Meshlet that a vertex was last added to, to count the unique vertices of the current meshlet.
+    std::vector<uint32_t> vertexMeshlet(vertices.size(), std::numeric_limits<uint32_t>::max());
+    uint32_t numMeshletVertices = 0;
+    glm::vec3 meshletNormalSum { 0.0f };
+    for (uint32_t t = 0; t < triangles.size(); t++) {
+        const glm::uvec3& triangle = triangles[t];
+        const auto currentMeshlet = static_cast<uint32_t>(out.size() - 1);
+        uint32_t newVertices = 0;
+        for (int i = 0; i < 3; i++) {
+            if (out.empty() || vertexMeshlet[triangle[i]] != currentMeshlet)
+                newVertices++;
+        }
+        const glm::vec3 normal = triangleNormal(vertices, triangle);
+
+        const bool startMeshlet = out.empty()
+            || out.back().numTriangles == maxTriangles
+            || numMeshletVertices + newVertices > maxVertices
+            || (out.back().numTriangles >= minTrianglesBeforeConeSplit && glm::dot(normal, meshletNormalSum) < 0.0f);
+        if (startMeshlet) {
+            out.push_back(Meshlet { .firstTriangle = t, .numTriangles = 0, .center {}, .radius = 0, .coneAxis {}, .coneCutoff = 2.0f });
+            numMeshletVertices = 0;
+            meshletNormalSum = glm::vec3(0.0f);
+        }
+
+        Meshlet& meshlet = out.back();
+        const auto meshletIndex = static_cast<uint32_t>(out.size() - 1);
+        for (int i = 0; i < 3; i++) {
+            if (vertexMeshlet[triangle[i]] != meshletIndex) {
+                vertexMeshlet[triangle[i]] = meshletIndex;
+                numMeshletVertices++;
+            }
+        }
+        meshlet.numTriangles++;
+        meshletNormalSum += normal;
+    }
+
+    for (Meshlet& meshlet : out)
+        computeMeshletBounds(meshlet, triangles, vertices);
+    return out;
+}
@@ -0,0 +1,133 @@
+#include "mip_cache.h"
+#include "hash.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+
+// Bump whenever the layout of the cache file or the output of generateMipChain() changes.
+static constexpr uint32_t cacheVersion = 1;
+static constexpr uint64_t cacheMagic = 0x48434d5046474346ull; // "FCGFPMCH"
+static constexpr uint64_t dataAlignment = 16;
+
+struct CacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t channels;
+    uint64_t sourceHash;
+    uint32_t width;
+    uint32_t height;
+    uint64_t levelCount;
+};
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + dataAlignment - 1) & ~(dataAlignment - 1);
+}
+
+std::filesystem::path mipCachePath(const std::filesystem::path& file)
+{
+    std::filesystem::path out = file;
+    out += ".mipcache";
+    return out;
+}
+
+uint64_t MipCache::computeSourceHash(const std::filesystem::path& file, const MipChainSettings& settings)
+{
+    const uint64_t hash = hashBytes(MappedFile(file).data(), cacheVersion);
+    const std::array<uint32_t, 3> settingBits { uint32_t(settings.filter), settings.srgb, settings.normalMap };
+    return hashBytes(std::as_bytes(std::span(settingBits)), hash);
+}
+
+std::optional<MipCache> MipCache::load(const std::filesystem::path& file, uint64_t sourceHash)
+{
+    const auto cacheFile = mipCachePath(file);
+    if (!std::filesystem::exists(cacheFile))
+        return {};
+
+    MipCache out;
+    try {
+        out.m_file = MappedFile(cacheFile);
+    } catch (const FileMappingException& e) {
+        std::cerr << e.what() << std::endl;
+        return {};
+    }
+
+    const auto bytes = out.m_file.data();
+    if (bytes.size() < sizeof(CacheHeader))
+        return {};
+    CacheHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != cacheMagic || header.version != cacheVersion || header.sourceHash != sourceHash)
+        return {};
+    if (header.channels < 1 || header.channels > 4 || header.width == 0 || header.height == 0 || header.width > (1u << 16)
+        || header.height > (1u << 16) || header.levelCount > 17)
+        return {};
+
+    out.m_channels = int(header.channels);
+    uint64_t offset = sizeof(CacheHeader);
+    int width = int(header.width), height = int(header.height);
+    // The levels follow the header back to back (aligned), so their offsets follow from the image size alone.
+    for (uint64_t level = 0; level < header.levelCount; level++) {
+        offset = alignUp(offset);
+        const uint64_t size = uint64_t(width) * uint64_t(height) * header.channels;
+        if (offset > bytes.size() || size > bytes.size() - offset) {
+            std::cerr << "Mip cache " << cacheFile << " is corrupt; regenerating it." << std::endl;
+            return {};
+        }
+        out.m_levels.push_back({ width, height, { reinterpret_cast<const uint8_t*>(bytes.data() + offset), size } });
+        offset += size;
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+    return out;
+}
+
+void MipCache::store(const std::filesystem::path& file, uint64_t sourceHash, const Image& image, std::span<const Image> mipChain)
+{
+    // Write to a temporary file first so that an interrupted write never leaves a truncated cache behind.
+    const auto cacheFile = mipCachePath(file);
+    auto tmpFile = cacheFile;
+    tmpFile += ".tmp";
+    {
+        std::ofstream stream { tmpFile, std::ios::binary | std::ios::trunc };
+        if (!stream) {
+            std::cerr << "Could not write mip cache " << cacheFile << std::endl;
+            return;
+        }
+
+        uint64_t written = 0;
+        const auto write = [&](const void* pData, uint64_t size) {
+            stream.write(static_cast<const char*>(pData), static_cast<std::streamsize>(size));
+            written += size;
+        };
+        const auto writeLevel = [&](const Image& level) {
+            static constexpr std::array<char, dataAlignment> zeros {};
+            write(zeros.data(), alignUp(written) - written);
+            write(level.get_data(), level.sizeInBytes());
+        };
+
+        const CacheHeader header { cacheMagic, cacheVersion, uint32_t(image.channels), sourceHash, uint32_t(image.width), uint32_t(image.height), mipChain.size() + 1 };
+        write(&header, sizeof(header));
+        writeLevel(image);
+        for (const Image& level : mipChain)
+            writeLevel(level);
+
+        if (!stream) {
+            std::cerr << "Could not write mip cache " << cacheFile << std::endl;
+            stream.close();
+            std::error_code error;
+            std::filesystem::remove(tmpFile, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpFile, cacheFile, error);
+    if (error) {
+        std::cerr << "Could not write mip cache " << cacheFile << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpFile, error);
+    }
+}
@@ -0,0 +1,460 @@
+#include "obj_parser.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <tinyobjloader/tiny_obj_loader.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <unordered_map>
+
+// Chunks smaller than this are not worth the scheduling overhead.
+static constexpr size_t minChunkSize = 1 << 20;
+
+namespace {
+// Consecutive corners of a chunk that share a material.
+struct MaterialRun {
+    size_t firstCorner;
+    int32_t slot; // Index into Chunk::materialNames, or inheritMaterial.
+};
+constexpr int32_t inheritMaterial = -1; // Faces before the first usemtl of a chunk continue the previous chunk.
+
+struct Chunk {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::vector<ObjIndex> corners;
+    std::vector<MaterialRun> runs;
+    std::vector<std::string> materialNames;
+    std::vector<std::string> materialLibraries;
+    // Relative (negative) OBJ indices can only be resolved once the number of attributes in all preceding chunks
+    // is known. They are stored chunk-local and listed here as (corner * 3 + attribute) to be fixed up later.
+    std::vector<size_t> relativeFixups;
+    // First corner of every quad. Quads are split along their shortest diagonal (like tinyobjloader), which can
+    // only be decided once the positions of all chunks are known; until then they are stored as [0,1,2],[0,2,3].
+    std::vector<size_t> quads;
+};
+
+struct LocalIndex {
+    ObjIndex index { -1, -1, -1 };
+    uint8_t relativeMask { 0 };
+};
+}
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skipSpaces(const char* p, const char* pEnd)
+{
+    while (p != pEnd && isSpace(*p))
+        ++p;
+    return p;
+}
+
+static std::string_view trim(std::string_view str)
+{
+    while (!str.empty() && isSpace(str.front()))
+        str.remove_prefix(1);
+    while (!str.empty() && isSpace(str.back()))
+        str.remove_suffix(1);
+    return str;
+}
+
+static const char* parseFloat(const char* p, const char* pEnd, float& out)
+{
+    p = skipSpaces(p, pEnd);
+    if (p != pEnd && *p == '+')
+        ++p; // std::from_chars does not accept an explicit plus sign.
+    const auto [pNext, error] = std::from_chars(p, pEnd, out);
+    if (error == std::errc())
+        return pNext;
+
+    // Malformed or out of range (e.g. denormal) value: treat as zero and skip the token.
+    out = 0.0f;
+    while (p != pEnd && !isSpace(*p))
+        ++p;
+    return p;
+}
+
+// Parse a single OBJ index and convert it to a zero-based index into the chunk (if relative) or file (if absolute).
+static const char* parseIndex(const char* p, const char* pEnd, size_t localCount, int32_t& out, bool& relative)
+{
+    int32_t value = 0;
+    const auto [pNext, error] = std::from_chars(p, pEnd, value);
+    relative = false;
+    if (error != std::errc() || value == 0) {
+        out = -1;
+        return error == std::errc() ? pNext : p;
+    }
+
+    if (value > 0) {
+        out = value - 1;
+    } else {
+        out = static_cast<int32_t>(localCount) + value;
+        relative = true;
+    }
+    return pNext;
+}
+
+static void parseChunk(std::string_view text, Chunk& chunk)
+{
+    chunk.runs.push_back({ 0, inheritMaterial });
+
+    const char* p = text.data();
+    const char* const pEnd = text.data() + text.size();
+    std::vector<LocalIndex> polygon;
+    while (p < pEnd) {
+        const char* pLineEnd = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(pEnd - p)));
+        if (!pLineEnd)
+            pLineEnd = pEnd;
+        const char* pLine = skipSpaces(p, pLineEnd);
+        p = pLineEnd + 1;
+
+        const auto lineLength = static_cast<size_t>(pLineEnd - pLine);
+        if (lineLength < 2)
+            continue;
+        const std::string_view line { pLine, lineLength };
+
+        if (line[0] == 'v' && isSpace(line[1])) {
+            glm::vec3& position = chunk.positions.emplace_back();
+            const char* q = parseFloat(pLine + 2, pLineEnd, position.x);
+            q = parseFloat(q, pLineEnd, position.y);
+            parseFloat(q, pLineEnd, position.z);
+        } else if (line.starts_with("vt") && lineLength > 2 && isSpace(line[2])) {
+            glm::vec2& texCoord = chunk.texCoords.emplace_back();
+            const char* q = parseFloat(pLine + 3, pLineEnd, texCoord.x);
+            parseFloat(q, pLineEnd, texCoord.y);
+        } else if (line.starts_with("vn") && lineLength > 2 && isSpace(line[2])) {
+            glm::vec3& normal = chunk.normals.emplace_back();
+            const char* q = parseFloat(pLine + 3, pLineEnd, normal.x);
+            q = parseFloat(q, pLineEnd, normal.y);
+            parseFloat(q, pLineEnd, normal.z);
+        } else if (line[0] == 'f' && isSpace(line[1])) {
+            // Corner formats: v, v/vt, v//vn and v/vt/vn.
+            polygon.clear();
+            const char* q = skipSpaces(pLine + 2, pLineEnd);
+            while (q != pLineEnd) {
+                LocalIndex corner;
+                bool relative;
+                q = parseIndex(q, pLineEnd, chunk.positions.size(), corner.index.position, relative);
+                corner.relativeMask |= relative ? 1 : 0;
+                if (q != pLineEnd && *q == '/') {
+                    ++q;
+                    if (q != pLineEnd && *q != '/') {
+                        q = parseIndex(q, pLineEnd, chunk.texCoords.size(), corner.index.texCoord, relative);
+                        corner.relativeMask |= relative ? 2 : 0;
+                    }
+                    if (q != pLineEnd && *q == '/') {
+                        ++q;
+                        q = parseIndex(q, pLineEnd, chunk.normals.size(), corner.index.normal, relative);
+                        corner.relativeMask |= relative ? 4 : 0;
+                    }
+                }
+                // Skip whatever is left of a malformed token.
+                while (q != pLineEnd && !isSpace(*q))
+                    ++q;
+                q = skipSpaces(q, pLineEnd);
+                polygon.push_back(corner);
+            }
+
+            // Fan triangulation (same as tinyobjloader, including its special case for quads).
+            if (polygon.size() == 4)
+                chunk.quads.push_back(chunk.corners.size());
+            for (size_t i = 2; i < polygon.size(); i++) {
+                for (const LocalIndex& corner : { polygon[0], polygon[i - 1], polygon[i] }) {
+                    for (size_t attribute = 0; attribute < 3; attribute++) {
+                        if (corner.relativeMask & (1 << attribute))
+                            chunk.relativeFixups.push_back(chunk.corners.size() * 3 + attribute);
+                    }
+                    chunk.corners.push_back(corner.index);
+                }
+            }
+        } else if (line.starts_with("usemtl") && lineLength > 6 && isSpace(line[6])) {
+            const std::string_view name = trim(line.substr(7));
+            auto iter = std::find(std::begin(chunk.materialNames), std::end(chunk.materialNames), name);
+            if (iter == std::end(chunk.materialNames))
+                iter = chunk.materialNames.emplace(iter, name);
+            const auto slot = static_cast<int32_t>(iter - std::begin(chunk.materialNames));
+            if (chunk.runs.back().firstCorner == chunk.corners.size())
+                chunk.runs.back().slot = slot; // Previous run is empty; replace it.
+            else
+                chunk.runs.push_back({ chunk.corners.size(), slot });
+        } else if (line.starts_with("mtllib") && lineLength > 6 && isSpace(line[6])) {
+            std::string_view libraries = line.substr(7);
+            while (!libraries.empty()) {
+                libraries = trim(libraries);
+                const size_t tokenEnd = std::min(libraries.find_first_of(" \t"), libraries.size());
+                if (tokenEnd > 0)
+                    chunk.materialLibraries.emplace_back(libraries.substr(0, tokenEnd));
+                libraries.remove_prefix(tokenEnd);
+            }
+        }
+        // Comments, object/group names, smoothing groups, lines and points are ignored.
+    }
+}
+
+static void parseMaterialLibrary(const std::filesystem::path& file, std::vector<ObjMaterial>& materials)
+{
+    std::ifstream stream { file };
+    if (!stream) {
+        std::cerr << "Material library " << file << " does not exist." << std::endl;
+        return;
+    }
+
+    const auto readVec3 = [](std::string_view str) {
+        glm::vec3 out { 0.0f };
+        const char* p = str.data();
+        const char* pEnd = str.data() + str.size();
+        p = parseFloat(p, pEnd, out.x);
+        p = parseFloat(p, pEnd, out.y);
+        parseFloat(p, pEnd, out.z);
+        return out;
+    };
+    const auto readFloat = [](std::string_view str) {
+        float out = 0.0f;
+        parseFloat(str.data(), str.data() + str.size(), out);
+        return out;
+    };
+
+    ObjMaterial* pMaterial = nullptr;
+    std::string lineBuffer;
+    while (std::getline(stream, lineBuffer)) {
+        const std::string_view line = trim(lineBuffer);
+        const size_t keywordEnd = std::min(line.find_first_of(" \t"), line.size());
+        const std::string_view keyword = line.substr(0, keywordEnd);
+        const std::string_view value = trim(line.substr(keywordEnd));
+
+        if (keyword == "newmtl") {
+            pMaterial = &materials.emplace_back();
+            pMaterial->name = value;
+        } else if (!pMaterial) {
+            continue;
+        } else if (keyword == "Kd") {
+            pMaterial->kd = readVec3(value);
+        } else if (keyword == "Ks") {
+            pMaterial->ks = readVec3(value);
+        } else if (keyword == "Ns") {
+            pMaterial->shininess = readFloat(value);
+        } else if (keyword == "d") {
+            pMaterial->transparency = readFloat(value);
+        } else if (keyword == "Tr") {
+            pMaterial->transparency = 1.0f - readFloat(value);
+        } else if (keyword == "map_Kd" && !value.empty()) {
+            // Texture options (-s, -o, ...) precede the file name; the file name is the last token.
+            const size_t nameStart = value.find_last_of(" \t");
+            const std::string_view name = nameStart == std::string_view::npos ? value : value.substr(nameStart + 1);
+            pMaterial->diffuseTexture = file.parent_path() / std::string(name);
+        }
+    }
+}
+
+ObjData parseObj(const std::filesystem::path& file)
+{
+    const MappedFile mappedFile { file };
+    const std::string_view text { reinterpret_cast<const char*>(mappedFile.data().data()), mappedFile.size() };
+
+    // Split the file into line-aligned chunks.
+    ThreadPool& threadPool = ThreadPool::global();
+    const size_t targetChunks = std::clamp<size_t>(text.size() / minChunkSize, 1, 4 * size_t(threadPool.numThreads()));
+    std::vector<std::string_view> chunkTexts;
+    for (size_t begin = 0; begin < text.size();) {
+        size_t end = std::min(begin + text.size() / targetChunks + 1, text.size());
+        end = std::min(text.find('\n', end), text.size());
+        chunkTexts.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+
+    std::vector<Chunk> chunks(chunkTexts.size());
+    threadPool.parallelFor(chunks.size(), [&](size_t i) { parseChunk(chunkTexts[i], chunks[i]); });
+
+    ObjData out;
+
+    // Materials from all libraries, looked up by name.
+    std::vector<std::string> materialLibraries;
+    for (const Chunk& chunk : chunks) {
+        for (const std::string& library : chunk.materialLibraries) {
+            if (std::find(std::begin(materialLibraries), std::end(materialLibraries), library) == std::end(materialLibraries))
+                materialLibraries.push_back(library);
+        }
+    }
+    for (const std::string& library : materialLibraries)
+        parseMaterialLibrary(file.parent_path() / library, out.materials);
+    std::unordered_map<std::string_view, int32_t> materialLookup;
+    for (size_t i = 0; i < out.materials.size(); i++)
+        materialLookup.try_emplace(out.materials[i].name, static_cast<int32_t>(i));
+
+    // Resolve the material of each run and decide where its corners end up in the output.
+    struct RunDestination {
+        size_t group;
+        size_t offset;
+    };
+    std::vector<std::vector<RunDestination>> runDestinations(chunks.size());
+    std::vector<size_t> groupSizes;
+    std::unordered_map<int32_t, size_t> groupLookup;
+    int32_t currentMaterial = -1;
+    for (size_t chunkIdx = 0; chunkIdx < chunks.size(); chunkIdx++) {
+        const Chunk& chunk = chunks[chunkIdx];
+        for (size_t runIdx = 0; runIdx < chunk.runs.size(); runIdx++) {
+            const MaterialRun& run = chunk.runs[runIdx];
+            if (run.slot != inheritMaterial) {
+                const std::string& name = chunk.materialNames[static_cast<size_t>(run.slot)];
+                if (auto iter = materialLookup.find(name); iter != std::end(materialLookup)) {
+                    currentMaterial = iter->second;
+                } else {
+                    std::cerr << "Material " << name << " used by " << file << " is not defined." << std::endl;
+                    currentMaterial = -1;
+                }
+            }
+
+            const size_t runEnd = runIdx + 1 < chunk.runs.size() ? chunk.runs[runIdx + 1].firstCorner : chunk.corners.size();
+            const size_t runSize = runEnd - run.firstCorner;
+            if (runSize == 0) {
+                runDestinations[chunkIdx].push_back({ 0, 0 });
+                continue;
+            }
+
+            auto [iter, inserted] = groupLookup.try_emplace(currentMaterial, out.faceGroups.size());
+            if (inserted) {
+                out.faceGroups.push_back({ currentMaterial, {} });
+                groupSizes.push_back(0);
+            }
+            runDestinations[chunkIdx].push_back({ iter->second, groupSizes[iter->second] });
+            groupSizes[iter->second] += runSize;
+        }
+    }
+    for (size_t i = 0; i < out.faceGroups.size(); i++)
+        out.faceGroups[i].corners.resize(groupSizes[i]);
+
+    // Offsets of each chunk's attributes in the merged arrays.
+    std::vector<glm::uvec3> attributeBases(chunks.size());
+    glm::uvec3 attributeCounts { 0 };
+    for (size_t i = 0; i < chunks.size(); i++) {
+        attributeBases[i] = attributeCounts;
+        attributeCounts += glm::uvec3(chunks[i].positions.size(), chunks[i].texCoords.size(), chunks[i].normals.size());
+    }
+    out.positions.resize(attributeCounts[0]);
+    out.texCoords.resize(attributeCounts[1]);
+    out.normals.resize(attributeCounts[2]);
+
+    std::atomic_bool invalidPositionIndex { false };
+    threadPool.parallelFor(chunks.size(), [&](size_t chunkIdx) {
+        Chunk& chunk = chunks[chunkIdx];
+        const glm::uvec3 bases = attributeBases[chunkIdx];
+        std::copy(std::begin(chunk.positions), std::end(chunk.positions), std::begin(out.positions) + bases[0]);
+        std::copy(std::begin(chunk.texCoords), std::end(chunk.texCoords), std::begin(out.texCoords) + bases[1]);
+        std::copy(std::begin(chunk.normals), std::end(chunk.normals), std::begin(out.normals) + bases[2]);
+
+        // Resolve indices that were relative to the end of the attribute arrays.
+        for (size_t fixup : chunk.relativeFixups) {
+            ObjIndex& corner = chunk.corners[fixup / 3];
+            int32_t* pAttributes[3] = { &corner.position, &corner.texCoord, &corner.normal };
+            *pAttributes[fixup % 3] += static_cast<int32_t>(bases[fixup % 3]);
+        }
+        // Invalid texture coordinate or normal references are dropped, invalid positions are an error.
+        for (ObjIndex& corner : chunk.corners) {
+            if (corner.position < 0 || static_cast<size_t>(corner.position) >= out.positions.size())
+                invalidPositionIndex = true;
+            if (corner.texCoord < 0 || static_cast<size_t>(corner.texCoord) >= out.texCoords.size())
+                corner.texCoord = -1;
+            if (corner.normal < 0 || static_cast<size_t>(corner.normal) >= out.normals.size())
+                corner.normal = -1;
+        }
+    });
+    if (invalidPositionIndex) {
+        std::cerr << "Mesh " << file << " references a vertex position that does not exist." << std::endl;
+        throw std::exception();
+    }
+
+    // All positions are in place now; split the quads and move the corners into their face groups.
+    threadPool.parallelFor(chunks.size(), [&](size_t chunkIdx) {
+        Chunk& chunk = chunks[chunkIdx];
+        for (size_t quad : chunk.quads) {
+            ObjIndex* pCorners = &chunk.corners[quad];
+            const glm::vec3& p0 = out.positions[pCorners[0].position];
+            const glm::vec3& p1 = out.positions[pCorners[1].position];
+            const glm::vec3& p2 = out.positions[pCorners[2].position];
+            const glm::vec3& p3 = out.positions[pCorners[5].position];
+            const glm::vec3 diagonal02 = p2 - p0, diagonal13 = p3 - p1;
+            if (!(glm::dot(diagonal02, diagonal02) < glm::dot(diagonal13, diagonal13))) {
+                const ObjIndex i0 = pCorners[0], i1 = pCorners[1], i2 = pCorners[2], i3 = pCorners[5];
+                pCorners[0] = i0, pCorners[1] = i1, pCorners[2] = i3;
+                pCorners[3] = i1, pCorners[4] = i2, pCorners[5] = i3;
+            }
+        }
+
+        for (size_t runIdx = 0; runIdx < chunk.runs.size(); runIdx++) {
+            const size_t runBegin = chunk.runs[runIdx].firstCorner;
+            const size_t runEnd = runIdx + 1 < chunk.runs.size() ? chunk.runs[runIdx + 1].firstCorner : chunk.corners.size();
+            const RunDestination destination = runDestinations[chunkIdx][runIdx];
+            std::copy(std::begin(chunk.corners) + static_cast<ptrdiff_t>(runBegin), std::begin(chunk.corners) + static_cast<ptrdiff_t>(runEnd),
+                std::begin(out.faceGroups[destination.group].corners) + static_cast<ptrdiff_t>(destination.offset));
+        }
+        chunk = {}; // Release the chunk-local copies early.
+    });
+
+    return out;
+}
+
+ObjData parseObjTinyObj(const std::filesystem::path& file)
+{
+    const auto baseDir = file.parent_path();
+
+    tinyobj::attrib_t inAttrib;
+    std::vector<tinyobj::shape_t> inShapes;
+    std::vector<tinyobj::material_t> inMaterials;
+
+    std::string warn, error;
+    bool ret = tinyobj::LoadObj(&inAttrib, &inShapes, &inMaterials, &warn, &error, file.string().c_str(), baseDir.string().c_str());
+    if (!ret) {
+        std::cerr << "Failed to load mesh " << file << std::endl;
+        throw std::exception();
+    }
+
+    ObjData out;
+    out.positions.resize(inAttrib.vertices.size() / 3);
+    std::memcpy(out.positions.data(), inAttrib.vertices.data(), out.positions.size() * sizeof(glm::vec3));
+    out.texCoords.resize(inAttrib.texcoords.size() / 2);
+    std::memcpy(out.texCoords.data(), inAttrib.texcoords.data(), out.texCoords.size() * sizeof(glm::vec2));
+    out.normals.resize(inAttrib.normals.size() / 3);
+    std::memcpy(out.normals.data(), inAttrib.normals.data(), out.normals.size() * sizeof(glm::vec3));
+
+    for (const tinyobj::material_t& inMaterial : inMaterials) {
+        ObjMaterial& material = out.materials.emplace_back();
+        material.name = inMaterial.name;
+        material.kd = glm::vec3(inMaterial.diffuse[0], inMaterial.diffuse[1], inMaterial.diffuse[2]);
+        material.ks = glm::vec3(inMaterial.specular[0], inMaterial.specular[1], inMaterial.specular[2]);
+        material.shininess = inMaterial.shininess;
+        material.transparency = inMaterial.dissolve;
+        if (!inMaterial.diffuse_texname.empty())
+            material.diffuseTexture = baseDir / inMaterial.diffuse_texname;
+    }
+
+    std::unordered_map<int32_t, size_t> groupLookup;
+    for (const auto& shape : inShapes) {
+        for (size_t triangle = 0; triangle < shape.mesh.indices.size() / 3; triangle++) {
+            int32_t material = shape.mesh.material_ids[triangle];
+            if (material < 0 || static_cast<size_t>(material) >= out.materials.size())
+                material = -1;
+            auto [iter, inserted] = groupLookup.try_emplace(material, out.faceGroups.size());
+            if (inserted)
+                out.faceGroups.push_back({ material, {} });
+
+            for (size_t i = 3 * triangle; i < 3 * triangle + 3; i++) {
+                const tinyobj::index_t& index = shape.mesh.indices[i];
+                out.faceGroups[iter->second].corners.push_back({ index.vertex_index, index.texcoord_index, index.normal_index });
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,105 @@
+#include "render_queue.h"
+#include <array>
+#include <bit>
+#include <cassert>
+#include <utility>
+
+static constexpr int passBits = 4;
+static constexpr int shaderBits = 12;
+static constexpr int materialBits = 15;
+static constexpr int depthBits = 32;
+static_assert(1 << passBits == maxRenderPasses && passBits + 1 + shaderBits + materialBits + depthBits == 64);
+
+// The bit pattern of a non-negative float increases with its value, so it can be compared as an integer.
+static uint64_t depthKey(float depth)
+{
+    return std::bit_cast<uint32_t>(depth > 0.0f ? depth : 0.0f);
+}
+
+static uint64_t passAndTranslucency(uint32_t pass, bool translucent)
+{
+    assert(pass < maxRenderPasses);
+    return (uint64_t(pass) << 1 | uint64_t(translucent)) << (64 - passBits - 1);
+}
+
+uint64_t makeOpaqueSortKey(uint32_t pass, uint32_t shader, uint32_t material, float depth)
+{
+    constexpr uint64_t shaderMask = (uint64_t(1) << shaderBits) - 1;
+    constexpr uint64_t materialMask = (uint64_t(1) << materialBits) - 1;
+    return passAndTranslucency(pass, false)
+        | (shader & shaderMask) << (materialBits + depthBits)
+        | (material & materialMask) << depthBits
+        | depthKey(depth);
+}
+
+uint64_t makeTranslucentSortKey(uint32_t pass, uint32_t shader, uint32_t material, float depth)
+{
+    constexpr uint64_t shaderMask = (uint64_t(1) << shaderBits) - 1;
+    constexpr uint64_t materialMask = (uint64_t(1) << materialBits) - 1;
+    constexpr uint64_t depthMask = (uint64_t(1) << depthBits) - 1;
+    return passAndTranslucency(pass, true)
+        | (~depthKey(depth) & depthMask) << (shaderBits + materialBits)
+        | (shader & shaderMask) << materialBits
+        | (material & materialMask);
+}
+
+static constexpr size_t blockSize = 16 * 1024;
+
+void RenderQueue::submit(uint64_t sortKey, DrawFunction draw, const void* pData)
+{
+    m_packets.push_back({ sortKey, uint32_t(m_draws.size()) });
+    m_draws.push_back({ draw, pData });
+}
+
+void* RenderQueue::allocate(size_t size, size_t alignment)
+{
+    // operator new[] aligns the blocks for any fundamental type.
+    assert(size <= blockSize && alignment <= alignof(std::max_align_t));
+    size_t offset = (m_blockOffset + alignment - 1) / alignment * alignment;
+    if (m_blocks.empty() || offset + size > blockSize) {
+        if (!m_blocks.empty())
+            m_block++;
+        if (m_block == m_blocks.size())
+            m_blocks.push_back(std::make_unique<std::byte[]>(blockSize));
+        offset = 0;
+    }
+    m_blockOffset = offset + size;
+    return m_blocks[m_block].get() + offset;
+}
+
+void RenderQueue::execute()
+{
+    if (m_packets.empty())
+        return;
+
+    // Least significant digit first radix sort with 8-bit digits. Every pass is stable, so packets with equal keys keep
+    // their submission order. Digits that are the same in every key (most of the pass and shader bits, typically)
+    // would leave the order unchanged and are skipped.
+    constexpr int digitBits = 8;
+    constexpr size_t numBuckets = size_t(1) << digitBits;
+    m_scratch.resize(m_packets.size());
+    for (int shift = 0; shift < 64; shift += digitBits) {
+        std::array<size_t, numBuckets> offsets {};
+        for (const Packet& packet : m_packets)
+            offsets[(packet.sortKey >> shift) & (numBuckets - 1)]++;
+        if (offsets[(m_packets.front().sortKey >> shift) & (numBuckets - 1)] == m_packets.size())
+            continue;
+
+        size_t offset = 0;
+        for (size_t& bucketOffset : offsets)
+            offset += std::exchange(bucketOffset, offset);
+        for (const Packet& packet : m_packets)
+            m_scratch[offsets[(packet.sortKey >> shift) & (numBuckets - 1)]++] = packet;
+        std::swap(m_packets, m_scratch);
+    }
+
+    for (const Packet& packet : m_packets) {
+        const Draw& draw = m_draws[packet.draw];
+        draw.function(draw.pData);
+    }
+
+    m_packets.clear();
+    m_draws.clear();
+    m_block = 0;
+    m_blockOffset = 0;
+}
@@ -0,0 +1,150 @@
+#include "render_state.h"
+#include <algorithm>
+#include <iterator>
+
+static constexpr std::array<GLenum, 3> trackedCapabilities { GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST };
+static constexpr std::array<GLenum, 2> trackedTextureTargets { GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP };
+
+RenderState& RenderState::global()
+{
+    static RenderState renderState;
+    return renderState;
+}
+
+RenderState::RenderState()
+{
+    invalidate();
+}
+
+template <typename T>
+bool RenderState::change(T& cached, T value)
+{
+    if (cached == value) {
+        m_counters.elided++;
+        return false;
+    }
+    cached = value;
+    m_counters.issued++;
+    return true;
+}
+
+void RenderState::useProgram(GLuint program)
+{
+    if (change(m_program, program))
+        glUseProgram(program);
+}
+
+void RenderState::bindVertexArray(GLuint vertexArray)
+{
+    if (change(m_vertexArray, vertexArray))
+        glBindVertexArray(vertexArray);
+}
+
+void RenderState::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    const auto targetIter = std::find(std::begin(trackedTextureTargets), std::end(trackedTextureTargets), target);
+    if (unit >= maxTrackedTextureUnits || targetIter == std::end(trackedTextureTargets)) {
+        m_activeTextureUnit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        m_counters.issued += 2;
+        return;
+    }
+
+    GLuint& boundTexture = m_textures[unit][size_t(std::distance(std::begin(trackedTextureTargets), targetIter))];
+    if (boundTexture == texture) {
+        m_counters.elided++;
+        return;
+    }
+    if (change(m_activeTextureUnit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+    boundTexture = texture;
+    m_counters.issued++;
+    glBindTexture(target, texture);
+}
+
+void RenderState::bindFramebuffer(GLuint framebuffer)
+{
+    if (change(m_framebuffer, framebuffer))
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void RenderState::setEnabled(GLenum capability, bool enabled)
+{
+    const auto capabilityIter = std::find(std::begin(trackedCapabilities), std::end(trackedCapabilities), capability);
+    if (capabilityIter != std::end(trackedCapabilities)) {
+        const size_t index = size_t(std::distance(std::begin(trackedCapabilities), capabilityIter));
+        if (!change(m_capabilities[index], GLuint(enabled)))
+            return;
+    } else {
+        m_counters.issued++;
+    }
+
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+}
+
+void RenderState::blendFunc(GLenum sourceFactor, GLenum destinationFactor)
+{
+    if (change(m_blendFunc, std::array { sourceFactor, destinationFactor }))
+        glBlendFunc(sourceFactor, destinationFactor);
+}
+
+void RenderState::cullFace(GLenum face)
+{
+    if (change(m_cullFace, face))
+        glCullFace(face);
+}
+
+void RenderState::depthFunc(GLenum func)
+{
+    if (change(m_depthFunc, func))
+        glDepthFunc(func);
+}
+
+void RenderState::depthMask(bool enabled)
+{
+    if (change(m_depthMask, GLuint(enabled)))
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+void RenderState::forgetProgram(GLuint program)
+{
+    if (m_program == program)
+        m_program = unknown;
+}
+
+void RenderState::forgetVertexArray(GLuint vertexArray)
+{
+    if (m_vertexArray == vertexArray)
+        m_vertexArray = unknown;
+}
+
+void RenderState::forgetTexture(GLuint texture)
+{
+    for (auto& unitTextures : m_textures)
+        std::replace(std::begin(unitTextures), std::end(unitTextures), texture, unknown);
+}
+
+void RenderState::forgetFramebuffer(GLuint framebuffer)
+{
+    if (m_framebuffer == framebuffer)
+        m_framebuffer = unknown;
+}
+
+void RenderState::invalidate()
+{
+    m_program = unknown;
+    m_vertexArray = unknown;
+    m_activeTextureUnit = unknown;
+    for (auto& unitTextures : m_textures)
+        unitTextures.fill(unknown);
+    m_framebuffer = unknown;
+    m_capabilities.fill(unknown);
+    m_blendFunc.fill(unknown);
+    m_cullFace = unknown;
+    m_depthFunc = unknown;
+    m_depthMask = unknown;
+}
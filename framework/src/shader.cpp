@@ -1,22 +1,46 @@
 #include "shader.h"
+#include "mapped_file.h"
+#include "render_state.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
+#include <glm/gtc/type_ptr.hpp>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <system_error>
 
 static constexpr GLuint invalid = 0xFFFFFFFF;
 
+// Bump whenever the layout of the program cache file changes.
+static constexpr uint32_t programCacheVersion = 1;
+static constexpr uint64_t programCacheMagic = 0x48435250'46474346ull; // "FCGFPRCH"
+
+struct ProgramCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t binaryFormat;
+    uint64_t sourceHash;
+    uint64_t binarySize;
+};
+
 static bool checkShaderErrors(GLuint shader);
 static bool checkProgramErrors(GLuint program);
 static std::string readFile(std::filesystem::path filePath);
+static std::string injectDefines(const std::string& source, const std::string& defines);
+static GLuint loadProgramBinary(const std::filesystem::path& cacheFile, uint64_t sourceHash);
+static void storeProgramBinary(const std::filesystem::path& cacheFile, uint64_t sourceHash, GLuint program);
 
 Shader::Shader(GLuint program)
-    : m_program(program) {}
+    : m_program(program)
+{
+    reflect();
+}
 
 Shader::Shader()
     : m_program(invalid) {}
@@ -24,21 +48,29 @@ Shader::Shader()
 Shader::Shader(Shader&& other)
 {
     m_program = other.m_program;
+    m_uniforms = std::move(other.m_uniforms);
+    m_uniformBlocks = std::move(other.m_uniformBlocks);
     other.m_program = invalid;
 }
 
 Shader::~Shader()
 {
-    if (m_program != invalid)
+    if (m_program != invalid) {
+        RenderState::global().forgetProgram(m_program);
         glDeleteProgram(m_program);
+    }
 }
 
 Shader& Shader::operator=(Shader&& other)
 {
-    if (m_program != invalid)
+    if (m_program != invalid) {
+        RenderState::global().forgetProgram(m_program);
         glDeleteProgram(m_program);
+    }
 
     m_program = other.m_program;
+    m_uniforms = std::move(other.m_uniforms);
+    m_uniformBlocks = std::move(other.m_uniformBlocks);
     other.m_program = invalid;
     return *this;
 }
@@ -46,17 +78,19 @@ Shader& Shader::operator=(Shader&& other)
 void Shader::bind() const
 {
     assert(m_program != invalid);
-    glUseProgram(m_program);
+    RenderState::global().useProgram(m_program);
 }
 
-void Shader::bindUniformBlock(const std::string& blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const
+void Shader::bindUniformBlock(ShaderName blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const
 {
-    GLuint blockIdx = glGetUniformBlockIndex(m_program, blockName.data());
-    if (blockIdx != GL_INVALID_INDEX) {
-        glUniformBlockBinding(m_program, blockIdx, bindingLocation);
+    if (UniformBlock* pBlock = findUniformBlock(blockName.hash)) {
+        if (pBlock->binding != bindingLocation) {
+            glUniformBlockBinding(m_program, pBlock->index, bindingLocation);
+            pBlock->binding = bindingLocation;
+        }
         glBindBufferBase(GL_UNIFORM_BUFFER, bindingLocation, uniformBlockBuffer);
     } else {
-        std::cout << "Could not bind uniform block " << blockName << " invalid name" << std::endl;
+        std::cout << "Could not bind uniform block " << blockName.name << " invalid name" << std::endl;
     }
 }
 
@@ -71,11 +105,151 @@ GLuint Shader::getAttributeLocation(const std::string& name) const
 
 GLint Shader::getUniformLocation(const std::string& name) const
 {
-    GLint loc = glGetUniformLocation(m_program, name.c_str());
-    if (loc == GL_INVALID_INDEX) {
+    Uniform* pUniform = findUniform(hashString(name));
+    if (!pUniform) {
         std::cerr << "Warning : Could not find uniform " << name << std::endl;
+        return -1;
     }
-    return loc;
+    // The caller sets the value behind our back.
+    pUniform->hasValue = false;
+    return pUniform->location;
+}
+
+bool Shader::hasUniform(ShaderName name) const
+{
+    return findUniform(name.hash) != nullptr;
+}
+
+void Shader::setUniform(ShaderName name, bool value) const
+{
+    // Stored like an int, so that mixing both overloads for one uniform compares equal values correctly.
+    setUniform(name, int(value));
+}
+
+void Shader::setUniform(ShaderName name, int value) const
+{
+    setUniformValue(name, value, [&](GLint location) { glProgramUniform1i(m_program, location, value); });
+}
+
+void Shader::setUniform(ShaderName name, float value) const
+{
+    setUniformValue(name, value, [&](GLint location) { glProgramUniform1f(m_program, location, value); });
+}
+
+void Shader::setUniform(ShaderName name, const glm::vec2& value) const
+{
+    setUniformValue(name, value, [&](GLint location) { glProgramUniform2fv(m_program, location, 1, glm::value_ptr(value)); });
+}
+
+void Shader::setUniform(ShaderName name, const glm::vec3& value) const
+{
+    setUniformValue(name, value, [&](GLint location) { glProgramUniform3fv(m_program, location, 1, glm::value_ptr(value)); });
+}
+
+void Shader::setUniform(ShaderName name, const glm::vec4& value) const
+{
+    setUniformValue(name, value, [&](GLint location) { glProgramUniform4fv(m_program, location, 1, glm::value_ptr(value)); });
+}
+
+void Shader::setUniform(ShaderName name, const glm::mat3& value) const
+{
+    setUniformValue(name, value, [&](GLint location) { glProgramUniformMatrix3fv(m_program, location, 1, GL_FALSE, glm::value_ptr(value)); });
+}
+
+void Shader::setUniform(ShaderName name, const glm::mat4& value) const
+{
+    setUniformValue(name, value, [&](GLint location) { glProgramUniformMatrix4fv(m_program, location, 1, GL_FALSE, glm::value_ptr(value)); });
+}
+
+template <typename T, typename Upload>
+void Shader::setUniformValue(ShaderName name, const T& value, Upload&& upload) const
+{
+    static_assert(sizeof(T) <= sizeof(Uniform::value));
+    Uniform* pUniform = findUniform(name.hash);
+    if (!pUniform)
+        return;
+    if (pUniform->hasValue && std::memcmp(pUniform->value.data(), &value, sizeof(T)) == 0)
+        return;
+    std::memcpy(pUniform->value.data(), &value, sizeof(T));
+    pUniform->hasValue = true;
+    upload(pUniform->location);
+}
+
+void Shader::setUniformBlockBinding(ShaderName blockName, GLuint bindingLocation) const
+{
+    UniformBlock* pBlock = findUniformBlock(blockName.hash);
+    if (pBlock && pBlock->binding != bindingLocation) {
+        glUniformBlockBinding(m_program, pBlock->index, bindingLocation);
+        pBlock->binding = bindingLocation;
+    }
+}
+
+Shader::Uniform* Shader::findUniform(uint64_t nameHash) const
+{
+    const auto uniform = std::lower_bound(std::begin(m_uniforms), std::end(m_uniforms), nameHash,
+        [](const Uniform& lhs, uint64_t rhs) { return lhs.nameHash < rhs; });
+    return uniform != std::end(m_uniforms) && uniform->nameHash == nameHash ? &*uniform : nullptr;
+}
+
+Shader::UniformBlock* Shader::findUniformBlock(uint64_t nameHash) const
+{
+    const auto block = std::lower_bound(std::begin(m_uniformBlocks), std::end(m_uniformBlocks), nameHash,
+        [](const UniformBlock& lhs, uint64_t rhs) { return lhs.nameHash < rhs; });
+    return block != std::end(m_uniformBlocks) && block->nameHash == nameHash ? &*block : nullptr;
+}
+
+void Shader::reflect()
+{
+    const auto addUniform = [&](const std::string& name) {
+        m_uniforms.push_back({ .nameHash = hashString(name), .location = glGetUniformLocation(m_program, name.c_str()) });
+    };
+
+    GLint numUniforms = 0, maxNameLength = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    std::string nameBuffer(size_t(std::max(maxNameLength, 1)), '\0');
+    for (GLuint i = 0; i < GLuint(numUniforms); i++) {
+        GLsizei nameLength;
+        GLint arraySize;
+        GLenum type;
+        glGetActiveUniform(m_program, i, GLsizei(nameBuffer.size()), &nameLength, &arraySize, &type, nameBuffer.data());
+        // Members of uniform blocks are stored in buffers and have no location.
+        GLint blockIndex;
+        glGetActiveUniformsiv(m_program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+        if (blockIndex != -1)
+            continue;
+
+        // Arrays of basic types are reported once, as "name[0]"; every element has its own location.
+        const std::string name { nameBuffer.data(), size_t(nameLength) };
+        if (name.ends_with("[0]")) {
+            const std::string arrayName = name.substr(0, name.size() - 3);
+            addUniform(arrayName);
+            for (GLint element = 0; element < arraySize; element++)
+                addUniform(fmt::format("{}[{}]", arrayName, element));
+        } else {
+            addUniform(name);
+        }
+    }
+
+    GLint numBlocks = 0, maxBlockNameLength = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockNameLength);
+    nameBuffer.assign(size_t(std::max(maxBlockNameLength, 1)), '\0');
+    for (GLuint i = 0; i < GLuint(numBlocks); i++) {
+        GLsizei nameLength;
+        glGetActiveUniformBlockName(m_program, i, GLsizei(nameBuffer.size()), &nameLength, nameBuffer.data());
+        GLint binding;
+        glGetActiveUniformBlockiv(m_program, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+        m_uniformBlocks.push_back({ .nameHash = hashString({ nameBuffer.data(), size_t(nameLength) }), .index = i, .binding = GLuint(binding) });
+    }
+
+    const auto byHash = [](const auto& lhs, const auto& rhs) { return lhs.nameHash < rhs.nameHash; };
+    std::sort(std::begin(m_uniforms), std::end(m_uniforms), byHash);
+    std::sort(std::begin(m_uniformBlocks), std::end(m_uniformBlocks), byHash);
+    const auto sameHash = [](const auto& lhs, const auto& rhs) { return lhs.nameHash == rhs.nameHash; };
+    if (std::adjacent_find(std::begin(m_uniforms), std::end(m_uniforms), sameHash) != std::end(m_uniforms)
+        || std::adjacent_find(std::begin(m_uniformBlocks), std::end(m_uniformBlocks), sameHash) != std::end(m_uniformBlocks))
+        std::cerr << "Warning : Two uniform names of a shader have the same hash" << std::endl;
 }
 
 ShaderBuilder::~ShaderBuilder()
@@ -89,35 +263,81 @@ ShaderBuilder& ShaderBuilder::addStage(GLuint shaderStage, std::filesystem::path
         throw ShaderLoadingException(fmt::format("File {} does not exist", shaderFile.string().c_str()));
     }
 
-    const std::string shaderSource = readFile(shaderFile);
-    const GLuint shader = glCreateShader(shaderStage);
-    const char* shaderSourcePtr = shaderSource.c_str();
-    glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
-    glCompileShader(shader);
-    if (!checkShaderErrors(shader)) {
-        glDeleteShader(shader);
-        throw ShaderLoadingException(fmt::format("Failed to compile shader {}", shaderFile.string().c_str()));
-    }
+    m_stages.push_back({ shaderStage, shaderFile, readFile(shaderFile) });
+    return *this;
+}
 
-    m_shaders.push_back(shader);
+ShaderBuilder& ShaderBuilder::addDefine(std::string_view name, int value)
+{
+    m_defines += fmt::format("#define {} {}\n", name, value);
     return *this;
 }
 
 Shader ShaderBuilder::build()
 {
+    const auto cacheFile = programCachePath();
+    const uint64_t sourceHash = computeSourceHash();
+    if (const GLuint program = loadProgramBinary(cacheFile, sourceHash); program != 0)
+        return Shader(program);
+
     // Combine vertex and fragment shaders into a single shader program.
+    compileStages();
     GLuint program = glCreateProgram();
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     for (GLuint shader : m_shaders)
         glAttachShader(program, shader);
     glLinkProgram(program);
 
     if (!checkProgramErrors(program)) {
+        glDeleteProgram(program);
         throw ShaderLoadingException("Shader program failed to link");
     }
 
+    storeProgramBinary(cacheFile, sourceHash, program);
     return Shader(program);
 }
 
+std::filesystem::path ShaderBuilder::programCachePath() const
+{
+    // Programs that share their last stage (such as variants of one fragment shader) are told apart by all stages.
+    uint64_t stagesHash = hashBytes(m_defines);
+    for (const Stage& stage : m_stages)
+        stagesHash = hashBytes(stage.file.generic_string(), hashMix(stagesHash ^ stage.type));
+
+    std::filesystem::path out = m_stages.empty() ? std::filesystem::path("program") : m_stages.back().file;
+    out += fmt::format(".{:08x}.programcache", uint32_t(stagesHash));
+    return out;
+}
+
+uint64_t ShaderBuilder::computeSourceHash() const
+{
+    // Binaries are only valid for the driver that produced them.
+    uint64_t hash = programCacheVersion;
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const auto* pString = reinterpret_cast<const char*>(glGetString(name));
+        hash = hashBytes(pString ? pString : "", hash);
+    }
+    for (const Stage& stage : m_stages)
+        hash = hashBytes(stage.source, hashMix(hash ^ stage.type));
+    return hashBytes(m_defines, hash);
+}
+
+void ShaderBuilder::compileStages()
+{
+    for (const Stage& stage : m_stages) {
+        const GLuint shader = glCreateShader(stage.type);
+        const std::string source = injectDefines(stage.source, m_defines);
+        const char* shaderSourcePtr = source.c_str();
+        glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
+        glCompileShader(shader);
+        if (!checkShaderErrors(shader)) {
+            glDeleteShader(shader);
+            throw ShaderLoadingException(fmt::format("Failed to compile shader {}", stage.file.string().c_str()));
+        }
+        m_shaders.push_back(shader);
+    }
+}
+
 void ShaderBuilder::freeShaders()
 {
     for (GLuint shader : m_shaders)
@@ -133,6 +353,119 @@ static std::string readFile(std::filesystem::path filePath)
     return buffer.str();
 }
 
+ShaderVariants::ShaderVariants(std::vector<std::pair<GLuint, std::filesystem::path>> stages, std::vector<std::string> defineNames)
+    : m_stages(std::move(stages))
+    , m_defineNames(std::move(defineNames))
+{
+}
+
+const Shader& ShaderVariants::get(std::span<const int> defineValues)
+{
+    assert(defineValues.size() == m_defineNames.size());
+    const uint64_t key = hashBytes(std::as_bytes(defineValues));
+    for (auto [variant, end] = m_variants.equal_range(key); variant != end; ++variant) {
+        if (std::ranges::equal(variant->second.defineValues, defineValues))
+            return variant->second.shader;
+    }
+
+    ShaderBuilder builder;
+    for (const auto& [stageType, stageFile] : m_stages)
+        builder.addStage(stageType, stageFile);
+    for (size_t i = 0; i < m_defineNames.size(); i++)
+        builder.addDefine(m_defineNames[i], defineValues[i]);
+    const auto variant = m_variants.emplace(key, Variant { { std::begin(defineValues), std::end(defineValues) }, builder.build() });
+    return variant->second.shader;
+}
+
+// Program linked from the cached binary, or 0 if there is no valid cached binary.
+static GLuint loadProgramBinary(const std::filesystem::path& cacheFile, uint64_t sourceHash)
+{
+    if (!std::filesystem::exists(cacheFile))
+        return 0;
+
+    MappedFile file;
+    try {
+        file = MappedFile(cacheFile);
+    } catch (const FileMappingException& e) {
+        std::cerr << e.what() << std::endl;
+        return 0;
+    }
+
+    const auto bytes = file.data();
+    if (bytes.size() < sizeof(ProgramCacheHeader))
+        return 0;
+    ProgramCacheHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != programCacheMagic || header.version != programCacheVersion || header.sourceHash != sourceHash
+        || header.binarySize != bytes.size() - sizeof(ProgramCacheHeader))
+        return 0;
+
+    const GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, bytes.data() + sizeof(ProgramCacheHeader), GLsizei(header.binarySize));
+    // Drivers may reject binaries at any time (e.g. after an update); the program is then built from source instead.
+    GLint linkSuccessful;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkSuccessful);
+    if (!linkSuccessful) {
+        std::cerr << "Cached shader program " << cacheFile << " was rejected by the driver; recompiling it." << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+// Write (or overwrite) the cached binary of a linked program. Failures are reported but not fatal.
+static void storeProgramBinary(const std::filesystem::path& cacheFile, uint64_t sourceHash, GLuint program)
+{
+    GLint numBinaryFormats = 0, binarySize = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+    if (numBinaryFormats == 0 || binarySize <= 0)
+        return;
+
+    std::vector<std::byte> binary(static_cast<size_t>(binarySize));
+    GLsizei length = 0;
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program, binarySize, &length, &binaryFormat, binary.data());
+    const ProgramCacheHeader header { programCacheMagic, programCacheVersion, binaryFormat, sourceHash, uint64_t(length) };
+
+    // Write to a temporary file first so that an interrupted write never leaves a truncated cache behind.
+    auto tmpFile = cacheFile;
+    tmpFile += ".tmp";
+    {
+        std::ofstream stream { tmpFile, std::ios::binary | std::ios::trunc };
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(binary.data()), length);
+        if (!stream) {
+            std::cerr << "Could not write shader program cache " << cacheFile << std::endl;
+            stream.close();
+            std::error_code error;
+            std::filesystem::remove(tmpFile, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpFile, cacheFile, error);
+    if (error) {
+        std::cerr << "Could not write shader program cache " << cacheFile << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpFile, error);
+    }
+}
+
+static std::string injectDefines(const std::string& source, const std::string& defines)
+{
+    if (defines.empty())
+        return source;
+
+    // Defines have to follow the #version directive. The #line directive keeps the line numbers in compile errors
+    // pointing at the file.
+    if (source.starts_with("#version")) {
+        const size_t versionEnd = std::min(source.find('\n'), source.size());
+        return source.substr(0, versionEnd) + "\n" + defines + "#line 2\n" + source.substr(std::min(versionEnd + 1, source.size()));
+    }
+    return defines + "#line 1\n" + source;
+}
+
 static bool checkShaderErrors(GLuint shader)
 {
     // Check if the shader compiled successfully.
@@ -0,0 +1,405 @@
+#include "texture_compression.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+namespace {
+// The 16 pixels of a block (row by row), one array per channel (RGBA, 0 to 255).
+struct BlockPixels {
+    alignas(16) float channels[4][16];
+};
+
+// Colors that the pixels of a block can be mapped to. Only the channels that are being encoded are used.
+struct Palette {
+    std::array<std::array<float, 4>, 16> entries;
+    int size;
+};
+
+using BlockIndices = std::array<uint8_t, 16>;
+
+// Collects the fields of a block, least significant bit first.
+struct BitWriter {
+    uint64_t words[2] { 0, 0 };
+    int position { 0 };
+
+    void write(uint64_t value, int numBits)
+    {
+        if (position < 64) {
+            words[0] |= value << position;
+            if (position + numBits > 64)
+                words[1] |= value >> (64 - position);
+        } else {
+            words[1] |= value << (position - 64);
+        }
+        position += numBits;
+    }
+
+    void store(std::byte* pTarget, int numBytes) const
+    {
+        for (int i = 0; i < numBytes; i++)
+            pTarget[i] = std::byte(words[i / 8] >> (8 * (i % 8)));
+    }
+};
+}
+
+size_t blockSize(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t compressedImageSize(BlockFormat format, int width, int height)
+{
+    return size_t((width + 3) / 4) * size_t((height + 3) / 4) * blockSize(format);
+}
+
+// Index of the nearest palette entry for every pixel, comparing numChannels channels starting at firstChannel.
+// Returns the total squared error.
+static float selectIndices(const BlockPixels& pixels, const Palette& palette, int firstChannel, int numChannels, BlockIndices& indices)
+{
+    Float4 totalError = Float4::broadcast(0.0f);
+    for (int group = 0; group < 16; group += 4) {
+        Float4 bestDistance = Float4::broadcast(std::numeric_limits<float>::max());
+        Float4 bestIndex = Float4::broadcast(0.0f);
+        for (int entry = 0; entry < palette.size; entry++) {
+            Float4 distance = Float4::broadcast(0.0f);
+            for (int channel = firstChannel; channel < firstChannel + numChannels; channel++) {
+                const Float4 difference = Float4::load(&pixels.channels[channel][group]) - Float4::broadcast(palette.entries[entry][channel]);
+                distance = distance + difference * difference;
+            }
+            const Float4 closer = distance < bestDistance;
+            bestDistance = select(closer, distance, bestDistance);
+            bestIndex = select(closer, Float4::broadcast(float(entry)), bestIndex);
+        }
+        totalError = totalError + bestDistance;
+        float groupIndices[4];
+        bestIndex.store(groupIndices);
+        for (int i = 0; i < 4; i++)
+            indices[group + i] = uint8_t(groupIndices[i]);
+    }
+    float errors[4];
+    totalError.store(errors);
+    return errors[0] + errors[1] + errors[2] + errors[3];
+}
+
+// End points of the segment along the dominant direction of the pixels (in numChannels channels) that covers all of
+// their projections. The direction is found by power iteration on the covariance matrix.
+static void principalSegment(const BlockPixels& pixels, int numChannels, float endpoints[2][4])
+{
+    float mean[4] { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int channel = 0; channel < numChannels; channel++) {
+        for (float value : pixels.channels[channel])
+            mean[channel] += value;
+        mean[channel] /= 16.0f;
+    }
+    float covariance[4][4] {};
+    for (int i = 0; i < 16; i++) {
+        for (int a = 0; a < numChannels; a++) {
+            for (int b = 0; b < numChannels; b++)
+                covariance[a][b] += (pixels.channels[a][i] - mean[a]) * (pixels.channels[b][i] - mean[b]);
+        }
+    }
+
+    // Start from the row of the channel with the largest variance, which cannot be orthogonal to the dominant axis.
+    int largest = 0;
+    for (int channel = 1; channel < numChannels; channel++) {
+        if (covariance[channel][channel] > covariance[largest][largest])
+            largest = channel;
+    }
+    float axis[4] { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int channel = 0; channel < numChannels; channel++)
+        axis[channel] = covariance[largest][channel];
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] { 0.0f, 0.0f, 0.0f, 0.0f };
+        float largestComponent = 0.0f;
+        for (int a = 0; a < numChannels; a++) {
+            for (int b = 0; b < numChannels; b++)
+                next[a] += covariance[a][b] * axis[b];
+            largestComponent = std::max(largestComponent, std::abs(next[a]));
+        }
+        if (largestComponent == 0.0f)
+            break;
+        for (int channel = 0; channel < numChannels; channel++)
+            axis[channel] = next[channel] / largestComponent;
+    }
+
+    float axisLengthSquared = 0.0f;
+    for (int channel = 0; channel < numChannels; channel++)
+        axisLengthSquared += axis[channel] * axis[channel];
+    float tMin = 0.0f, tMax = 0.0f;
+    if (axisLengthSquared > 0.0f) {
+        tMin = std::numeric_limits<float>::max();
+        tMax = std::numeric_limits<float>::lowest();
+        for (int i = 0; i < 16; i++) {
+            float t = 0.0f;
+            for (int channel = 0; channel < numChannels; channel++)
+                t += (pixels.channels[channel][i] - mean[channel]) * axis[channel];
+            tMin = std::min(tMin, t / axisLengthSquared);
+            tMax = std::max(tMax, t / axisLengthSquared);
+        }
+    }
+    for (int channel = 0; channel < 4; channel++) {
+        endpoints[0][channel] = channel < numChannels ? std::clamp(mean[channel] + tMin * axis[channel], 0.0f, 255.0f) : 255.0f;
+        endpoints[1][channel] = channel < numChannels ? std::clamp(mean[channel] + tMax * axis[channel], 0.0f, 255.0f) : 255.0f;
+    }
+}
+
+// End points that minimize the squared error for fixed indices, where index i blends the end points with weight
+// weights[i] for the second one (least squares). False if all pixels use the same weight.
+static bool fitEndpoints(const BlockPixels& pixels, int numChannels, const BlockIndices& indices, const float* weights, float endpoints[2][4])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ap[4] { 0.0f, 0.0f, 0.0f, 0.0f }, bp[4] { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++) {
+        const float b = weights[indices[i]];
+        const float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int channel = 0; channel < numChannels; channel++) {
+            ap[channel] += a * pixels.channels[channel][i];
+            bp[channel] += b * pixels.channels[channel][i];
+        }
+    }
+    const float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f)
+        return false;
+    for (int channel = 0; channel < numChannels; channel++) {
+        endpoints[0][channel] = std::clamp((bb * ap[channel] - ab * bp[channel]) / determinant, 0.0f, 255.0f);
+        endpoints[1][channel] = std::clamp((aa * bp[channel] - ab * ap[channel]) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+static uint16_t packRgb565(const float color[4])
+{
+    const auto quantize = [](float value, int maxValue) { return uint16_t(std::lround(value * float(maxValue) / 255.0f)); };
+    return uint16_t(quantize(color[0], 31) << 11 | quantize(color[1], 63) << 5 | quantize(color[2], 31));
+}
+
+static std::array<float, 4> unpackRgb565(uint16_t color)
+{
+    const int r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+    return { float(r << 3 | r >> 2), float(g << 2 | g >> 4), float(b << 3 | b >> 2), 255.0f };
+}
+
+// Four-color mode: the two end points and two colors in between.
+static Palette bc1Palette(uint16_t color0, uint16_t color1)
+{
+    Palette out;
+    out.size = 4;
+    out.entries[0] = unpackRgb565(color0);
+    out.entries[1] = unpackRgb565(color1);
+    for (int channel = 0; channel < 3; channel++) {
+        out.entries[2][channel] = (2.0f * out.entries[0][channel] + out.entries[1][channel]) / 3.0f;
+        out.entries[3][channel] = (out.entries[0][channel] + 2.0f * out.entries[1][channel]) / 3.0f;
+    }
+    return out;
+}
+
+static void encodeBc1(const BlockPixels& pixels, std::byte* pOut)
+{
+    static constexpr float weights[4] { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+    float endpoints[2][4];
+    principalSegment(pixels, 3, endpoints);
+    // Pull the end points in a little: the extremes are usually outliers, and the interpolated colors cover the
+    // range better this way.
+    for (int channel = 0; channel < 3; channel++) {
+        const float inset = (endpoints[1][channel] - endpoints[0][channel]) / 16.0f;
+        endpoints[0][channel] += inset;
+        endpoints[1][channel] -= inset;
+    }
+    uint16_t color0 = packRgb565(endpoints[1]), color1 = packRgb565(endpoints[0]);
+    BlockIndices indices;
+    float error = selectIndices(pixels, bc1Palette(color0, color1), 0, 3, indices);
+    for (int iteration = 0; iteration < 2; iteration++) {
+        if (!fitEndpoints(pixels, 3, indices, weights, endpoints))
+            break;
+        const uint16_t refined0 = packRgb565(endpoints[0]), refined1 = packRgb565(endpoints[1]);
+        BlockIndices refinedIndices;
+        const float refinedError = selectIndices(pixels, bc1Palette(refined0, refined1), 0, 3, refinedIndices);
+        if (refinedError >= error)
+            break;
+        std::tie(color0, color1, indices, error) = std::tuple { refined0, refined1, refinedIndices, refinedError };
+    }
+
+    // color0 > color1 selects the four-color mode; swapping the end points swaps indices 0/1 and 2/3.
+    if (color0 < color1) {
+        std::swap(color0, color1);
+        for (uint8_t& index : indices)
+            index ^= 1;
+    } else if (color0 == color1) {
+        indices.fill(0);
+    }
+    BitWriter writer;
+    writer.write(color0, 16);
+    writer.write(color1, 16);
+    for (uint8_t index : indices)
+        writer.write(index, 2);
+    writer.store(pOut, 8);
+}
+
+// Single channel block (the alpha of BC3, either channel of BC5).
+static void encodeBc4(const BlockPixels& pixels, int channel, std::byte* pOut)
+{
+    const auto [minValue, maxValue] = std::minmax_element(std::begin(pixels.channels[channel]), std::end(pixels.channels[channel]));
+    const auto value0 = uint8_t(std::lround(*maxValue)), value1 = uint8_t(std::lround(*minValue));
+    BlockIndices indices {};
+    if (value0 != value1) {
+        // value0 > value1 selects eight values: the end points and six in between.
+        Palette palette;
+        palette.size = 8;
+        palette.entries[0][channel] = float(value0);
+        palette.entries[1][channel] = float(value1);
+        for (int i = 2; i < 8; i++)
+            palette.entries[i][channel] = (float(8 - i) * float(value0) + float(i - 1) * float(value1)) / 7.0f;
+        selectIndices(pixels, palette, channel, 1, indices);
+    }
+    BitWriter writer;
+    writer.write(value0, 8);
+    writer.write(value1, 8);
+    for (uint8_t index : indices)
+        writer.write(index, 3);
+    writer.store(pOut, 8);
+}
+
+namespace {
+// End point of a BC7 mode 6 block: 7 bits per channel and a shared lowest bit.
+struct Bc7Endpoint {
+    std::array<uint8_t, 4> channels;
+    uint8_t pBit;
+
+    [[nodiscard]] int value(int channel) const { return channels[channel] << 1 | pBit; }
+};
+}
+
+static Bc7Endpoint quantizeBc7Endpoint(const float endpoint[4])
+{
+    Bc7Endpoint best {};
+    float bestError = std::numeric_limits<float>::max();
+    for (uint8_t pBit = 0; pBit < 2; pBit++) {
+        Bc7Endpoint candidate { {}, pBit };
+        float error = 0.0f;
+        for (int channel = 0; channel < 4; channel++) {
+            candidate.channels[channel] = uint8_t(std::clamp(std::lround((endpoint[channel] - float(pBit)) / 2.0f), 0l, 127l));
+            const float difference = float(candidate.value(channel)) - endpoint[channel];
+            error += difference * difference;
+        }
+        if (error < bestError) {
+            best = candidate;
+            bestError = error;
+        }
+    }
+    return best;
+}
+
+static constexpr std::array<int, 16> bc7Weights { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static Palette bc7Palette(const Bc7Endpoint& endpoint0, const Bc7Endpoint& endpoint1)
+{
+    Palette out;
+    out.size = 16;
+    for (int i = 0; i < 16; i++) {
+        for (int channel = 0; channel < 4; channel++)
+            out.entries[i][channel] = float(((64 - bc7Weights[i]) * endpoint0.value(channel) + bc7Weights[i] * endpoint1.value(channel) + 32) >> 6);
+    }
+    return out;
+}
+
+static void encodeBc7(const BlockPixels& pixels, std::byte* pOut)
+{
+    static const auto weights = []() {
+        std::array<float, 16> out;
+        for (size_t i = 0; i < out.size(); i++)
+            out[i] = float(bc7Weights[i]) / 64.0f;
+        return out;
+    }();
+
+    float endpoints[2][4];
+    principalSegment(pixels, 4, endpoints);
+    Bc7Endpoint endpoint0 = quantizeBc7Endpoint(endpoints[0]), endpoint1 = quantizeBc7Endpoint(endpoints[1]);
+    BlockIndices indices;
+    float error = selectIndices(pixels, bc7Palette(endpoint0, endpoint1), 0, 4, indices);
+    for (int iteration = 0; iteration < 2; iteration++) {
+        if (!fitEndpoints(pixels, 4, indices, weights.data(), endpoints))
+            break;
+        const Bc7Endpoint refined0 = quantizeBc7Endpoint(endpoints[0]), refined1 = quantizeBc7Endpoint(endpoints[1]);
+        BlockIndices refinedIndices;
+        const float refinedError = selectIndices(pixels, bc7Palette(refined0, refined1), 0, 4, refinedIndices);
+        if (refinedError >= error)
+            break;
+        std::tie(endpoint0, endpoint1, indices, error) = std::tuple { refined0, refined1, refinedIndices, refinedError };
+    }
+
+    // The most significant index bit of the first pixel is implied to be zero; swap the end points if it is not.
+    if (indices[0] >= 8) {
+        std::swap(endpoint0, endpoint1);
+        for (uint8_t& index : indices)
+            index = uint8_t(15 - index);
+    }
+    BitWriter writer;
+    writer.write(1 << 6, 7); // Mode 6.
+    for (int channel = 0; channel < 4; channel++) {
+        writer.write(endpoint0.channels[channel], 7);
+        writer.write(endpoint1.channels[channel], 7);
+    }
+    writer.write(endpoint0.pBit, 1);
+    writer.write(endpoint1.pBit, 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        writer.write(indices[i], i == 0 ? 3 : 4);
+    assert(writer.position == 128);
+    writer.store(pOut, 16);
+}
+
+// Pixels outside of the image repeat the last row/column.
+static void loadBlock(const Image& image, int blockX, int blockY, BlockPixels& pixels)
+{
+    const uint8_t* pData = image.get_data();
+    for (int y = 0; y < 4; y++) {
+        const int imageY = std::min(4 * blockY + y, image.height - 1);
+        for (int x = 0; x < 4; x++) {
+            const int imageX = std::min(4 * blockX + x, image.width - 1);
+            const uint8_t* pPixel = pData + (size_t(imageY) * size_t(image.width) + size_t(imageX)) * size_t(image.channels);
+            for (int channel = 0; channel < 4; channel++)
+                pixels.channels[channel][4 * y + x] = channel < image.channels ? float(pPixel[channel]) : (channel == 3 ? 255.0f : 0.0f);
+        }
+    }
+}
+
+std::vector<std::byte> compressImage(const Image& image, BlockFormat format)
+{
+    assert(image.channels >= 1 && image.channels <= 4);
+    const int blocksX = (image.width + 3) / 4, blocksY = (image.height + 3) / 4;
+    const size_t bytesPerBlock = blockSize(format);
+    std::vector<std::byte> out(compressedImageSize(format, image.width, image.height));
+    ThreadPool::global().parallelFor(size_t(blocksY), [&](size_t blockY) {
+        BlockPixels pixels;
+        for (int blockX = 0; blockX < blocksX; blockX++) {
+            loadBlock(image, blockX, int(blockY), pixels);
+            std::byte* pBlock = out.data() + (blockY * size_t(blocksX) + size_t(blockX)) * bytesPerBlock;
+            switch (format) {
+            case BlockFormat::BC1:
+                encodeBc1(pixels, pBlock);
+                break;
+            case BlockFormat::BC3:
+                encodeBc4(pixels, 3, pBlock);
+                encodeBc1(pixels, pBlock + 8);
+                break;
+            case BlockFormat::BC5:
+                encodeBc4(pixels, 0, pBlock);
+                encodeBc4(pixels, 1, pBlock + 8);
+                break;
+            case BlockFormat::BC7:
+                encodeBc7(pixels, pBlock);
+                break;
+            }
+        }
+    });
+    return out;
+}
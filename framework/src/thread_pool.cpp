@@ -0,0 +1,51 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(unsigned numThreads)
+{
+    m_workers.reserve(numThreads);
+    for (unsigned i = 0; i < numThreads; i++)
+        m_workers.emplace_back([this]() { workerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::enqueue(std::function<void()>&& task)
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock { m_mutex };
+            m_condition.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            // Drain the queue before stopping so that no submitted future is left without a result.
+            if (m_tasks.empty())
+                return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -1,4 +1,5 @@
 #include "window.h"
+#include "render_state.h"
 #include <imgui/imgui.h>
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl2.h>
@@ -254,6 +255,8 @@ void Window::swapBuffers()
         }
         break;
         };
+        // The ImGui renderer changes OpenGL state without going through the state tracker.
+        RenderState::global().invalidate();
     }
 
     glfwSwapBuffers(m_pWindow);
@@ -263,8 +266,9 @@ void Window::swapBuffers()
 void Window::renderToImage(const std::filesystem::path& filePath, const bool flipY)
 {
     std::vector<GLubyte> pixels;
-    pixels.reserve(4 * m_windowSize.x * m_windowSize.y);
+    pixels.resize(size_t(4) * m_windowSize.x * m_windowSize.y);
 
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
     glReadPixels(0, 0, m_windowSize.x, m_windowSize.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
 
     std::string filePathString = filePath.string();
@@ -0,0 +1,97 @@
+// Bakes block-compressed copies (with mip chains) of image files, which Texture and Skybox then load instead of the
+// original images. The copies are written next to the images as "<file>.ktx".
+// Usage: TextureBaker <bc1|bc3|bc5|bc7> <image file>...
+//
+// Also packs single-channel maps (such as ambient occlusion, roughness and displacement) into the channels of one
+// image, so that shaders read them with a single texture fetch.
+// Usage: TextureBaker pack <output png> <red image> [green image] [blue image] [alpha image]
+#include <framework/compressed_texture.h>
+#include <framework/image.h>
+#include <framework/texture_compression.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+static std::optional<BlockFormat> parseFormat(std::string_view name)
+{
+    if (name == "bc1")
+        return BlockFormat::BC1;
+    if (name == "bc3")
+        return BlockFormat::BC3;
+    if (name == "bc5")
+        return BlockFormat::BC5;
+    if (name == "bc7")
+        return BlockFormat::BC7;
+    return {};
+}
+
+static int packImages(std::span<char*> arguments)
+{
+    try {
+        std::vector<Image> sources;
+        for (const char* pFile : arguments.subspan(1))
+            sources.emplace_back(std::filesystem::path(pFile));
+        std::vector<const Image*> pSources;
+        for (const Image& source : sources)
+            pSources.push_back(&source);
+        if (!packChannels(pSources).writePngToFile(arguments[0]))
+            return 1;
+        std::cout << fmt::format("{} ({}x{}, {} channels)\n", arguments[0], sources[0].width, sources[0].height, sources.size());
+        return 0;
+    } catch (const std::exception&) {
+        // Image reports the reason itself.
+        return 1;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::string_view(argv[1]) == "pack") {
+        if (argc < 4 || argc > 7) {
+            std::cerr << "Usage: TextureBaker pack <output png> <red image> [green image] [blue image] [alpha image]" << std::endl;
+            return 1;
+        }
+        return packImages(std::span(argv + 2, size_t(argc - 2)));
+    }
+
+    const auto format = argc > 2 ? parseFormat(argv[1]) : std::nullopt;
+    if (!format) {
+        std::cerr << "Usage: TextureBaker <bc1|bc3|bc5|bc7> <image file>...\n"
+                  << "       TextureBaker pack <output png> <red image> [green image] [blue image] [alpha image]\n"
+                  << "  bc1: RGB, 4 bits per pixel\n"
+                  << "  bc3: RGBA, 8 bits per pixel\n"
+                  << "  bc5: two channels of a normal map, 8 bits per pixel\n"
+                  << "  bc7: RGBA at higher quality, 8 bits per pixel" << std::endl;
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 2; i < argc; i++) {
+        const std::filesystem::path file = argv[i];
+        try {
+            const auto start = std::chrono::steady_clock::now();
+            const Image image { file };
+            // BC5 only stores x and y, which is meant for normal maps.
+            MipChainSettings mipSettings;
+            mipSettings.normalMap = *format == BlockFormat::BC5;
+            CompressedTexture::store(file, CompressedTexture::computeSourceHash(file), image, *format, mipSettings);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << fmt::format("{} ({}x{}): {} bytes in {:.2f} s\n", compressedTexturePath(file).string(), image.width, image.height,
+                std::filesystem::file_size(compressedTexturePath(file)), seconds);
+        } catch (const std::exception&) {
+            // Image reports the reason itself; write failures are reported by store().
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -1,4 +1,28 @@
 #version 410
+// Features are compiled in or out by the defines below, which ShaderVariants sets for every variant (see Application);
+// the defaults give a variant with everything enabled.
+#ifndef SHADING_MODE
+#define SHADING_MODE 0// 0=Default, 1=Albedo, 2=Lambert, 3=Phong, 4=Blinn-Phong, 5=PBR, other=normals
+#endif
+#ifndef USE_SHADOWS
+#define USE_SHADOWS 1
+#endif
+#ifndef USE_NORMAL_MAP
+#define USE_NORMAL_MAP 1// Only takes effect with HAS_TEX_COORDS
+#endif
+#ifndef USE_MATERIAL_MAP
+#define USE_MATERIAL_MAP 1// Only takes effect with HAS_TEX_COORDS
+#endif
+#ifndef USE_ENVIRONMENT_MAP
+#define USE_ENVIRONMENT_MAP 1
+#endif
+#ifndef HAS_TEX_COORDS
+#define HAS_TEX_COORDS 1
+#endif
+#ifndef USE_MATERIAL
+#define USE_MATERIAL 0
+#endif
+
 in vec3 fragPosition;
 in vec3 fragNormal;
 in vec2 fragTexCoord;
@@ -14,14 +38,22 @@ layout(std140) uniform Material// Must match the GPUMaterial defined in src/mesh
     float metallic;
 };
 
-uniform bool useNormalMap;
 uniform sampler2D normalMap;
 uniform float normalStrength;
 uniform bool normalFlipY;
 
+// Packed terrain maps: ambient occlusion (r), roughness (g) and displacement (b).
+uniform sampler2D materialMap;
+
 uniform samplerCube skybox;
-uniform mat4 skyboxRotation;
-uniform bool useEnvironmentalMapping;
+
+// Data that changes at most once per frame, shared by all draws.
+layout(std140) uniform FrameData// Must match the GPUFrameData defined in src/application.cpp
+{
+    vec3 viewPos;
+    bool useDiffuse;
+    mat4 skyboxRotation;
+};
 
 struct Light {
     vec3 position;
@@ -29,30 +61,34 @@ struct Light {
 };
 
 #define NR_POINT_LIGHTS 2
-uniform Light lights[NR_POINT_LIGHTS];
-uniform mat4 lightMVP[NR_POINT_LIGHTS];
+layout(std140) uniform LightData// Must match the GPULightData defined in src/application.cpp
+{
+    Light lights[NR_POINT_LIGHTS];
+    mat4 lightMVP[NR_POINT_LIGHTS];
+};
 
-uniform bool useShadows;
 uniform sampler2D texShadow[NR_POINT_LIGHTS];
 uniform float offset = 0.0001;
 
-uniform vec3 viewPos;
-uniform bool useDiffuse;
 uniform sampler2D colorMap;
-uniform bool hasTexCoords;
-uniform bool useMaterial;
-uniform int  shadingMode;// 0=Default, 1=Lambert, 2=Phong, 3=Blinn
 
 layout(location = 0) out vec4 fragColor;
 
 const float PI = 3.14159265359;
 
 vec3 computeAlbedo() {
-    return (hasTexCoords && !useMaterial) ? texture(colorMap, fragTexCoord).rgb : kd;
+#if HAS_TEX_COORDS && !USE_MATERIAL
+    return texture(colorMap, fragTexCoord).rgb;
+#else
+    return kd;
+#endif
 }
 
 vec3 mapNormal() {
-    vec3 n = texture(normalMap, fragTexCoord).rgb * 2.0 - 1.0;
+    // Only x and y are read so that two-channel (BC5) normal maps work too; z is positive in tangent space.
+    vec3 n;
+    n.xy = texture(normalMap, fragTexCoord).rg * 2.0 - 1.0;
+    n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
     if (normalFlipY) n.g = -n.g;
     n = normalize(mix(vec3(0, 0, 1), n, normalStrength));
     return normalize(fragTBN * n);
@@ -99,8 +135,6 @@ vec3 reflection(vec3 n, vec3 i) {
 
 float shadow(vec3 normal, int lightIndex)
 {
-    if (!useShadows) return 1.0;
-
     vec4 fragLightCoord = lightMVP[lightIndex] * vec4(fragPosition, 1.0);
     fragLightCoord.xyz /= fragLightCoord.w;
     fragLightCoord.xyz = fragLightCoord.xyz * 0.5 + 0.5;
@@ -126,13 +160,23 @@ float shadow(vec3 normal, int lightIndex)
 }
 
 void main() {
+#if USE_NORMAL_MAP && HAS_TEX_COORDS
+    vec3 normal = mapNormal();
+#else
     vec3 normal = normalize(fragNormal);
-
-    if (useNormalMap && hasTexCoords)
-    normal = mapNormal();
+#endif
     vec3 viewDir = normalize(viewPos - fragPosition);
     vec3 albedo = computeAlbedo();
 
+#if USE_MATERIAL_MAP && HAS_TEX_COORDS
+    vec2 occlusionRoughness = texture(materialMap, fragTexCoord).rg;
+    float occlusion = occlusionRoughness.r;
+    float surfaceRoughness = occlusionRoughness.g;
+#else
+    float occlusion = 1.0;
+    float surfaceRoughness = roughness;
+#endif
+
     vec3 finalColor = vec3(0.0);
 
     // Loop over all point lights
@@ -143,20 +187,20 @@ void main() {
 
         vec3 color = vec3(0.0);
 
-        if (shadingMode == 0) { // Default (Lambert + BlinnPhong)
+#if SHADING_MODE == 0 // Default (Lambert + BlinnPhong)
             color = albedo * diff + ks * blinnSpec;
-        } else if (shadingMode == 1) { // Albedo
+#elif SHADING_MODE == 1 // Albedo
             color = albedo;
-        } else if (shadingMode == 2) { // Lambert
+#elif SHADING_MODE == 2 // Lambert
             color = albedo * diff;
-        } else if (shadingMode == 3) { // Phong
+#elif SHADING_MODE == 3 // Phong
             if (useDiffuse) color += albedo * diff;
             color += ks * phongSpecular(normal, lightDir, viewDir, shininess);
-        } else if (shadingMode == 4) { // Blinn-Phong
+#elif SHADING_MODE == 4 // Blinn-Phong
             if (useDiffuse) color += albedo * diff;
             color += ks * blinnSpec;
-        } else if (shadingMode == 5) { // PBR (GGX)
-            float r = clamp(roughness, 0.04, 1.0);
+#elif SHADING_MODE == 5 // PBR (GGX)
+            float r = clamp(surfaceRoughness, 0.04, 1.0);
             float m = clamp(metallic, 0.0, 1.0);
 
             vec3 halfVec = normalize(viewDir + lightDir);
@@ -176,24 +220,29 @@ void main() {
             vec3 spec = (D * G * F) / max(4.0 * NdotL * NdotV, 1e-4);
             vec3 Lo = (kD * albedo / PI + spec)  * NdotL;
 
-            vec3 ambient = albedo * 0.15;
+            vec3 ambient = albedo * 0.15 * occlusion;
             color = ambient + Lo;// TODO - something not good, pbr is too dark
-        } else {
+#else
             color = normal;
-        }
+#endif
 
         color *= lights[i].color;
 
-        if (useShadows) {
-            color *= shadow(normal, i);
-        }
+#if USE_SHADOWS
+        color *= shadow(normal, i);
+#endif
 
 
         finalColor += color * 0.5;
     }
 
-    if (useEnvironmentalMapping) finalColor += reflection(normal, -viewDir) * ks * 0.5;// TODO - should use proper reflection parameter instead of ks + add refraction
+#if USE_ENVIRONMENT_MAP
+    finalColor += reflection(normal, -viewDir) * ks * 0.5 * occlusion;// TODO - should use proper reflection parameter instead of ks + add refraction
+#endif
 
-    if (hasTexCoords || useMaterial) { fragColor = vec4(clamp(finalColor, 0.0, 1.0), transparency); }
-    else { fragColor = vec4(normal, 1); }
+#if HAS_TEX_COORDS || USE_MATERIAL
+    fragColor = vec4(clamp(finalColor, 0.0, 1.0), transparency);
+#else
+    fragColor = vec4(normal, 1);
+#endif
 }
\ No newline at end of file
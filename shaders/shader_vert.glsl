@@ -6,36 +6,49 @@ uniform mat4 modelMatrix;
 // https://paroj.github.io/gltut/Illumination/Tut09%20Normal%20Transformation.html
 uniform mat3 normalModelMatrix;
 
-layout(location = 0) in vec3 position;
+// Vertex decoding, must match GPUMesh in src/mesh.h. Packed vertices store the position relative to the bounding
+// box (with the bitangent sign in w) and octahedral encoded normals and tangents in the xy components.
+uniform bool packedVertices;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+layout(location = 0) in vec4 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 texCoord;
-layout(location=3) in vec3 tangent;    
-layout(location=4) in vec3 bitangent;  
-
-uniform bool hasTangents; 
+layout(location = 3) in vec3 tangent;
+layout(location = 4) in vec3 bitangent;
 
 out vec3 fragPosition;
 out vec3 fragNormal;
 out vec2 fragTexCoord;
 out mat3 fragTBN;
 
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
 void main()
 {
-    gl_Position = mvpMatrix * vec4(position, 1);
+    vec3 objectPosition = positionOffset + positionScale * position.xyz;
+    vec3 objectNormal = packedVertices ? octDecode(normal.xy) : normal;
+    vec3 objectTangent = packedVertices ? octDecode(tangent.xy) : tangent;
+    vec3 objectBitangent = packedVertices ? (position.w * 2.0 - 1.0) * cross(objectNormal, objectTangent) : bitangent;
 
-    fragPosition    = (modelMatrix * vec4(position, 1)).xyz;
-    vec3 N = normalize(normalModelMatrix * normal);
-    vec3 T = normalize(normalModelMatrix * tangent);
-    vec3 B = normalize(normalModelMatrix * bitangent);
+    gl_Position = mvpMatrix * vec4(objectPosition, 1);
 
-    if (!hasTangents) {
-        vec3 up = abs(N.y) < 0.999 ? vec3(0,1,0) : vec3(1,0,0);
-        T = normalize(cross(up, N));
-        B = normalize(cross(N, T));
-    }
+    fragPosition    = (modelMatrix * vec4(objectPosition, 1)).xyz;
+    vec3 N = normalize(normalModelMatrix * objectNormal);
+    vec3 T = normalize(normalModelMatrix * objectTangent);
+    vec3 B = normalModelMatrix * objectBitangent;
 
+    // Tangents are generated on the CPU (meshComputeTangents, MikkTSpace convention); keep the bitangent sign of
+    // mirrored texture mappings when re-orthogonalizing.
     T = normalize(T - N * dot(N, T));
-    B = normalize(cross(N, T));
+    B = (dot(cross(N, T), B) < 0.0 ? -1.0 : 1.0) * cross(N, T);
 
     fragNormal   = N;
     fragTBN      = mat3(T, B, N);
@@ -1,10 +1,13 @@
 #version 410
 
 uniform mat4 mvpMatrix;
+// Dequantization of packed positions (see shader_vert.glsl).
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 
 layout(location = 0) in vec3 position;
 
 void main()
 {
-    gl_Position = mvpMatrix * vec4(position, 1);
+    gl_Position = mvpMatrix * vec4(positionOffset + positionScale * position, 1);
 }
@@ -13,6 +13,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glad/glad.h>
 // Include glad before glfw3
 #include <GLFW/glfw3.h>
+#include <fmt/format.h>
 #include <imgui/imgui.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
@@ -20,18 +21,74 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/mat4x4.hpp>
 DISABLE_WARNINGS_POP()
+#include <framework/compressed_texture.h>
+#include <framework/frame_capture.h>
+#include <framework/frustum.h>
+#include <framework/hash.h>
+#include <framework/render_queue.h>
+#include <framework/image_cache.h>
+#include <framework/mapped_file.h>
+#include <framework/mip_cache.h>
+#include <framework/render_state.h>
 #include <framework/shader.h>
 #include <framework/window.h>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <functional>
 #include <iostream>
 #include <vector>
 
+// Video memory available to textures (see TextureBudget); lower these on machines with little memory.
+static constexpr size_t TEXTURE_BUDGET_BYTES      = size_t(512) << 20;
+static constexpr int    MAX_MATERIAL_TEXTURE_SIZE = 2048;
+static constexpr int    MAX_TERRAIN_TEXTURE_SIZE  = 4096;
+// Screenshots (F12) and recorded frame sequences (F11) are written here.
+static constexpr const char* CAPTURE_DIRECTORY = "captures";
+
+// Passes of the main render queue, in the order in which they are drawn. Opaque draws go first so that the skybox
+// only fills the background, and the blended draws are composited over both.
+static constexpr uint32_t OPAQUE_PASS      = 0;
+static constexpr uint32_t SKYBOX_PASS      = 1;
+static constexpr uint32_t TRANSLUCENT_PASS = 2;
+// Material id of the terrain in sort keys; mesh materials use GPUMesh::materialId().
+static constexpr uint32_t TERRAIN_MATERIAL_ID = 0;
+
+// Uniform buffer binding locations; location 0 holds the Material block of the mesh being drawn (see GPUMesh).
+static constexpr GLuint FRAME_DATA_BINDING = 1;
+static constexpr GLuint LIGHT_DATA_BINDING = 2;
+
+// Per-frame data of the lit shader, must match the FrameData block in shaders/shader_lit_frag.glsl (std140 layout)
+struct GPUFrameData
+{
+    glm::vec3 viewPos;
+    int32_t   useDiffuse;
+    glm::mat4 skyboxRotation;
+};
+static_assert(offsetof(GPUFrameData, skyboxRotation) == 16 && sizeof(GPUFrameData) == 80);
+
+// Must match the LightData block in shaders/shader_lit_frag.glsl (std140 layout)
+struct GPULight
+{
+    alignas(16) glm::vec3 position;
+    alignas(16) glm::vec3 color;
+};
+struct GPULightData
+{
+    std::array<GPULight, 2>  lights;
+    std::array<glm::mat4, 2> lightMVP;
+};
+static_assert(sizeof(GPULight) == 32 && offsetof(GPULightData, lightMVP) == 64);
+
 class Application
 {
    public:
     Application()
         : m_window("Final Project", glm::ivec2(1024, 1024), OpenGLVersion::GL41),
-          m_terrainTexture(RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_Color.jpg"),
+          m_decodingImages(decodeStartupImages(m_terrainMaterialMapPath)),
+          m_terrainTexture(TERRAIN_COLOR_PATH, TextureClass::Terrain),
           m_worldCamera(&m_window, glm::vec3(-6.0f, 2.5f, 2.5f), -glm::vec3(-3.5f, 0.5f, 2.0f)),
           m_objectCamera(&m_window, glm::vec3(0.0f, 1.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f)),
           m_activeCamera(&m_worldCamera),
@@ -57,14 +114,22 @@ class Application
                     onMouseReleased(button, mods);
             });
 
-        m_ufoMeshes  = GPUMesh::loadMeshGPU(RESOURCE_ROOT "resources/ufo/flying_Disk_flying.obj", true);
-        m_baseMeshes = GPUMesh::loadMeshGPU(RESOURCE_ROOT "resources/environment/MarsBase.obj");
-
-        std::vector<std::string> cubemapFaces = {"resources/skybox/right.png", "resources/skybox/left.png",
-                                                 "resources/skybox/top.png",   "resources/skybox/bottom.png",
-                                                 "resources/skybox/front.png", "resources/skybox/back.png"};
-        m_cubemapTex                          = Skybox::loadCubemap(cubemapFaces);
-        m_skyboxVAO                           = Skybox::createSkyboxVAO();
+        // Models are parsed in the background and uploaded a slice per frame (see update()); sub-meshes that are not
+        // resident yet are simply not drawn.
+        // The base also gets a BVH for mouse picking and for collisions with the UFO.
+        const GPUMeshSettings gpuMeshSettings{
+            .vertexFormat = VertexFormat::Packed, .buildMeshlets = true, .generateLods = true};
+        GPUMeshSettings baseMeshSettings = gpuMeshSettings;
+        baseMeshSettings.buildBvh        = true;
+        m_ufoMeshes =
+            GPUMesh::loadMeshGPUAsync(RESOURCE_ROOT "resources/ufo/flying_Disk_flying.obj", true, gpuMeshSettings);
+        m_baseMeshes =
+            GPUMesh::loadMeshGPUAsync(RESOURCE_ROOT "resources/environment/MarsBase.obj", false, baseMeshSettings);
+
+        m_cubemapTex = Skybox::loadCubemap(SKYBOX_FACES);
+        m_skyboxVAO  = Skybox::createSkyboxVAO();
+        // Every image that was decoded up front has been uploaded.
+        m_decodingImages.clear();
 
         m_objectCamera.setFollowTarget(&m_meshPosition, &m_meshRotation);
 
@@ -80,10 +145,14 @@ class Application
             shadowBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "Shaders/shadow_frag.glsl");
             m_shadowShader = shadowBuilder.build();
 
-            ShaderBuilder litBuilder;
-            litBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
-            litBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_lit_frag.glsl");
-            m_litShader = litBuilder.build();
+            m_litShaders = ShaderVariants({{GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl"},
+                                           {GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_lit_frag.glsl"}},
+                                          {"SHADING_MODE", "USE_SHADOWS", "USE_NORMAL_MAP", "USE_MATERIAL_MAP",
+                                           "USE_ENVIRONMENT_MAP", "HAS_TEX_COORDS", "USE_MATERIAL"});
+            // Build the variants that the first frame draws with; others are compiled when a setting first needs them.
+            for (bool hasTexCoords : {false, true})
+                litShader(hasTexCoords, !hasTexCoords && m_useMaterial, false, false, m_useEnvironmentalMapping);
+            litShader(m_useTexture, !m_useTexture && m_useMaterial, m_useNormalMap, m_useMaterialMap, false);
 
             ShaderBuilder skyboxBuilder;
             skyboxBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/skybox_vert.glsl");
@@ -106,7 +175,7 @@ class Application
             glGenFramebuffers(1, &m_framebuffers[i]);
             glGenTextures(1, &m_shadowTextures[i]);
 
-            glBindTexture(GL_TEXTURE_2D, m_shadowTextures[i]);
+            RenderState::global().bindTexture(0, GL_TEXTURE_2D, m_shadowTextures[i]);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, m_shadowWidth, m_shadowWidth, 0, GL_DEPTH_COMPONENT,
                          GL_FLOAT, nullptr);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -116,7 +185,7 @@ class Application
             float borderColor[] = {1.0, 1.0, 1.0, 1.0};
             glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
 
-            glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[i]);
+            RenderState::global().bindFramebuffer(m_framebuffers[i]);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_shadowTextures[i], 0);
             glDrawBuffer(GL_NONE);
             glReadBuffer(GL_NONE);
@@ -124,8 +193,12 @@ class Application
             {
                 std::cerr << "ERROR: Shadow framebuffer " << i << " is not complete!" << std::endl;
             }
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            RenderState::global().bindFramebuffer(0);
         }
+
+        // Uniform buffers of the lit shader, filled once per frame by updateFrameData()
+        for (GLuint* pBuffer : {&m_uboFrameData, &m_uboLightData})
+            glGenBuffers(1, pBuffer);
     }
 
     void update()
@@ -137,6 +210,9 @@ class Application
 
             m_window.updateInput();
 
+            m_ufoMeshes.update(m_meshUploadBudget);
+            m_baseMeshes.update(m_meshUploadBudget);
+
             if (m_selectedViewpoint == 1)
                 updateObjectMovement();
 
@@ -149,14 +225,19 @@ class Application
             glm::mat4 skyboxRotation =
                 glm::rotate(glm::mat4(1.0f), glm::radians(m_skyboxRotation), glm::vec3(0.0f, 1.0f, 0.0f));
 
+            // State changes of the previous frame, shown by imgui()
+            RenderState& renderState = RenderState::global();
+            m_renderStateCounters    = renderState.counters();
+            renderState.resetCounters();
+
             // Use ImGui for easy input/output of ints, floats, strings, etc...
             imgui();
 
             // Clear the screen
             glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            glEnable(GL_DEPTH_TEST);
-            glBlendFunc(GL_ONE, GL_ONE);
+            renderState.setEnabled(GL_DEPTH_TEST, true);
+            renderState.blendFunc(GL_ONE, GL_ONE);
 
             if (m_wire_frame_enabled)
             {
@@ -171,187 +252,213 @@ class Application
                 m_lightSpaceMatrices[lightIndex] = lightProjection * lightView;
             }
 
+            // Everything below only draws the meshes and terrain tiles that are in the view that it draws.
+            const glm::mat4 viewProjection = m_projectionMatrix * m_activeCamera->viewMatrix();
+            const glm::mat4 ufoModel       = ufoModelMatrix();
+            cullScene(viewProjection, ufoModel);
+
             // --- Perform shadow passes for each light ---
-            glCullFace(GL_FRONT);
-            glEnable(GL_DEPTH_TEST);
+            renderState.cullFace(GL_FRONT);
+            renderState.setEnabled(GL_DEPTH_TEST, true);
 
-            for (int lightIndex = 0; lightIndex < 2; lightIndex++)
+            for (size_t lightIndex = 0; lightIndex < 2; lightIndex++)
             {
-                glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[lightIndex]);
+                renderState.bindFramebuffer(m_framebuffers[lightIndex]);
                 glViewport(0, 0, m_shadowWidth, m_shadowWidth);
                 glClearDepth(1.0);
                 glClear(GL_DEPTH_BUFFER_BIT);
 
                 m_shadowShader.bind();
 
+                // Meshes are culled in the order of m_objectBounds: the UFO meshes followed by the base meshes.
+                const std::vector<uint8_t>& visibleObjects = m_visibleObjects[lightIndex];
+                size_t                      objectIndex    = m_ufoMeshes.meshes().size();
+
                 // Render shadow map for static environment meshes
-                for (auto& mesh : m_baseMeshes)
+                for (auto& mesh : m_baseMeshes.meshes())
                 {
+                    if (!visibleObjects[objectIndex++])
+                        continue;
                     glm::mat4 model    = m_modelMatrix;  // or however you compute it
                     glm::mat4 lightMVP = m_lightSpaceMatrices[lightIndex] * model;
-                    glUniformMatrix4fv(m_shadowShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE,
-                                       glm::value_ptr(lightMVP));
-                    glBindVertexArray(mesh.getVAO());
-                    mesh.draw(m_shadowShader, false);
+                    m_shadowShader.setUniform("mvpMatrix", lightMVP);
+                    mesh.drawVisible(m_shadowShader, lightMVP, model, glm::vec3(0.0f), false, false);
                 }
 
                 // Render shadow map for moving UFO meshes
-                for (auto& mesh : m_ufoMeshes)
+                objectIndex = 0;
+                for (auto& mesh : m_ufoMeshes.meshes())
                 {
-                    glm::mat4 model    = glm::rotate(glm::translate(m_modelMatrix, m_meshPosition), m_meshRotation.y,
-                                                     glm::vec3(0, 1, 0));
+                    if (!visibleObjects[objectIndex++])
+                        continue;
+                    glm::mat4 model    = ufoModel;
                     glm::mat4 lightMVP = m_lightSpaceMatrices[lightIndex] * model;
-                    glUniformMatrix4fv(m_shadowShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE,
-                                       glm::value_ptr(lightMVP));
-                    glBindVertexArray(mesh.getVAO());
-                    mesh.draw(m_shadowShader, false);
+                    m_shadowShader.setUniform("mvpMatrix", lightMVP);
+                    mesh.drawVisible(m_shadowShader, lightMVP, model, glm::vec3(0.0f), false, false);
                 }
 
-                glBindVertexArray(0);
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                renderState.bindFramebuffer(0);
             }
-            glCullFace(GL_BACK);
+            renderState.cullFace(GL_BACK);
+            updateFrameData(skyboxRotation);
             glViewport(0, 0, m_window.getWindowSize().x, m_window.getWindowSize().y);
             glClearColor(0.4f, 0.4f, 0.5f, 1.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            // Render all UFO meshes
-            for (GPUMesh& mesh : m_ufoMeshes)
-            {
-                glm::mat4 model =
-                    glm::rotate(glm::translate(m_modelMatrix, m_meshPosition), m_meshRotation.y, glm::vec3(0, 1, 0));
-                glm::mat4 mvpMatrix         = m_projectionMatrix * m_activeCamera->viewMatrix() * model;
-                glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(model));
-                bindAndSetup(m_litShader, mvpMatrix, model, normalModelMatrix);
-
-                glEnable(GL_BLEND);
-                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapTex);
-                glUniform1i(m_litShader.getUniformLocation("skybox"), 0);
-                glUniformMatrix4fv(m_litShader.getUniformLocation("skyboxRotation"), 1, GL_FALSE,
-                                   glm::value_ptr(skyboxRotation));
-
-                if (mesh.hasTextureCoords())
-                {
-                    // m_terrainTexture.bind(
-                    //     GL_TEXTURE0);  // TODO this has to be fixed -> meshes can get textures from .mtl
-                    glUniform1i(m_litShader.getUniformLocation("colorMap"), 0);
-                    glUniform1i(m_litShader.getUniformLocation("hasTexCoords"), GL_TRUE);
-                    glUniform1i(m_litShader.getUniformLocation("useMaterial"), GL_FALSE);
-                }
-                else
-                {
-                    glUniform1i(m_litShader.getUniformLocation("hasTexCoords"), GL_FALSE);
-                    glUniform1i(m_litShader.getUniformLocation("useMaterial"), m_useMaterial);
-                }
-                glUniform1i(m_litShader.getUniformLocation("useEnvironmentalMapping"), m_useEnvironmentalMapping);
-                glUniform1i(m_litShader.getUniformLocation("useNormalMap"), GL_FALSE);
-                glUniform1i(m_litShader.getUniformLocation("hasTangents"), GL_FALSE);
+            const LodSelection lodSelection{
+                .viewPos       = m_activeCamera->cameraPos(),
+                .pixelsPerUnit = 0.5f * m_projectionMatrix[1][1] * float(m_window.getWindowSize().y),
+                .maxPixelError = m_lodPixelError};
 
-                mesh.draw(m_litShader);
+            // Every part of the scene submits its draws to the render queue, which runs them sorted by pass, shader
+            // and material (see RenderQueue).
+            const glm::vec3             viewPos        = m_activeCamera->cameraPos();
+            const std::vector<uint8_t>& visibleObjects = m_visibleObjects[CAMERA_VIEW];
+            size_t                      objectIndex    = 0;
 
-                glDisable(GL_BLEND);
+            // Submit all UFO meshes; they are blended, so they are drawn back to front after everything else.
+            for (GPUMesh& mesh : m_ufoMeshes.meshes())
+            {
+                if (!visibleObjects[objectIndex++])
+                    continue;
+                const Shader& shader = litShader(mesh.hasTextureCoords(), !mesh.hasTextureCoords() && m_useMaterial,
+                                                 false, false, m_useEnvironmentalMapping);
+                const float depth =
+                    glm::distance(viewPos, glm::vec3(ufoModel * glm::vec4(mesh.boundsCenter(), 1.0f)));
+                m_renderQueue.submit(
+                    makeTranslucentSortKey(TRANSLUCENT_PASS, shader.program(), mesh.materialId(), depth),
+                    [&, &mesh = mesh, &shader = shader]()
+                    {
+                        const glm::mat4 mvpMatrix         = viewProjection * ufoModel;
+                        const glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(ufoModel));
+                        bindAndSetup(shader, mvpMatrix, ufoModel, normalModelMatrix);
+
+                        renderState.setEnabled(GL_BLEND, true);
+                        renderState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                        renderState.bindTexture(0, GL_TEXTURE_CUBE_MAP, m_cubemapTex);
+                        shader.setUniform("skybox", 0);
+                        // The diffuse texture from the .mtl file is bound by GPUMesh::draw.
+                        shader.setUniform("colorMap", GPUMesh::DIFFUSE_TEXTURE_UNIT);
+
+                        mesh.selectLod(ufoModel, lodSelection);
+                        // The UFO is blended, so its back faces stay visible through the front.
+                        mesh.drawVisible(shader, mvpMatrix, ufoModel, viewPos, false);
+                    });
             }
 
-            // Render base meshes
-            for (GPUMesh& mesh : m_baseMeshes)
+            // Submit base meshes
+            m_numVisibleMeshlets = 0;
+            m_numMeshlets        = 0;
+            for (GPUMesh& mesh : m_baseMeshes.meshes())
             {
-                glm::mat4 mvpMatrix         = m_projectionMatrix * m_activeCamera->viewMatrix() * m_modelMatrix;
-                glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(m_modelMatrix));
+                m_numMeshlets += mesh.numMeshlets();
+                if (!visibleObjects[objectIndex++])
+                    continue;
+                const Shader& shader = litShader(mesh.hasTextureCoords(), !mesh.hasTextureCoords() && m_useMaterial,
+                                                 false, false, m_useEnvironmentalMapping);
+                const float depth =
+                    glm::distance(viewPos, glm::vec3(m_modelMatrix * glm::vec4(mesh.boundsCenter(), 1.0f)));
+                m_renderQueue.submit(
+                    makeOpaqueSortKey(OPAQUE_PASS, shader.program(), mesh.materialId(), depth),
+                    [&, &mesh = mesh, &shader = shader]()
+                    {
+                        const glm::mat4 mvpMatrix         = viewProjection * m_modelMatrix;
+                        const glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(m_modelMatrix));
+                        bindAndSetup(shader, mvpMatrix, m_modelMatrix, normalModelMatrix);
+
+                        renderState.setEnabled(GL_BLEND, false);
+                        renderState.bindTexture(0, GL_TEXTURE_CUBE_MAP, m_cubemapTex);
+                        shader.setUniform("skybox", 0);
+                        // The diffuse texture from the .mtl file is bound by GPUMesh::draw.
+                        shader.setUniform("colorMap", GPUMesh::DIFFUSE_TEXTURE_UNIT);
+
+                        mesh.selectLod(m_modelMatrix, lodSelection);
+                        m_numVisibleMeshlets +=
+                            mesh.drawVisible(shader, mvpMatrix, m_modelMatrix, viewPos, m_useMeshletBackfaceCulling);
+                    });
+            }
 
-                bindAndSetup(m_litShader, mvpMatrix, m_modelMatrix, normalModelMatrix);
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapTex);
-                glUniform1i(m_litShader.getUniformLocation("skybox"), 0);
-                glUniformMatrix4fv(m_litShader.getUniformLocation("skyboxRotation"), 1, GL_FALSE,
-                                   glm::value_ptr(skyboxRotation));
+            // Submit terrain; its tiles surround the viewer, so it is sorted as if it were right in front of it.
+            {
+                const Shader& shader = litShader(m_useTexture, !m_useTexture && m_useMaterial, m_useNormalMap,
+                                                 m_useMaterialMap, false);
+                m_renderQueue.submit(
+                    makeOpaqueSortKey(OPAQUE_PASS, shader.program(), TERRAIN_MATERIAL_ID, 0.0f),
+                    [&, &shader = shader]()
+                    {
+                        const glm::mat4 modelMatrix       = m_modelMatrix;
+                        const glm::mat4 mvpMatrix         = viewProjection * modelMatrix;
+                        const glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(modelMatrix));
+                        bindAndSetup(shader, mvpMatrix, modelMatrix, normalModelMatrix);
+                        renderState.setEnabled(GL_BLEND, false);
+
+                        if (m_useTexture)
+                        {
+                            m_terrainTexture.bind(GL_TEXTURE2);
+                            shader.setUniform("colorMap", 2);
+                        }
+                        if (m_useNormalMap)
+                        {
+                            m_terrainNormal.bind(GL_TEXTURE3);
+                            shader.setUniform("normalMap", 3);
+                            shader.setUniform("normalStrength", m_normalStrength);
+                            shader.setUniform("normalFlipY", m_normalFlipY);
+                        }
+                        // Ambient occlusion and roughness come from one fetch of the packed material map.
+                        if (m_useMaterialMap)
+                        {
+                            m_terrainMaterialMap.bind(GL_TEXTURE6);
+                            shader.setUniform("materialMap", 6);
+                        }
+
+                        m_terrain.render(shader, lodSelection, m_visibleTiles);
+                    });
+            }
 
-                if (mesh.hasTextureCoords())
-                {
-                    // m_terrainTexture.bind(
-                    //     GL_TEXTURE0);  // TODO this has to be fixed -> meshes can get textures from .mtl
-                    glUniform1i(m_litShader.getUniformLocation("colorMap"), 0);
-                    glUniform1i(m_litShader.getUniformLocation("hasTexCoords"), GL_TRUE);
-                    glUniform1i(m_litShader.getUniformLocation("useMaterial"), GL_FALSE);
-                }
-                else
+            // Submit skybox; it only covers pixels that no opaque draw has written to.
+            m_renderQueue.submit(
+                makeOpaqueSortKey(SKYBOX_PASS, m_skyboxShader.program(), 0, 0.0f),
+                [&]()
                 {
-                    glUniform1i(m_litShader.getUniformLocation("hasTexCoords"), GL_FALSE);
-                    glUniform1i(m_litShader.getUniformLocation("useMaterial"), m_useMaterial);
-                }
-                glUniform1i(m_litShader.getUniformLocation("useEnvironmentalMapping"), m_useEnvironmentalMapping);
-                glUniform1i(m_litShader.getUniformLocation("useNormalMap"), GL_FALSE);
-                glUniform1i(m_litShader.getUniformLocation("hasTangents"), GL_FALSE);
-
-                mesh.draw(m_litShader);
+                    const glm::mat4 skyboxView = glm::mat4(glm::mat3(m_activeCamera->viewMatrix())) * skyboxRotation;
 
-                glDisable(GL_BLEND);
-            }
+                    renderState.setEnabled(GL_BLEND, false);
+                    renderState.depthMask(false);
+                    renderState.depthFunc(GL_LEQUAL);
+                    m_skyboxShader.bind();
+                    m_skyboxShader.setUniform("view", skyboxView);
+                    m_skyboxShader.setUniform("projection", m_projectionMatrix);
+                    m_skyboxShader.setUniform("skybox", 0);
 
-            // Render terrain
-            {
-                glm::mat4 modelMatrix       = m_modelMatrix;
-                glm::mat4 mvpMatrix         = m_projectionMatrix * m_activeCamera->viewMatrix() * modelMatrix;
-                glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(modelMatrix));
-                bindAndSetup(m_litShader, mvpMatrix, modelMatrix, normalModelMatrix);
+                    renderState.bindTexture(0, GL_TEXTURE_CUBE_MAP, m_cubemapTex);
 
-                if (m_useTexture)
-                {
-                    m_terrainTexture.bind(GL_TEXTURE2);
-                    glUniform1i(m_litShader.getUniformLocation("colorMap"), 2);
-                    glUniform1i(m_litShader.getUniformLocation("hasTexCoords"), GL_TRUE);
-                    glUniform1i(m_litShader.getUniformLocation("useMaterial"), GL_FALSE);
-                }
-                else
-                {
-                    glUniform1i(m_litShader.getUniformLocation("hasTexCoords"), GL_FALSE);
-                    glUniform1i(m_litShader.getUniformLocation("useMaterial"), m_useMaterial);
-                }
-                glUniform1i(m_litShader.getUniformLocation("useEnvironmentalMapping"), GL_FALSE);
-                glUniform1i(m_litShader.getUniformLocation("useNormalMap"), m_useNormalMap);
-                glUniform1i(m_litShader.getUniformLocation("hasTangents"), GL_TRUE);
-                if (m_useNormalMap)
-                {
-                    m_terrainNormal.bind(GL_TEXTURE3);
-                    glUniform1i(m_litShader.getUniformLocation("normalMap"), 3);
-                    glUniform1f(m_litShader.getUniformLocation("normalStrength"), m_normalStrength);
-                    glUniform1i(m_litShader.getUniformLocation("normalFlipY"), m_normalFlipY);
-                }
+                    renderState.bindVertexArray(m_skyboxVAO);
+                    glDrawArrays(GL_TRIANGLES, 0, 36);
 
-                m_terrain.render(m_litShader);
-            }
+                    renderState.depthMask(true);
+                    renderState.depthFunc(GL_LESS);
+                });
 
-            // Render skybox
-            {
-                glm::mat4 skyboxView = glm::mat4(glm::mat3(m_activeCamera->viewMatrix())) * skyboxRotation;
-
-                glDepthMask(GL_FALSE);
-                glDepthFunc(GL_LEQUAL);
-                m_skyboxShader.bind();
-                glUniform1i(m_litShader.getUniformLocation("useNormalMap"), GL_FALSE);
-                glUniform1i(m_litShader.getUniformLocation("hasTangents"), GL_FALSE);
-                glUniformMatrix4fv(m_skyboxShader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(skyboxView));
-                glUniformMatrix4fv(m_skyboxShader.getUniformLocation("projection"), 1, GL_FALSE,
-                                   glm::value_ptr(m_projectionMatrix));
-                glUniform1i(m_skyboxShader.getUniformLocation("skybox"), 0);
-
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapTex);
-
-                glBindVertexArray(m_skyboxVAO);
-                glDrawArrays(GL_TRIANGLES, 0, 36);
-                glBindVertexArray(0);
-
-                glDepthMask(GL_TRUE);
-                glDepthFunc(GL_LESS);
-            }
+            m_numDrawPackets = m_renderQueue.numPackets();
+            m_renderQueue.execute();
+            renderState.setEnabled(GL_BLEND, false);
 
             // Disable wireframe rendering after loop
             if (m_wire_frame_enabled)
             {
                 glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
             }
+            // Capture the scene without the user interface, which is drawn when swapping buffers.
+            if (m_takeScreenshot)
+            {
+                std::filesystem::create_directories(CAPTURE_DIRECTORY);
+                const auto filePath = std::filesystem::path(CAPTURE_DIRECTORY) /
+                                      fmt::format("screenshot_{:04}.png", m_numScreenshots++);
+                m_frameCapture.capture(m_window.getWindowSize(), filePath);
+                m_takeScreenshot = false;
+            }
+            m_frameCapture.update(m_window.getWindowSize());
+
             // Processes input and swaps the window buffer
             m_window.swapBuffers();
         }
@@ -362,6 +469,8 @@ class Application
             glDeleteTextures(1, &m_shadowTextures[i]);
         }
         glDeleteVertexArrays(1, &m_skyboxVAO);
+        glDeleteBuffers(1, &m_uboFrameData);
+        glDeleteBuffers(1, &m_uboLightData);
     }
 
     // In here you can handle key presses
@@ -394,6 +503,10 @@ class Application
             m_shadingMode = 2;
         else if (key == GLFW_KEY_6)
             m_shadingMode = 3;
+        else if (key == GLFW_KEY_F12)
+            m_takeScreenshot = true;
+        else if (key == GLFW_KEY_F11)
+            toggleRecording();
     }
 
     // In here you can handle key releases
@@ -410,13 +523,41 @@ class Application
     // If one of the mouse buttons is pressed this function will be called
     // button - Integer that corresponds to numbers in https://www.glfw.org/docs/latest/group__buttons.html
     // mods - Any modifier buttons pressed
-    void onMouseClicked(int button, int mods) { std::cout << "Pressed mouse button: " << button << std::endl; }
+    void onMouseClicked(int button, int mods)
+    {
+        std::cout << "Pressed mouse button: " << button << std::endl;
+        if (button == GLFW_MOUSE_BUTTON_LEFT && !ImGui::GetIO().WantCaptureMouse)
+            pickBase();
+    }
 
     // If one of the mouse buttons is released this function will be called
     // button - Integer that corresponds to numbers in https://www.glfw.org/docs/latest/group__buttons.html
     // mods - Any modifier buttons pressed
     void onMouseReleased(int button, int mods) { std::cout << "Released mouse button: " << button << std::endl; }
 
+    // Cast a ray through the cursor against the base meshes (which are drawn with m_modelMatrix).
+    void pickBase()
+    {
+        const Bvh* pBvh = m_baseMeshes.bvh();
+        if (!pBvh)
+            return;
+
+        const glm::mat4 inverseModelViewProjection =
+            glm::inverse(m_projectionMatrix * m_activeCamera->viewMatrix() * m_modelMatrix);
+        // The cursor position is normalized with y pointing up, like normalized device coordinates.
+        const glm::vec2 ndc     = 2.0f * m_window.getNormalizedCursorPos() - 1.0f;
+        const glm::vec4 nearPos = inverseModelViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+        const glm::vec4 farPos  = inverseModelViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+        Ray ray;
+        ray.origin    = glm::vec3(nearPos) / nearPos.w;
+        ray.direction = glm::normalize(glm::vec3(farPos) / farPos.w - ray.origin);
+
+        const auto start = std::chrono::steady_clock::now();
+        m_hasPick        = pBvh->intersectRay(ray, m_pickHit);
+        m_pickQueryTime  = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+        m_pickPosition   = glm::vec3(m_modelMatrix * glm::vec4(ray.origin + ray.t * ray.direction, 1.0f));
+    }
+
     // Update object position
     void updateObjectMovement()
     {
@@ -425,18 +566,65 @@ class Application
 
         glm::vec3 forward = glm::vec3(sin(m_meshRotation.y), 0.0f, cos(m_meshRotation.y));
 
+        glm::vec3 delta{0.0f};
         if (m_window.isKeyPressed(GLFW_KEY_W))
-            m_meshPosition += forward * objectSpeed;
+            delta += forward * objectSpeed;
         if (m_window.isKeyPressed(GLFW_KEY_S))
-            m_meshPosition -= forward * objectSpeed;
+            delta -= forward * objectSpeed;
         if (m_window.isKeyPressed(GLFW_KEY_A))
             m_meshRotation.y += rotateSpeed;
         if (m_window.isKeyPressed(GLFW_KEY_D))
             m_meshRotation.y -= rotateSpeed;
         if (m_window.isKeyPressed(GLFW_KEY_SPACE))
-            m_meshPosition.y += objectSpeed;
+            delta.y += objectSpeed;
         else if (m_meshPosition.y > 1.5f)
-            m_meshPosition.y -= objectSpeed;
+            delta.y -= objectSpeed;
+
+        // Move along each axis separately so that the UFO slides along walls instead of sticking to them. The base
+        // is drawn with m_modelMatrix, which is the identity, so the BVH is in world space.
+        const Bvh* pBvh = m_baseMeshes.bvh();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            glm::vec3 axisDelta{0.0f};
+            axisDelta[axis] = delta[axis];
+            if (axisDelta[axis] == 0.0f)
+                continue;
+            if (m_useCollision && pBvh)
+            {
+                // A UFO that already overlaps the base (it started there, or the base finished loading around it)
+                // may only move away from it; every sweep from its position would be blocked otherwise.
+                if (!pBvh->overlapsSphere(m_meshPosition, m_ufoCollisionRadius))
+                {
+                    if (pBvh->overlapsCapsule(m_meshPosition, m_meshPosition + axisDelta, m_ufoCollisionRadius))
+                        continue;
+                }
+                else if (collisionClearance(*pBvh, m_meshPosition + axisDelta) <=
+                         collisionClearance(*pBvh, m_meshPosition))
+                {
+                    continue;
+                }
+            }
+            m_meshPosition += axisDelta;
+        }
+    }
+
+    // Distance from position to the closest triangle of the base, up to m_ufoCollisionRadius, found by bisection.
+    float collisionClearance(const Bvh& bvh, const glm::vec3& position) const
+    {
+        constexpr int numSteps = 10;
+        float         clear    = 0.0f;
+        float         blocked  = m_ufoCollisionRadius;
+        if (!bvh.overlapsSphere(position, blocked))
+            return blocked;
+        for (int step = 0; step < numSteps; step++)
+        {
+            const float radius = 0.5f * (clear + blocked);
+            if (bvh.overlapsSphere(position, radius))
+                blocked = radius;
+            else
+                clear = radius;
+        }
+        return clear;
     }
 
     void imgui()
@@ -473,6 +661,24 @@ class Application
         ImGui::Checkbox("Use Environmental Mapping", &m_useEnvironmentalMapping);
         ImGui::Checkbox("Use material if no texture", &m_useMaterial);
         ImGui::Checkbox("Use Shadows", &m_useShadows);
+        ImGui::Checkbox("Meshlet Backface Culling", &m_useMeshletBackfaceCulling);
+        ImGui::Text("Base meshlets drawn: %zu / %zu", m_numVisibleMeshlets, m_numMeshlets);
+        ImGui::Text("Meshes in view: %zu / %zu (light views: %zu, %zu)", m_numVisibleObjects[CAMERA_VIEW],
+                    m_objectBounds.size(), m_numVisibleObjects[0], m_numVisibleObjects[1]);
+        ImGui::Text("Terrain tiles in view: %zu / %zu", m_numVisibleTiles, m_terrain.tileBounds().size());
+        ImGui::SliderFloat("LOD Pixel Error", &m_lodPixelError, 0.0f, 8.0f);
+        ImGui::Checkbox("UFO Collision", &m_useCollision);
+        if (m_hasPick)
+        {
+            ImGui::Text("Picked sub mesh %u, triangle %u (%.1f us)", m_pickHit.meshIndex, m_pickHit.triangleIndex,
+                        double(m_pickQueryTime));
+            ImGui::Text("at (%.2f, %.2f, %.2f)", double(m_pickPosition.x), double(m_pickPosition.y),
+                        double(m_pickPosition.z));
+        }
+        else
+        {
+            ImGui::Text("Click the base to pick a triangle");
+        }
 
         ImGui::Separator();
         ImGui::Text("Normal Mapping Terrain");
@@ -484,6 +690,7 @@ class Application
         ImGui::Text("Terrain");
         ImGui::Checkbox("Wireframe", &m_wire_frame_enabled);
         ImGui::Checkbox("Use Texture", &m_useTexture);
+        ImGui::Checkbox("Use Occlusion/Roughness Map", &m_useMaterialMap);
 
         ImGui::SliderFloat("Tile Size", &m_terrainParameters.tileSize, 1.0f, 50.0f);
         ImGui::SliderInt("Subdivisions", &m_terrainParameters.subdivisions, 1, 10);
@@ -494,40 +701,196 @@ class Application
         {
             m_terrain.setParameters(m_terrainParameters);
         }
+
+        ImGui::Separator();
+        const TextureBudget& textureBudget = TextureBudget::global();
+        ImGui::Text("Texture memory: %.1f / %.1f MB (%zu reduced)", double(textureBudget.residentBytes()) / 1e6,
+                    double(textureBudget.maxResidentBytes()) / 1e6, textureBudget.numReducedTextures());
+
+        ImGui::Separator();
+        ImGui::Text("Capture");
+        if (ImGui::Button("Screenshot (F12)"))
+            m_takeScreenshot = true;
+        ImGui::SameLine();
+        if (ImGui::Button(m_frameCapture.isRecording() ? "Stop Recording (F11)" : "Record Frames (F11)"))
+            toggleRecording();
+        if (m_frameCapture.isRecording())
+            ImGui::Text("Recorded %u frames", m_frameCapture.numSequenceFrames());
+        ImGui::Text("Pending captures: %zu, stalls: %zu", m_frameCapture.numPending(), m_frameCapture.numStalls());
+
+        ImGui::Separator();
+        ImGui::Text("GL state changes: %zu issued, %zu elided", m_renderStateCounters.issued,
+                    m_renderStateCounters.elided);
+        ImGui::Text("Draw packets: %zu", m_numDrawPackets);
         ImGui::End();
     }
 
-    void bindAndSetup(Shader& sh, const glm::mat4& mvp, const glm::mat4& model, const glm::mat3& normal)
+    // Start or stop recording every frame as a numbered image sequence; each recording gets its own prefix.
+    void toggleRecording()
     {
-        sh.bind();
-        glUniformMatrix4fv(sh.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvp));
-        glUniformMatrix4fv(sh.getUniformLocation("modelMatrix"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix3fv(sh.getUniformLocation("normalModelMatrix"), 1, GL_FALSE, glm::value_ptr(normal));
+        if (m_frameCapture.isRecording())
+        {
+            m_frameCapture.stopSequence();
+            return;
+        }
+        std::filesystem::create_directories(CAPTURE_DIRECTORY);
+        m_frameCapture.startSequence(std::filesystem::path(CAPTURE_DIRECTORY) /
+                                     fmt::format("sequence_{:02}", m_numSequences++));
+    }
 
-        for (int lightIndex = 0; lightIndex < 2; lightIndex++)
+    // Start decoding the textures that the constructor uploads (the terrain maps and the skybox faces) on the thread
+    // pool, so that they are decoded concurrently instead of one after the other as they are needed.
+    static std::vector<ImageCache::ImageFuture> decodeStartupImages(const std::filesystem::path& terrainMaterialMapPath)
+    {
+        // Images with a baked compressed copy or cached mip chain are normally not decoded at all (see Texture).
+        std::vector<ImageCache::ImageFuture> out;
+        const auto decodeAsync = [&](const std::filesystem::path& filePath)
+        {
+            if (!std::filesystem::exists(compressedTexturePath(filePath)) && !std::filesystem::exists(mipCachePath(filePath)))
+                out.push_back(ImageCache::global().loadAsync(filePath));
+        };
+        for (const char* filePath : {TERRAIN_COLOR_PATH, TERRAIN_NORMAL_PATH})
+            decodeAsync(filePath);
+        if (!std::filesystem::exists(terrainMaterialMapPath))
         {
-            glm::mat4 lightMVP = m_lightSpaceMatrices[lightIndex];
-
-            glUniform3fv(sh.getUniformLocation("lights[" + std::to_string(lightIndex) + "].position"), 1,
-                         glm::value_ptr(m_lights[lightIndex].position));
-            glUniform3fv(sh.getUniformLocation("lights[" + std::to_string(lightIndex) + "].color"), 1,
-                         glm::value_ptr(m_lights[lightIndex].color));
-            glUniformMatrix4fv(sh.getUniformLocation("lightMVP[" + std::to_string(lightIndex) + "]"), 1, GL_FALSE,
-                               glm::value_ptr(lightMVP));
-
-            glActiveTexture(GL_TEXTURE0 + lightIndex + 4);
-            glBindTexture(GL_TEXTURE_2D, m_shadowTextures[lightIndex]);
-            glUniform1i(sh.getUniformLocation("texShadow[" + std::to_string(lightIndex) + "]"), lightIndex + 4);
+            for (const char* filePath : TERRAIN_MATERIAL_MAP_SOURCES)
+                decodeAsync(filePath);
         }
-        // Other uniforms
-        glUniform1i(sh.getUniformLocation("shadingMode"), m_shadingMode);
-        glUniform1i(sh.getUniformLocation("useDiffuse"), m_useDiffuseInSpecular);
-        glUniform1i(sh.getUniformLocation("useShadows"), m_useShadows);
-        glUniform3fv(sh.getUniformLocation("viewPos"), 1, glm::value_ptr(m_activeCamera->cameraPos()));
+        for (const std::string& face : SKYBOX_FACES)
+            decodeAsync(face);
+        return out;
+    }
+
+    // File to which the packed terrain material map is baked. Its name contains a hash of the source images, so that
+    // changing any of them bakes a new one instead of using a stale bake.
+    static std::filesystem::path terrainMaterialMapPath()
+    {
+        uint64_t hash = 0;
+        for (const char* filePath : TERRAIN_MATERIAL_MAP_SOURCES)
+            hash = hashBytes(MappedFile(filePath).data(), hash);
+        return fmt::format("{}_{:016x}.png", TERRAIN_MATERIAL_MAP_BASE_PATH, hash);
+    }
+
+    // Pack the single-channel terrain maps into the channels of one image (see TERRAIN_MATERIAL_MAP_SOURCES) and bake
+    // it to filePath, unless a previous run already did; same as "TextureBaker pack" with the same files. If the bake
+    // cannot be written (e.g. the resources are read-only) the texture is made from the packed image in memory.
+    static Texture loadTerrainMaterialMap(const std::filesystem::path& filePath)
+    {
+        // The maps hold data rather than colors, so their mip-maps are filtered without sRGB decoding.
+        const MipChainSettings mipSettings{.srgb = false};
+        if (std::filesystem::exists(filePath))
+            return Texture(filePath, TextureClass::Terrain, mipSettings);
+
+        std::vector<std::shared_ptr<Image>> sources;
+        std::vector<const Image*>           pSources;
+        for (const char* sourcePath : TERRAIN_MATERIAL_MAP_SOURCES)
+            pSources.push_back(sources.emplace_back(ImageCache::global().load(sourcePath)).get());
+        const Image packed = packChannels(pSources);
+        if (packed.writePngToFile(filePath))
+            return Texture(filePath, TextureClass::Terrain, mipSettings);
+        return Texture(packed, TextureClass::Terrain);
+    }
+
+    // Variant of the lit shader with only the features that the settings and the surface use compiled in.
+    const Shader& litShader(bool hasTexCoords, bool useMaterial, bool useNormalMap, bool useMaterialMap,
+                            bool useEnvironmentalMapping)
+    {
+        // Must match the define names passed to m_litShaders.
+        const std::array<int, 7> defineValues{m_shadingMode,
+                                              m_useShadows,
+                                              useNormalMap && hasTexCoords,
+                                              useMaterialMap && hasTexCoords,
+                                              useEnvironmentalMapping,
+                                              hasTexCoords,
+                                              useMaterial};
+        return m_litShaders.get(defineValues);
+    }
+
+    glm::mat4 ufoModelMatrix() const
+    {
+        return glm::rotate(glm::translate(m_modelMatrix, m_meshPosition), m_meshRotation.y, glm::vec3(0, 1, 0));
+    }
+
+    // Test the bounding boxes of all meshes against the view frustum of each light and of the camera, and those of the
+    // terrain tiles against the camera's only (the terrain is not drawn into the shadow maps).
+    void cullScene(const glm::mat4& viewProjection, const glm::mat4& ufoModel)
+    {
+        m_objectBounds.clear();
+        for (const GPUMesh& mesh : m_ufoMeshes.meshes())
+            m_objectBounds.push_back(ufoModel, mesh.boundsMin(), mesh.boundsMax());
+        for (const GPUMesh& mesh : m_baseMeshes.meshes())
+            m_objectBounds.push_back(m_modelMatrix, mesh.boundsMin(), mesh.boundsMax());
+
+        for (size_t view = 0; view < m_visibleObjects.size(); view++)
+        {
+            const glm::mat4& matrix = view == CAMERA_VIEW ? viewProjection : m_lightSpaceMatrices[view];
+            m_visibleObjects[view].resize(m_objectBounds.size());
+            m_numVisibleObjects[view] = cullBoxes(Frustum{matrix}, m_objectBounds, m_visibleObjects[view]);
+        }
+
+        m_visibleTiles.resize(m_terrain.tileBounds().size());
+        m_numVisibleTiles = cullBoxes(Frustum{viewProjection}, m_terrain.tileBounds(), m_visibleTiles);
+    }
+
+    // Upload the data that all lit draws of this frame share and bind it (and the shadow maps) for the main pass.
+    void updateFrameData(const glm::mat4& skyboxRotation)
+    {
+        const GPUFrameData frameData{m_activeCamera->cameraPos(), m_useDiffuseInSpecular, skyboxRotation};
+        GPULightData       lightData;
+        for (size_t lightIndex = 0; lightIndex < lightData.lights.size(); lightIndex++)
+        {
+            lightData.lights[lightIndex]   = {m_lights[lightIndex].position, m_lights[lightIndex].color};
+            lightData.lightMVP[lightIndex] = m_lightSpaceMatrices[lightIndex];
+        }
+
+        // Respecifying the whole buffer lets the driver hand out new memory instead of waiting for the last frame.
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uboFrameData);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(frameData), &frameData, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uboLightData);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(lightData), &lightData, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, m_uboFrameData);
+        glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_DATA_BINDING, m_uboLightData);
+
+        for (int lightIndex = 0; lightIndex < 2; lightIndex++)
+            RenderState::global().bindTexture(GLuint(lightIndex + 4), GL_TEXTURE_2D, m_shadowTextures[lightIndex]);
+    }
+
+    // Set the per-object uniforms; everything else is shared through the buffers bound by updateFrameData().
+    void bindAndSetup(const Shader& sh, const glm::mat4& mvp, const glm::mat4& model, const glm::mat3& normal)
+    {
+        sh.bind();
+        sh.setUniform("mvpMatrix", mvp);
+        sh.setUniform("modelMatrix", model);
+        sh.setUniform("normalModelMatrix", normal);
+
+        // These only make OpenGL calls the first time a shader (variant) is used.
+        sh.setUniformBlockBinding("FrameData", FRAME_DATA_BINDING);
+        sh.setUniformBlockBinding("LightData", LIGHT_DATA_BINDING);
+        sh.setUniform("texShadow[0]", 4);
+        sh.setUniform("texShadow[1]", 5);
     }
 
    private:
+    static constexpr const char* TERRAIN_COLOR_PATH =
+        RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_Color.jpg";
+    static constexpr const char* TERRAIN_NORMAL_PATH =
+        RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_NormalGL.jpg";
+    // Ambient occlusion (red), roughness (green) and displacement (blue) in one texture; see terrainMaterialMapPath().
+    static constexpr const char* TERRAIN_MATERIAL_MAP_BASE_PATH =
+        RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_AORoughnessDisplacement";
+    static constexpr std::array<const char*, 3> TERRAIN_MATERIAL_MAP_SOURCES{
+        RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_AmbientOcclusion.jpg",
+        RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_Roughness.jpg",
+        RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_Displacement.jpg"};
+    inline static const std::vector<std::string> SKYBOX_FACES = {
+        "resources/skybox/right.png", "resources/skybox/left.png",  "resources/skybox/top.png",
+        "resources/skybox/bottom.png", "resources/skybox/front.png", "resources/skybox/back.png"};
+
     Window m_window;
+    const std::filesystem::path m_terrainMaterialMapPath = terrainMaterialMapPath();
+    // Images that are being decoded for the constructor; see decodeStartupImages().
+    std::vector<ImageCache::ImageFuture> m_decodingImages;
 
     bool m_wire_frame_enabled      = false;
     bool m_useTexture              = true;
@@ -537,13 +900,15 @@ class Application
     // Shader for default rendering and for depth rendering
     Shader m_defaultShader;
     Shader m_shadowShader;
-    Shader m_litShader;
+    // Variants of shader_lit_frag.glsl; see litShader()
+    ShaderVariants m_litShaders;
     Shader m_skyboxShader;
     int    m_shadingMode = 0;
     Shader m_lightShader;
 
-    std::vector<GPUMesh> m_ufoMeshes;
-    std::vector<GPUMesh> m_baseMeshes;
+    GPUMeshLoad          m_ufoMeshes;
+    GPUMeshLoad          m_baseMeshes;
+    size_t               m_meshUploadBudget{8 * 1024 * 1024};  // Bytes of mesh data uploaded per frame while loading
     Texture              m_terrainTexture;
     bool                 m_useMaterial{true};
     glm::vec3            m_meshPosition{0.0f, 1.5f, 0.0f};
@@ -566,6 +931,15 @@ class Application
         {glm::vec3(0.4f, 20.2f, 10.2f), glm::vec3(0.77f, 1.0f, 0.90f), false, glm::vec3(0.0f, 0.0f, 0.0f)},
         {glm::vec3(-20.4f, 15.2f, 20.2f), glm::vec3(0.95f, 0.78f, 0.97f), false, glm::vec3(0.0f, 0.0f, 0.0f)}};
     glm::mat4 m_lightSpaceMatrices[2];
+    // State changes made through RenderState in the previous frame
+    RenderState::Counters m_renderStateCounters;
+    // Draws of the main pass, sorted to minimize state changes (see RenderQueue)
+    RenderQueue m_renderQueue;
+    size_t      m_numDrawPackets = 0;
+
+    // Uniform buffers holding GPUFrameData and GPULightData
+    GLuint m_uboFrameData;
+    GLuint m_uboLightData;
 
     // Viewpoints
     Camera  m_worldCamera;
@@ -576,11 +950,14 @@ class Application
     TerrainParameters m_terrainParameters{100, 50.0f, 5};
     Terrain           m_terrain;
 
-    Texture m_terrainNormal{RESOURCE_ROOT "resources/terrain/Ground050/Ground050_2K-JPG_NormalGL.jpg"};
+    Texture m_terrainNormal{TERRAIN_NORMAL_PATH, TextureClass::NormalMap, MipChainSettings{.normalMap = true}};
     bool    m_useNormalMap   = true;
     float   m_normalStrength = 1.0f;
     int     m_normalFlipY    = 0;
 
+    Texture m_terrainMaterialMap{loadTerrainMaterialMap(m_terrainMaterialMapPath)};
+    bool    m_useMaterialMap = true;
+
     // Projection and view matrices for you to fill in and use
     glm::mat4 m_projectionMatrix = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f);
     glm::mat4 m_viewMatrix       = glm::lookAt(glm::vec3(-1, 1, -1), glm::vec3(0), glm::vec3(0, 1, 0));
@@ -591,10 +968,48 @@ class Application
     GLuint m_shadowTextures[2];
     int    m_shadowWidth = 4096;
     bool   m_useShadows  = true;
+
+    // Meshlet culling of the base meshes. Back faces are drawn (GL_CULL_FACE is off), so culling back-facing meshlets
+    // is opt-in: it removes the insides of open or single-sided parts of the base.
+    bool   m_useMeshletBackfaceCulling = false;
+    size_t m_numVisibleMeshlets        = 0;
+    size_t m_numMeshlets               = 0;
+
+    // Frustum culling of whole meshes and terrain tiles; views 0 and 1 are the lights, CAMERA_VIEW is the camera.
+    static constexpr size_t CAMERA_VIEW = 2;
+    // World space bounds of the UFO meshes followed by those of the base meshes
+    BoundingBoxes                        m_objectBounds;
+    std::array<std::vector<uint8_t>, 3> m_visibleObjects;
+    std::array<size_t, 3>                m_numVisibleObjects{};
+    std::vector<uint8_t>                 m_visibleTiles;
+    size_t                               m_numVisibleTiles = 0;
+
+    // Largest simplification error (in pixels) that is accepted when choosing a mesh's level of detail
+    float m_lodPixelError = 1.0f;
+
+    // Collision of the UFO (approximated by a sphere) with the base and picking of base triangles
+    bool      m_useCollision       = true;
+    float     m_ufoCollisionRadius = 0.5f;
+    bool      m_hasPick            = false;
+    BvhHit    m_pickHit{};
+    glm::vec3 m_pickPosition{0.0f};
+    float     m_pickQueryTime = 0.0f;
+
+    // Screenshots and frame sequences, read back asynchronously (see FrameCapture)
+    FrameCapture m_frameCapture;
+    bool         m_takeScreenshot = false;
+    int          m_numScreenshots = 0;
+    int          m_numSequences   = 0;
 };
 
 int main()
 {
+    // Texture limits for machines with little video memory; textures that exceed them lose their top mip-map levels.
+    TextureBudget::global().setMaxResidentBytes(TEXTURE_BUDGET_BYTES);
+    TextureBudget::global().setMaxDimension(TextureClass::Material, MAX_MATERIAL_TEXTURE_SIZE);
+    TextureBudget::global().setMaxDimension(TextureClass::Terrain, MAX_TERRAIN_TEXTURE_SIZE);
+    TextureBudget::global().setMaxDimension(TextureClass::NormalMap, MAX_TERRAIN_TEXTURE_SIZE);
+
     Application app;
     app.update();
 
@@ -1,8 +1,23 @@
 #include "mesh.h"
 #include <framework/disable_all_warnings.h>
+#include <framework/frustum.h>
+#include <framework/hash.h>
+#include <framework/mesh_cache.h>
+#include <framework/render_state.h>
+#include <framework/thread_pool.h>
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <chrono>
 #include <iostream>
 #include <vector>
 
@@ -27,47 +42,214 @@ GPUMaterial::GPUMaterial(const Material& material)
     metallic  = derive_metallic_from_KsKd(material.ks, material.kd);
 }
 
-GPUMesh::GPUMesh(const Mesh& cpuMesh)
+// Octahedral mapping of a unit vector onto [-1, 1]^2 (Cigolle et al., "A Survey of Efficient Representations for
+// Independent Unit Vectors"); decoded by octDecode in shader_vert.glsl.
+static glm::vec2 octEncode(glm::vec3 n)
+{
+    const float l1Norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1Norm == 0.0f)
+        return glm::vec2(0.0f);
+    n /= l1Norm;
+    if (n.z >= 0.0f)
+        return glm::vec2(n.x, n.y);
+    const auto signNotZero = [](float v) { return v >= 0.0f ? 1.0f : -1.0f; };
+    return glm::vec2((1.0f - std::abs(n.y)) * signNotZero(n.x), (1.0f - std::abs(n.x)) * signNotZero(n.y));
+}
+
+static int16_t packSnorm16(float v)
+{
+    return static_cast<int16_t>(std::round(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint16_t packUnorm16(float v)
+{
+    return static_cast<uint16_t>(std::round(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+GPUMeshData::GPUMeshData(std::span<const Vertex> vertices, std::span<const glm::uvec3> triangles,
+                         const GPUMeshSettings& settings, std::span<const MeshLod> meshLods)
+{
+    if (settings.buildMeshlets)
+        meshlets = buildMeshlets(triangles, vertices);
+
+    std::vector<MeshLod> generatedLods;
+    if (meshLods.empty() && settings.generateLods)
+    {
+        generatedLods = generateLodChain(triangles, vertices);
+        meshLods      = generatedLods;
+    }
+    lods.push_back({0, static_cast<GLsizei>(3 * triangles.size()), 0.0f});
+    for (const MeshLod& lod : meshLods)
+    {
+        const GPUMeshLod& previous = lods.back();
+        lods.push_back({previous.firstIndex + previous.numIndices, static_cast<GLsizei>(3 * lod.triangles.size()),
+                        lod.error});
+    }
+
+    glm::vec3 aabbMin{std::numeric_limits<float>::max()}, aabbMax{std::numeric_limits<float>::lowest()};
+    for (const Vertex& vertex : vertices)
+    {
+        aabbMin = glm::min(aabbMin, vertex.position);
+        aabbMax = glm::max(aabbMax, vertex.position);
+    }
+    boundsMin = aabbMin;
+    boundsMax = aabbMax;
+    if (!vertices.empty())
+    {
+        boundsCenter = 0.5f * (aabbMin + aabbMax);
+        for (const Vertex& vertex : vertices)
+            boundsRadius = std::max(boundsRadius, glm::length(vertex.position - boundsCenter));
+    }
+
+    // Half floats have 10 mantissa bits, which is less than a texel of a 2K texture beyond 4.
+    const bool texCoordsFitHalf = std::all_of(std::begin(vertices), std::end(vertices), [](const Vertex& v)
+                                              { return std::abs(v.texCoord.x) <= 4.0f && std::abs(v.texCoord.y) <= 4.0f; });
+    vertexFormat = (settings.vertexFormat == VertexFormat::Packed && texCoordsFitHalf) ? VertexFormat::Packed
+                                                                                      : VertexFormat::Float;
+
+    if (vertexFormat == VertexFormat::Packed)
+    {
+        positionOffset = vertices.empty() ? glm::vec3(0.0f) : aabbMin;
+        positionScale  = vertices.empty() ? glm::vec3(0.0f) : aabbMax - aabbMin;
+
+        m_packedVertices.resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            const Vertex& vertex = vertices[i];
+            PackedVertex& packed = m_packedVertices[i];
+            for (int c = 0; c < 3; c++)
+                packed.position[c] = positionScale[c] > 0.0f
+                                         ? packUnorm16((vertex.position[c] - positionOffset[c]) / positionScale[c])
+                                         : 0;
+            const float bitangentSign =
+                glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.bitangent) < 0.0f ? 0.0f : 1.0f;
+            packed.position[3] = packUnorm16(bitangentSign);
+
+            const glm::vec2 normal  = octEncode(vertex.normal);
+            const glm::vec2 tangent = octEncode(vertex.tangent);
+            packed.normal[0]        = packSnorm16(normal.x);
+            packed.normal[1]        = packSnorm16(normal.y);
+            packed.tangent[0]       = packSnorm16(tangent.x);
+            packed.tangent[1]       = packSnorm16(tangent.y);
+            packed.texCoord[0]      = glm::packHalf1x16(vertex.texCoord.x);
+            packed.texCoord[1]      = glm::packHalf1x16(vertex.texCoord.y);
+        }
+        vertexBytes = std::as_bytes(std::span(m_packedVertices));
+    }
+    else
+    {
+        vertexBytes = std::as_bytes(vertices);
+    }
+
+    // Level 0 followed by the simplified levels.
+    std::vector<std::span<const glm::uvec3>> lodTriangles{triangles};
+    for (const MeshLod& lod : meshLods)
+        lodTriangles.push_back(lod.triangles);
+
+    if (vertices.size() <= std::numeric_limits<uint16_t>::max())
+    {
+        m_shortIndices.reserve(static_cast<size_t>(lods.back().firstIndex + lods.back().numIndices));
+        for (std::span<const glm::uvec3> levelTriangles : lodTriangles)
+        {
+            for (const glm::uvec3& triangle : levelTriangles)
+            {
+                for (int c = 0; c < 3; c++)
+                    m_shortIndices.push_back(static_cast<uint16_t>(triangle[c]));
+            }
+        }
+        indexBytes = std::as_bytes(std::span(m_shortIndices));
+        indexType  = GL_UNSIGNED_SHORT;
+    }
+    else if (meshLods.empty())
+    {
+        indexBytes = std::as_bytes(triangles);
+        indexType  = GL_UNSIGNED_INT;
+    }
+    else
+    {
+        for (std::span<const glm::uvec3> levelTriangles : lodTriangles)
+            m_triangles.insert(std::end(m_triangles), std::begin(levelTriangles), std::end(levelTriangles));
+        indexBytes = std::as_bytes(std::span(m_triangles));
+        indexType  = GL_UNSIGNED_INT;
+    }
+}
+
+GPUMesh::GPUMesh(const Mesh& cpuMesh, const GPUMeshSettings& settings)
+    : GPUMesh(cpuMesh.vertices, cpuMesh.triangles, cpuMesh.material, settings)
+{
+}
+
+GPUMesh::GPUMesh(const Mesh& cpuMesh, std::span<const MeshLod> lods, const GPUMeshSettings& settings)
+    : GPUMesh(GPUMeshData(cpuMesh.vertices, cpuMesh.triangles, settings, lods), cpuMesh.material, true)
+{
+}
+
+GPUMesh::GPUMesh(std::span<const Vertex> vertices, std::span<const glm::uvec3> triangles, const Material& material,
+                 const GPUMeshSettings& settings)
+    : GPUMesh(GPUMeshData(vertices, triangles, settings), material, true)
+{
+}
+
+GPUMesh::GPUMesh(const GPUMeshData& data, const Material& material, bool uploadData)
 {
     // Create uniform buffer to store mesh material (https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL)
-    GPUMaterial gpuMaterial(cpuMesh.material);
+    GPUMaterial gpuMaterial(material);
     glGenBuffers(1, &m_uboMaterial);
     glBindBuffer(GL_UNIFORM_BUFFER, m_uboMaterial);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(GPUMaterial), &gpuMaterial, GL_STATIC_READ);
 
     // Figure out if this mesh has texture coordinates
-    m_hasTextureCoords = static_cast<bool>(cpuMesh.material.kdTexture);
+    m_hasTextureCoords = material.kdTexture || !material.kdTexturePath.empty();
+
+    // Upload the diffuse texture; files that are shared between (sub)meshes are only decoded and uploaded once.
+    // GPUMeshLoad sets up the texture itself, so that it can upload it in slices as well.
+    if (uploadData && !material.kdTexturePath.empty())
+        m_kdTexture = TextureCache::global().load(material.kdTexturePath);
+    else if (uploadData && material.kdTexture)
+        m_kdTexture = std::make_shared<Texture>(*material.kdTexture);
 
     // Create VAO and bind it so subsequent creations of VBO and IBO are bound to this VAO
     glGenVertexArrays(1, &m_vao);
-    glBindVertexArray(m_vao);
+    RenderState::global().bindVertexArray(m_vao);
 
     // Create vertex buffer object (VBO)
     glGenBuffers(1, &m_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    glBufferData(GL_ARRAY_BUFFER,
-                 static_cast<GLsizeiptr>(cpuMesh.vertices.size() * sizeof(decltype(cpuMesh.vertices)::value_type)),
-                 cpuMesh.vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(data.vertexBytes.size()),
+                 uploadData ? data.vertexBytes.data() : nullptr, GL_STATIC_DRAW);
 
     // Create index buffer object (IBO)
     glGenBuffers(1, &m_ibo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 static_cast<GLsizeiptr>(cpuMesh.triangles.size() * sizeof(decltype(cpuMesh.triangles)::value_type)),
-                 cpuMesh.triangles.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(data.indexBytes.size()),
+                 uploadData ? data.indexBytes.data() : nullptr, GL_STATIC_DRAW);
 
-    // Tell OpenGL that we will be using vertex attributes 0, 1 and 2.
+    // Tell OpenGL that we will be using vertex attributes 0 to 4.
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
     glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
     // We tell OpenGL what each vertex looks like and how they are mapped to the shader (location = ...).
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, bitangent));
+    if (data.vertexFormat == VertexFormat::Packed)
+    {
+        // The bitangent is reconstructed in the shader, so attribute 4 keeps its default (constant) value.
+        glDisableVertexAttribArray(4);
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+                              (void*)offsetof(PackedVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                              (void*)offsetof(PackedVertex, texCoord));
+        glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, tangent));
+    }
+    else
+    {
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, bitangent));
+    }
     // Reuse all attributes for each instance
     glVertexAttribDivisor(0, 0);
     glVertexAttribDivisor(1, 0);
@@ -76,7 +258,16 @@ GPUMesh::GPUMesh(const Mesh& cpuMesh)
     glVertexAttribDivisor(4, 0);
 
     // Each triangle has 3 vertices.
-    m_numIndices = static_cast<GLsizei>(3 * cpuMesh.triangles.size());
+    m_indexType      = data.indexType;
+    m_packedVertices = data.vertexFormat == VertexFormat::Packed;
+    m_positionOffset = data.positionOffset;
+    m_positionScale  = data.positionScale;
+    m_meshlets       = data.meshlets;
+    m_lods           = data.lods;
+    m_boundsCenter   = data.boundsCenter;
+    m_boundsRadius   = data.boundsRadius;
+    m_boundsMin      = data.boundsMin;
+    m_boundsMax      = data.boundsMax;
 }
 
 GPUMesh::GPUMesh(GPUMesh&& other)
@@ -95,50 +286,179 @@ GPUMesh& GPUMesh::operator=(GPUMesh&& other)
     return *this;
 }
 
-std::vector<GPUMesh> GPUMesh::loadMeshGPU(std::filesystem::path filePath, bool normalize)
+std::vector<GPUMesh> GPUMesh::loadMeshGPU(std::filesystem::path filePath, bool normalize,
+                                          const GPUMeshSettings& gpuSettings)
 {
     if (!std::filesystem::exists(filePath))
         throw MeshLoadingException(fmt::format("File {} does not exist", filePath.string().c_str()));
 
-    // Generate GPU-side meshes for all sub-meshes
-    std::vector<Mesh>    subMeshes = loadMesh(filePath, {.normalizeVertexPositions = normalize});
+    // The textures are loaded from their paths by TextureCache, which only decodes them if they have neither a baked
+    // copy nor a cached mip chain.
+    const LoadMeshSettings settings{
+        .normalizeVertexPositions = normalize, .optimizeMeshes = true, .decodeTextures = false};
     std::vector<GPUMesh> gpuMeshes;
+
+    // Upload straight from the memory-mapped mesh cache if it is up to date; this skips both the OBJ parse and the
+    // copy into std::vector<Mesh>.
+    if (auto cache = MeshCache::load(filePath, MeshCache::computeSourceHash(filePath, settings)))
+    {
+        for (const MeshCache::SubMesh& subMesh : cache->subMeshes())
+        {
+            gpuMeshes.emplace_back(subMesh.vertices, subMesh.triangles, subMesh.material, gpuSettings);
+        }
+        return gpuMeshes;
+    }
+
+    // Generate GPU-side meshes for all sub-meshes (this also writes the cache for the next run).
+    std::vector<Mesh> subMeshes = loadMesh(filePath, settings);
     for (const Mesh& mesh : subMeshes)
     {
-        gpuMeshes.emplace_back(mesh);
+        gpuMeshes.emplace_back(mesh, gpuSettings);
     }
 
     return gpuMeshes;
 }
 
+GPUMeshLoad GPUMesh::loadMeshGPUAsync(std::filesystem::path filePath, bool normalize, const GPUMeshSettings& settings)
+{
+    if (!std::filesystem::exists(filePath))
+        throw MeshLoadingException(fmt::format("File {} does not exist", filePath.string().c_str()));
+
+    return GPUMeshLoad(std::move(filePath), normalize, settings);
+}
+
 bool GPUMesh::hasTextureCoords() const
 {
     return m_hasTextureCoords;
 }
 
 void GPUMesh::draw(const Shader& drawingShader, bool bindMaterial)
+{
+    bind(drawingShader, bindMaterial);
+
+    // Draw the mesh's triangles
+    const GPUMeshLod& lod = m_lods[m_lodLevel];
+    glDrawElements(GL_TRIANGLES, lod.numIndices, m_indexType, indexOffset(lod.firstIndex));
+}
+
+size_t GPUMesh::drawVisible(const Shader& drawingShader, const glm::mat4& mvpMatrix, const glm::mat4& modelMatrix,
+                            const glm::vec3& viewPos, bool cullBackfacing, bool bindMaterial)
+{
+    // Cull in object space, where the meshlet bounds are defined.
+    const Frustum frustum{mvpMatrix};
+    if (m_meshlets.empty() || m_lodLevel != 0)
+    {
+        // The meshlets only cover level 0; coarser levels are cheap enough to be culled as a whole.
+        if (frustum.intersectsSphere(m_boundsCenter, m_boundsRadius))
+            draw(drawingShader, bindMaterial);
+        return 0;
+    }
+
+    const glm::vec3 objectViewPos = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(viewPos, 1.0f));
+
+    // Merge consecutive visible meshlets into a single range.
+    size_t numVisible          = 0;
+    bool   extendPreviousRange = false;
+    m_drawCounts.clear();
+    m_drawOffsets.clear();
+    for (const Meshlet& meshlet : m_meshlets)
+    {
+        const bool visible = frustum.intersectsSphere(meshlet.center, meshlet.radius) &&
+                             !(cullBackfacing && isMeshletBackfacing(meshlet, objectViewPos));
+        if (visible && extendPreviousRange)
+        {
+            m_drawCounts.back() += static_cast<GLsizei>(3 * meshlet.numTriangles);
+        }
+        else if (visible)
+        {
+            m_drawCounts.push_back(static_cast<GLsizei>(3 * meshlet.numTriangles));
+            m_drawOffsets.push_back(indexOffset(static_cast<GLsizei>(3 * meshlet.firstTriangle)));
+        }
+        numVisible += visible;
+        extendPreviousRange = visible;
+    }
+    if (m_drawCounts.empty())
+        return 0;
+
+    bind(drawingShader, bindMaterial);
+    glMultiDrawElements(GL_TRIANGLES, m_drawCounts.data(), m_indexType, m_drawOffsets.data(),
+                        static_cast<GLsizei>(m_drawCounts.size()));
+    return numVisible;
+}
+
+void GPUMesh::selectLod(const glm::mat4& modelMatrix, const LodSelection& selection)
+{
+    // A coarser level must have at most this fraction of the allowed error to be selected.
+    constexpr float lodHysteresis = 0.75f;
+
+    if (m_lods.size() <= 1)
+        return;
+
+    // Distance to the closest point of the bounding sphere, using the largest scale factor of the model matrix.
+    const float scale = std::max({glm::length(glm::vec3(modelMatrix[0])), glm::length(glm::vec3(modelMatrix[1])),
+                                  glm::length(glm::vec3(modelMatrix[2]))});
+    const glm::vec3 center   = glm::vec3(modelMatrix * glm::vec4(m_boundsCenter, 1.0f));
+    const float     distance = std::max(glm::length(center - selection.viewPos) - scale * m_boundsRadius, 1e-3f);
+    const auto      pixelError = [&](size_t level)
+    { return m_lods[level].error * scale * selection.pixelsPerUnit / distance; };
+
+    while (m_lodLevel > 0 && pixelError(m_lodLevel) > selection.maxPixelError)
+        m_lodLevel--;
+    while (m_lodLevel + 1 < m_lods.size() && pixelError(m_lodLevel + 1) <= lodHysteresis * selection.maxPixelError)
+        m_lodLevel++;
+}
+
+uint32_t GPUMesh::materialId() const
+{
+    return uint32_t(hashMix(reinterpret_cast<uintptr_t>(m_kdTexture.get())));
+}
+
+const void* GPUMesh::indexOffset(GLsizei index) const
+{
+    const size_t indexSize = m_indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    return reinterpret_cast<const void*>(static_cast<size_t>(index) * indexSize);
+}
+
+void GPUMesh::bind(const Shader& drawingShader, bool bindMaterial)
 {
     // Bind material data uniform (we assume that the uniform buffer objects is always called 'Material')
     // Yes, we could define the binding inside the shader itself, but that would break on OpenGL versions below 4.2
     if (bindMaterial)
+    {
         drawingShader.bindUniformBlock("Material", 0, m_uboMaterial);
+        if (m_kdTexture)
+            m_kdTexture->bind(GL_TEXTURE0 + DIFFUSE_TEXTURE_UNIT);
+    }
 
-    // Draw the mesh's triangles
-    glBindVertexArray(m_vao);
-    glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, nullptr);
+    // Tell the vertex shader how to decode the vertices (positions of unpacked meshes are passed through as is)
+    drawingShader.setUniform("packedVertices", m_packedVertices);
+    drawingShader.setUniform("positionOffset", m_positionOffset);
+    drawingShader.setUniform("positionScale", m_positionScale);
+
+    RenderState::global().bindVertexArray(m_vao);
 }
 
 void GPUMesh::moveInto(GPUMesh&& other)
 {
     freeGpuMemory();
-    m_numIndices       = other.m_numIndices;
+    m_indexType        = other.m_indexType;
     m_hasTextureCoords = other.m_hasTextureCoords;
+    m_packedVertices   = other.m_packedVertices;
+    m_positionOffset   = other.m_positionOffset;
+    m_positionScale    = other.m_positionScale;
     m_ibo              = other.m_ibo;
     m_vbo              = other.m_vbo;
     m_vao              = other.m_vao;
     m_uboMaterial      = other.m_uboMaterial;
+    m_kdTexture        = std::move(other.m_kdTexture);
+    m_meshlets         = std::move(other.m_meshlets);
+    m_lods             = std::move(other.m_lods);
+    m_lodLevel         = other.m_lodLevel;
+    m_boundsCenter     = other.m_boundsCenter;
+    m_boundsRadius     = other.m_boundsRadius;
+    m_boundsMin        = other.m_boundsMin;
+    m_boundsMax        = other.m_boundsMax;
 
-    other.m_numIndices       = 0;
     other.m_hasTextureCoords = other.m_hasTextureCoords;
     other.m_ibo              = INVALID;
     other.m_vbo              = INVALID;
@@ -149,11 +469,132 @@ void GPUMesh::moveInto(GPUMesh&& other)
 void GPUMesh::freeGpuMemory()
 {
     if (m_vao != INVALID)
+    {
+        RenderState::global().forgetVertexArray(m_vao);
         glDeleteVertexArrays(1, &m_vao);
+    }
     if (m_vbo != INVALID)
         glDeleteBuffers(1, &m_vbo);
     if (m_ibo != INVALID)
         glDeleteBuffers(1, &m_ibo);
     if (m_uboMaterial != INVALID)
         glDeleteBuffers(1, &m_uboMaterial);
+}
+
+GPUMeshLoad::GPUMeshLoad(std::filesystem::path filePath, bool normalize, const GPUMeshSettings& settings)
+{
+    // The vertices are converted to their GPU layout and the mip levels of the material textures are prepared (mapped
+    // from the caches, or decoded and filtered) here as well, so only the GL uploads are left for the render thread.
+    // Which block formats the GPU supports has to be queried on this thread, which owns the OpenGL context.
+    m_loading = ThreadPool::global().submit(
+        [filePath = std::move(filePath), normalize, settings, supportedFormats = supportedBlockFormats()]()
+        {
+            // TextureLevels::prepare() below decodes the textures, and only those without a baked copy or mip cache.
+            std::vector<Mesh> cpuMeshes = loadMesh(
+                filePath, {.normalizeVertexPositions = normalize, .optimizeMeshes = true, .decodeTextures = false});
+            LoadResult out;
+            if (settings.buildBvh)
+                out.pBvh = std::make_unique<Bvh>(cpuMeshes);
+            std::map<std::filesystem::path, std::shared_ptr<const TextureLevels>> textures;
+            for (Mesh& cpuMesh : cpuMeshes)
+            {
+                auto pPending = std::make_unique<PendingMesh>(std::move(cpuMesh), settings);
+                const auto& texturePath = pPending->cpuMesh.material.kdTexturePath;
+                if (!texturePath.empty())
+                {
+                    auto& pLevels = textures[texturePath];
+                    if (!pLevels)
+                        pLevels = std::make_shared<const TextureLevels>(
+                            TextureLevels::prepare(texturePath, {}, supportedFormats));
+                    pPending->pKdTexture = pLevels;
+                }
+                out.pendingMeshes.push_back(std::move(pPending));
+            }
+            return out;
+        });
+}
+
+void GPUMeshLoad::update(size_t uploadBudget)
+{
+    if (m_loading.valid())
+    {
+        if (m_loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        LoadResult result = m_loading.get();
+        m_pendingMeshes   = std::move(result.pendingMeshes);
+        m_pBvh            = std::move(result.pBvh);
+        m_gpuMeshes.reserve(m_pendingMeshes.size());
+    }
+
+    while (m_gpuMeshes.size() < m_pendingMeshes.size() && uploadBudget > 0)
+    {
+        auto&              pPending    = m_pendingMeshes[m_gpuMeshes.size()];
+        const GPUMeshData& gpuData     = pPending->gpuData;
+        const auto&        texturePath = pPending->cpuMesh.material.kdTexturePath;
+        if (!m_pUploading)
+        {
+            m_pUploading   = std::unique_ptr<GPUMesh>(new GPUMesh(gpuData, pPending->cpuMesh.material, false));
+            m_uploadOffset = 0;
+            // A texture that is shared with an earlier sub-mesh (or another model) is only uploaded once. It is only
+            // added to the cache once it is complete, so nothing ever samples a partially uploaded texture.
+            if (pPending->pKdTexture)
+            {
+                m_pUploading->m_kdTexture = TextureCache::global().find(texturePath);
+                if (!m_pUploading->m_kdTexture)
+                {
+                    m_pUploadingTexture =
+                        std::make_shared<Texture>(*pPending->pKdTexture, TextureClass::Material, false);
+                    m_pUploading->m_kdTexture = m_pUploadingTexture;
+                }
+            }
+        }
+
+        // Fill the buffers with glBufferSubData in slices; GL_COPY_WRITE_BUFFER is used so that neither the vertex
+        // array bindings nor the element buffer of the currently bound VAO are disturbed.
+        const auto   vertexBytes = gpuData.vertexBytes;
+        const auto   indexBytes  = gpuData.indexBytes;
+        const size_t bufferSize  = vertexBytes.size() + indexBytes.size();
+        const size_t uploadSize =
+            bufferSize + (m_pUploadingTexture ? m_pUploadingTexture->uploadSize(*pPending->pKdTexture) : 0);
+        while (m_uploadOffset < uploadSize && uploadBudget > 0)
+        {
+            if (m_uploadOffset >= bufferSize)
+            {
+                // Whole rows of texels are uploaded, so the last slice may exceed the budget a little.
+                const size_t sliceSize =
+                    m_pUploadingTexture->uploadSlice(*pPending->pKdTexture, m_uploadOffset - bufferSize, uploadBudget);
+                m_uploadOffset += sliceSize;
+                uploadBudget -= std::min(sliceSize, uploadBudget);
+                continue;
+            }
+
+            const bool isVertexData = m_uploadOffset < vertexBytes.size();
+            const auto bytes        = isVertexData ? vertexBytes : indexBytes;
+            const auto offset       = isVertexData ? m_uploadOffset : m_uploadOffset - vertexBytes.size();
+            const auto sliceSize    = std::min(uploadBudget, bytes.size() - offset);
+
+            glBindBuffer(GL_COPY_WRITE_BUFFER, isVertexData ? m_pUploading->m_vbo : m_pUploading->m_ibo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(sliceSize),
+                            bytes.data() + offset);
+            m_uploadOffset += sliceSize;
+            uploadBudget -= sliceSize;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        if (m_uploadOffset == uploadSize)
+        {
+            if (m_pUploadingTexture)
+                TextureCache::global().insert(texturePath, m_pUploadingTexture);
+            m_pUploadingTexture.reset();
+            m_gpuMeshes.push_back(std::move(*m_pUploading));
+            m_pUploading.reset();
+            // The CPU copies (including the decoded texture) are no longer needed.
+            pPending.reset();
+        }
+    }
+}
+
+bool GPUMeshLoad::isReady() const
+{
+    return !m_loading.valid() && m_gpuMeshes.size() == m_pendingMeshes.size() && !m_pUploading;
 }
\ No newline at end of file
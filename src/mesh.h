@@ -1,15 +1,26 @@
 #pragma once
 
+#include <framework/bvh.h>
 #include <framework/disable_all_warnings.h>
 #include <framework/mesh.h>
+#include <framework/mesh_simplifier.h>
+#include <framework/meshlet.h>
 #include <framework/shader.h>
+#include "texture.h"
 DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
 
 #include <framework/opengl_includes.h>
 #include <exception>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <future>
+#include <memory>
+#include <span>
+#include <vector>
 
 struct MeshLoadingException : public std::runtime_error
 {
@@ -30,10 +41,103 @@ struct GPUMaterial
     float metallic{0.0f};
 };
 
+enum class VertexFormat
+{
+    // Vertex as is (56 bytes): float positions, normals, texture coordinates, tangents and bitangents.
+    Float,
+    // PackedVertex (20 bytes). Half float texture coordinates are only precise enough for meshes whose texture
+    // coordinates stay within [-4, 4]; other meshes fall back to VertexFormat::Float.
+    Packed
+};
+
+struct PackedVertex
+{
+    // xyz: position relative to the bounding box of the mesh (unorm16), w: sign of the bitangent (0 = -1, 1 = +1).
+    uint16_t position[4];
+    // Octahedral encoding of the unit normal and tangent (snorm16); the bitangent is sign * cross(normal, tangent).
+    int16_t  normal[2];
+    int16_t  tangent[2];
+    // Half floats.
+    uint16_t texCoord[2];
+};
+
+struct GPUMeshSettings
+{
+    VertexFormat vertexFormat{VertexFormat::Float};
+    // Split the mesh into meshlets (see framework/meshlet.h) so that drawVisible() can cull parts of it.
+    bool buildMeshlets{false};
+    // Simplify the mesh into a chain of levels of detail (see framework/mesh_simplifier.h) for GPUMesh::selectLod.
+    bool generateLods{false};
+    // Build a BVH (see framework/bvh.h) over all sub-meshes for picking and collision; see GPUMeshLoad::bvh().
+    // Only supported by loadMeshGPUAsync.
+    bool buildBvh{false};
+};
+
+// Range of the index buffer that holds one level of detail; level 0 is the original mesh.
+struct GPUMeshLod
+{
+    GLsizei firstIndex;
+    GLsizei numIndices;
+    // Simplification error in mesh units.
+    float error;
+};
+
+// Parameters of the screen-space error based level of detail selection (see GPUMesh::selectLod).
+struct LodSelection
+{
+    glm::vec3 viewPos;
+    // Size in pixels of one unit at a distance of one unit: projectionMatrix[1][1] * viewportHeight / 2.
+    float pixelsPerUnit;
+    float maxPixelError{1.0f};
+};
+
+// Vertex and index buffer contents of a GPUMesh in the layout in which they are uploaded.
+// Indices are stored as 16-bit integers when the mesh has fewer than 65536 vertices.
+struct GPUMeshData
+{
+   public:
+    // Levels of detail are either passed in (meshLods) or generated if GPUMeshSettings::generateLods is set.
+    GPUMeshData(std::span<const Vertex> vertices, std::span<const glm::uvec3> triangles,
+                const GPUMeshSettings& settings, std::span<const MeshLod> meshLods = {});
+    GPUMeshData(const GPUMeshData&) = delete;
+    GPUMeshData(GPUMeshData&&)      = default;
+
+    // Point into the spans passed to the constructor if no conversion was needed (so that, for example, a
+    // memory-mapped mesh cache is uploaded without a copy) and into the converted data otherwise.
+    std::span<const std::byte> vertexBytes;
+    std::span<const std::byte> indexBytes;
+
+    VertexFormat vertexFormat;
+    GLenum       indexType;
+    // Packed positions are decoded as positionOffset + positionScale * position.
+    glm::vec3 positionOffset{0.0f};
+    glm::vec3 positionScale{1.0f};
+    // Bounding sphere and axis aligned bounding box of the vertices; the box is empty (min > max) without vertices.
+    glm::vec3 boundsCenter{0.0f};
+    float     boundsRadius{0.0f};
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    // Empty unless GPUMeshSettings::buildMeshlets is set; refers to the triangles of level 0.
+    std::vector<Meshlet> meshlets;
+    // All levels share the vertex buffer and are stored one after the other in the index buffer.
+    std::vector<GPUMeshLod> lods;
+
+   private:
+    std::vector<PackedVertex> m_packedVertices;
+    std::vector<uint16_t>     m_shortIndices;
+    std::vector<glm::uvec3>   m_triangles;
+};
+
+class GPUMeshLoad;
+
 class GPUMesh
 {
    public:
-    GPUMesh(const Mesh& cpuMesh);
+    GPUMesh(const Mesh& cpuMesh, const GPUMeshSettings& settings = {});
+    GPUMesh(std::span<const Vertex> vertices, std::span<const glm::uvec3> triangles, const Material& material,
+            const GPUMeshSettings& settings = {});
+    // Uses the given levels of detail (which must index the vertices of cpuMesh) instead of generating them.
+    GPUMesh(const Mesh& cpuMesh, std::span<const MeshLod> lods, const GPUMeshSettings& settings = {});
     // Cannot copy a GPU mesh because it would require reference counting of GPU resources.
     GPUMesh(const GPUMesh&) = delete;
     GPUMesh(GPUMesh&&);
@@ -41,7 +145,12 @@ class GPUMesh
 
     // Generate a number of GPU meshes from a particular model file.
     // Multiple meshes may be generated if there are multiple sub-meshes in the file
-    static std::vector<GPUMesh> loadMeshGPU(std::filesystem::path filePath, bool normalize = false);
+    static std::vector<GPUMesh> loadMeshGPU(std::filesystem::path filePath, bool normalize = false,
+                                            const GPUMeshSettings& settings = {});
+    // Same as loadMeshGPU, but returns immediately: the file is parsed and the levels of its textures are prepared
+    // (see TextureLevels) on a worker thread, and the result is uploaded in slices by GPUMeshLoad::update().
+    static GPUMeshLoad loadMeshGPUAsync(std::filesystem::path filePath, bool normalize = false,
+                                        const GPUMeshSettings& settings = {});
 
     // Cannot copy a GPU mesh because it would require reference counting of GPU resources.
     GPUMesh& operator=(const GPUMesh&) = delete;
@@ -49,22 +158,126 @@ class GPUMesh
 
     bool hasTextureCoords() const;
 
-    // Bind VAO and call glDrawElements.
+    // Texture unit that draw() binds the diffuse texture (map_Kd) of the material to.
+    static constexpr GLint DIFFUSE_TEXTURE_UNIT = 1;
+
+    // Bind VAO (and the material's diffuse texture if bindMaterial is set) and call glDrawElements.
+    // Also sets the vertex decoding uniforms (packedVertices, positionOffset, positionScale) of drawingShader.
     void draw(const Shader& drawingShader, bool bindMaterial = true);
+    // Same as draw(), but only draws the meshlets whose bounding sphere intersects the view frustum of mvpMatrix
+    // and, if cullBackfacing is set, that are not entirely back-facing as seen from viewPos (in world space).
+    // Meshes without meshlets and levels of detail other than 0 are only culled as a whole. Returns the number of
+    // meshlets that were drawn.
+    size_t drawVisible(const Shader& drawingShader, const glm::mat4& mvpMatrix, const glm::mat4& modelMatrix,
+                       const glm::vec3& viewPos, bool cullBackfacing, bool bindMaterial = true);
+
+    size_t numMeshlets() const { return m_meshlets.size(); }
+
+    // Choose the coarsest level of detail whose error projects to at most selection.maxPixelError pixels on screen;
+    // draw() and drawVisible() use it until the next call. Moving to a coarser level requires some margin below the
+    // threshold so that the level does not flicker back and forth when the error is close to it.
+    void   selectLod(const glm::mat4& modelMatrix, const LodSelection& selection);
+    size_t lodLevel() const { return m_lodLevel; }
+    size_t numLods() const { return m_lods.size(); }
 
     GLuint getVAO() const { return m_vao; }
+    // Center of the bounding sphere in the space of the mesh, e.g. to sort draws by their distance to the viewer.
+    const glm::vec3& boundsCenter() const { return m_boundsCenter; }
+    // Axis aligned bounding box in the space of the mesh, e.g. for frustum culling (see framework/frustum.h).
+    const glm::vec3& boundsMin() const { return m_boundsMin; }
+    const glm::vec3& boundsMax() const { return m_boundsMax; }
+    // Equal for meshes that bind the same diffuse texture, so that draws can be grouped by material.
+    uint32_t materialId() const;
 
    private:
+    friend class GPUMeshLoad;
+    // Allocates the vertex and index buffers; they are left uninitialized, and the diffuse texture is not loaded,
+    // unless uploadData is set.
+    GPUMesh(const GPUMeshData& data, const Material& material, bool uploadData);
+
+    // Bind material, vertex decoding uniforms and VAO for drawing.
+    void bind(const Shader& drawingShader, bool bindMaterial);
+    // Byte offset of the given index in the index buffer.
+    const void* indexOffset(GLsizei index) const;
     void moveInto(GPUMesh&&);
     void freeGpuMemory();
 
    private:
     static constexpr GLuint INVALID = 0xFFFFFFFF;
 
-    GLsizei m_numIndices{0};
-    bool    m_hasTextureCoords{false};
-    GLuint  m_ibo{INVALID};
-    GLuint  m_vbo{INVALID};
-    GLuint  m_vao{INVALID};
-    GLuint  m_uboMaterial{INVALID};
+    GLenum    m_indexType{GL_UNSIGNED_INT};
+    bool      m_hasTextureCoords{false};
+    bool      m_packedVertices{false};
+    glm::vec3 m_positionOffset{0.0f};
+    glm::vec3 m_positionScale{1.0f};
+    GLuint    m_ibo{INVALID};
+    GLuint    m_vbo{INVALID};
+    GLuint    m_vao{INVALID};
+    GLuint    m_uboMaterial{INVALID};
+    // Shared with every other mesh that uses the same texture file (see TextureCache).
+    std::shared_ptr<Texture> m_kdTexture;
+
+    std::vector<GPUMeshLod> m_lods;
+    size_t                  m_lodLevel{0};
+    glm::vec3               m_boundsCenter{0.0f};
+    float                   m_boundsRadius{0.0f};
+    glm::vec3               m_boundsMin{0.0f};
+    glm::vec3               m_boundsMax{0.0f};
+
+    std::vector<Meshlet> m_meshlets;
+    // Scratch space of drawVisible() for the ranges passed to glMultiDrawElements.
+    std::vector<GLsizei>     m_drawCounts;
+    std::vector<const void*> m_drawOffsets;
+};
+
+// Future-like handle to a model that is loaded in the background by GPUMesh::loadMeshGPUAsync.
+// Sub-meshes become available one by one as their upload completes; until then nothing is drawn for them.
+class GPUMeshLoad
+{
+   public:
+    GPUMeshLoad() = default;
+    GPUMeshLoad(std::filesystem::path filePath, bool normalize, const GPUMeshSettings& settings);
+
+    // Upload at most uploadBudget bytes of vertex, index and texture data. Must be called from the thread that owns the OpenGL
+    // context, typically once per frame. Rethrows any exception that occurred while loading the file.
+    void update(size_t uploadBudget);
+
+    // True once every sub-mesh has been uploaded.
+    bool isReady() const;
+    // Sub-meshes that have been fully uploaded so far.
+    std::span<GPUMesh> meshes() { return m_gpuMeshes; }
+    // BVH over the sub-meshes (in the space of the model file) if GPUMeshSettings::buildBvh was set. Available once
+    // the file has been parsed, which may be before all sub-meshes have been uploaded; nullptr until then.
+    const Bvh* bvh() const { return m_pBvh.get(); }
+
+   private:
+    // Sub-mesh converted to its GPU layout on the worker thread; gpuData may point into cpuMesh.
+    struct PendingMesh
+    {
+        PendingMesh(Mesh&& mesh, const GPUMeshSettings& settings)
+            : cpuMesh(std::move(mesh)), gpuData(cpuMesh.vertices, cpuMesh.triangles, settings)
+        {
+        }
+
+        Mesh        cpuMesh;
+        GPUMeshData gpuData;
+        // Levels of the diffuse texture (if any), shared by the sub-meshes that use the same file.
+        std::shared_ptr<const TextureLevels> pKdTexture;
+    };
+
+    struct LoadResult
+    {
+        std::vector<std::unique_ptr<PendingMesh>> pendingMeshes;
+        std::unique_ptr<Bvh>                      pBvh;
+    };
+
+    std::future<LoadResult>                   m_loading;
+    std::vector<std::unique_ptr<PendingMesh>> m_pendingMeshes;
+    std::vector<GPUMesh>                      m_gpuMeshes;
+    std::unique_ptr<Bvh>                      m_pBvh;
+    // Sub-mesh m_gpuMeshes.size() whose buffers are being filled and the number of bytes uploaded so far
+    // (vertex data first, followed by the index data and the diffuse texture, if it is not loaded already).
+    std::unique_ptr<GPUMesh> m_pUploading;
+    std::shared_ptr<Texture> m_pUploadingTexture;
+    size_t                   m_uploadOffset{0};
 };
\ No newline at end of file
@@ -3,30 +3,58 @@
 #include <vector>
 
 #include "glad/glad.h"
-#include "stb/stb_image.h"
+#include <framework/image_cache.h>
+#include <framework/render_state.h>
+
+#include "texture.h"
 
 unsigned int Skybox::loadCubemap(const std::vector<std::string>& faces)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    RenderState::global().bindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+
+    // Baked copies are only used if every face has one, so that all faces share the same format.
+    std::vector<CompressedTexture> compressedFaces;
+    for (const std::string& face : faces)
+    {
+        auto compressedFace = loadCompressedTexture(face);
+        if (!compressedFace || (!compressedFaces.empty() && compressedFace->format() != compressedFaces[0].format()))
+            break;
+        compressedFaces.push_back(std::move(*compressedFace));
+    }
+    if (compressedFaces.size() == faces.size())
+    {
+        // The cube map is not mip-mapped (see setCubemapParameters()), so only the full-resolution level is needed.
+        for (unsigned int i = 0; i < faces.size(); ++i)
+        {
+            const CompressedTexture& face = compressedFaces[i];
+            glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, face.glInternalFormat(), face.width(),
+                                   face.height(), 0, static_cast<GLsizei>(face.levels()[0].size()),
+                                   face.levels()[0].data());
+        }
+        setCubemapParameters();
+        return textureID;
+    }
 
-    int width, height, nrChannels;
+    // Decode all faces concurrently; only the uploads below happen on this thread.
+    std::vector<ImageCache::ImageFuture> decodedFaces;
+    for (const std::string& face : faces)
+        decodedFaces.push_back(ImageCache::global().loadAsync(face));
 
     for (unsigned int i = 0; i < faces.size(); ++i)
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
+        try
         {
-            GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, static_cast<GLint>(format), width, height, 0, format,
-                         GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            // Decodes the face right here if no worker has picked it up yet.
+            const auto pImage = ImageCache::global().load(faces[i]);
+            GLenum     format = (pImage->channels == 4) ? GL_RGBA : GL_RGB;
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, static_cast<GLint>(format), pImage->width,
+                         pImage->height, 0, format, GL_UNSIGNED_BYTE, pImage->get_data());
         }
-        else
+        catch (const std::exception&)
         {
             std::cerr << "Failed to load skybox texture: " << faces[i] << std::endl;
-            stbi_image_free(data);
         }
     }
 
@@ -58,7 +86,7 @@ unsigned int Skybox::createSkyboxVAO()
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
+    RenderState::global().bindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
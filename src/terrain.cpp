@@ -1,48 +1,8 @@
 #include "terrain.h"
+#include <framework/mesh_optimizer.h>
 #include <cmath>
 #include <iostream>
 
-static void accumulateTangents(Mesh& mesh)
-{
-    for (auto& v : mesh.vertices)
-    {
-        v.tangent   = glm::vec3(0);
-        v.bitangent = glm::vec3(0);
-    }
-
-    for (auto& tri : mesh.triangles)
-    {
-        Vertex& v0 = mesh.vertices[tri[0]];
-        Vertex& v1 = mesh.vertices[tri[1]];
-        Vertex& v2 = mesh.vertices[tri[2]];
-
-        glm::vec3 p0 = v0.position, p1 = v1.position, p2 = v2.position;
-        glm::vec2 uv0 = v0.texCoord, uv1 = v1.texCoord, uv2 = v2.texCoord;
-
-        glm::vec3 dp1 = p1 - p0, dp2 = p2 - p0;
-        glm::vec2 duv1 = uv1 - uv0, duv2 = uv2 - uv0;
-
-        float     r = 1.0f / (duv1.x * duv2.y - duv1.y * duv2.x + 1e-20f);
-        glm::vec3 T = (dp1 * duv2.y - dp2 * duv1.y) * r;
-        glm::vec3 B = (dp2 * duv1.x - dp1 * duv2.x) * r;
-
-        v0.tangent += T;
-        v1.tangent += T;
-        v2.tangent += T;
-        v0.bitangent += B;
-        v1.bitangent += B;
-        v2.bitangent += B;
-    }
-    for (auto& v : mesh.vertices)
-    {
-        glm::vec3 n = glm::normalize(v.normal);
-        glm::vec3 t = glm::normalize(v.tangent - n * glm::dot(n, v.tangent));
-        glm::vec3 b = glm::normalize(glm::cross(n, t));
-        v.tangent   = t;
-        v.bitangent = b;
-    }
-}
-
 Terrain::Terrain(TerrainParameters params)
     : m_subdivisions(params.subdivisions),
       m_tileSize(params.tileSize),
@@ -63,16 +23,24 @@ void Terrain::update(const glm::vec3& cameraPos)
     {
         loadTiles(cameraTileX, cameraTileZ);
         unloadTiles(cameraTileX, cameraTileZ);
+        // Tiles are created in world space.
+        m_tileBounds.clear();
+        for (const auto& pair : m_tiles)
+            m_tileBounds.push_back(pair.second->boundsMin(), pair.second->boundsMax());
         m_lastCameraTileX = cameraTileX;
         m_lastCameraTileZ = cameraTileZ;
         m_generated       = true;
     }
 }
 
-void Terrain::render(const Shader& shader)
+void Terrain::render(const Shader& shader, const LodSelection& lodSelection, std::span<const uint8_t> visibleTiles)
 {
+    size_t tileIndex = 0;
     for (auto& pair : m_tiles)
     {
+        if (!visibleTiles[tileIndex++])
+            continue;
+        pair.second->selectLod(glm::mat4(1.0f), lodSelection);
         pair.second->draw(shader);
     }
 }
@@ -85,6 +53,41 @@ void Terrain::setParameters(TerrainParameters params)
     m_textureScale   = params.textureScale;
     m_generated      = false;
     m_tiles.clear();
+    m_tileBounds.clear();
+    m_tileTriangles.clear();
+    m_tileVertexRemap.clear();
+    m_tileLods.clear();
+}
+
+void Terrain::optimizeTileTopology()
+{
+    const size_t numVertices = size_t(m_subdivisions) * size_t(m_subdivisions);
+
+    // Row-major grid triangles; this order is poor for the post-transform vertex cache.
+    m_tileTriangles.clear();
+    for (int z = 0; z < m_subdivisions - 1; z++)
+    {
+        for (int x = 0; x < m_subdivisions - 1; x++)
+        {
+            int topLeft     = z * m_subdivisions + x;
+            int topRight    = topLeft + 1;
+            int bottomLeft  = (z + 1) * m_subdivisions + x;
+            int bottomRight = bottomLeft + 1;
+
+            m_tileTriangles.emplace_back(topLeft, bottomLeft, topRight);
+            m_tileTriangles.emplace_back(topRight, bottomLeft, bottomRight);
+        }
+    }
+
+    const VertexCacheStatistics before = analyzeVertexCache(m_tileTriangles, numVertices);
+    optimizeVertexCache(m_tileTriangles, numVertices);
+    m_tileVertexRemap = computeVertexFetchRemap(m_tileTriangles, numVertices);
+    for (auto& tri : m_tileTriangles)
+        tri = glm::uvec3(m_tileVertexRemap[tri.x], m_tileVertexRemap[tri.y], m_tileVertexRemap[tri.z]);
+    const VertexCacheStatistics after = analyzeVertexCache(m_tileTriangles, numVertices);
+
+    std::cout << "Terrain tile (" << m_tileTriangles.size() << " triangles): ACMR " << before.acmr << " -> "
+              << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
 }
 
 GPUMesh Terrain::createTileMesh(int gridX, int gridZ)
@@ -95,7 +98,11 @@ GPUMesh Terrain::createTileMesh(int gridX, int gridZ)
     const float offsetX = gridX * m_tileSize;
     const float offsetZ = gridZ * m_tileSize;
 
-    // Create vertices
+    if (m_tileTriangles.empty())
+        optimizeTileTopology();
+
+    // Create vertices (stored in the optimized order that m_tileTriangles refers to)
+    mesh.vertices.resize(m_tileVertexRemap.size());
     for (int z = 0; z < m_subdivisions; z++)
     {
         for (int x = 0; x < m_subdivisions; x++)
@@ -108,31 +115,21 @@ GPUMesh Terrain::createTileMesh(int gridX, int gridZ)
 
             v.texCoord = glm::vec2(worldX / m_textureScale, worldZ / m_textureScale);
 
-            mesh.vertices.push_back(v);
+            mesh.vertices[m_tileVertexRemap[size_t(z) * size_t(m_subdivisions) + size_t(x)]] = v;
         }
     }
 
-    // Create triangles
-    for (int z = 0; z < m_subdivisions - 1; z++)
-    {
-        for (int x = 0; x < m_subdivisions - 1; x++)
-        {
-            int topLeft     = z * m_subdivisions + x;
-            int topRight    = topLeft + 1;
-            int bottomLeft  = (z + 1) * m_subdivisions + x;
-            int bottomRight = bottomLeft + 1;
-
-            mesh.triangles.emplace_back(topLeft, bottomLeft, topRight);
-            mesh.triangles.emplace_back(topRight, bottomLeft, bottomRight);
-        }
-    }
+    mesh.triangles = m_tileTriangles;
 
-    accumulateTangents(mesh);
+    meshComputeTangents(mesh);
 
     mesh.material.kd        = glm::vec3(0.8f, 0.8f, 0.8f);
     mesh.material.ks        = glm::vec3(0.04f, 0.04f, 0.04f);
     mesh.material.shininess = 8.0f;
-    return GPUMesh(mesh);
+
+    if (m_tileLods.empty())
+        m_tileLods = generateLodChain(mesh.triangles, mesh.vertices, {.lockBorder = true});
+    return GPUMesh(mesh, m_tileLods);
 }
 
 void Terrain::loadTiles(int centerTileX, int centerTileZ)
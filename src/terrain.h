@@ -1,8 +1,12 @@
 #pragma once
 
+#include <framework/frustum.h>
 #include <glm/glm.hpp>
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <span>
+#include <vector>
 #include "mesh.h"
 
 class TerrainParameters
@@ -20,7 +24,12 @@ class Terrain
     Terrain(TerrainParameters params);
 
     void update(const glm::vec3& cameraPos);
-    void render(const Shader& shader);
+    // Bounding boxes of the loaded tiles (in world space), in the order in which render() visits the tiles. Only
+    // changes in update() and setParameters().
+    const BoundingBoxes& tileBounds() const { return m_tileBounds; }
+    // Draw the tiles whose entry in visibleTiles (see cullBoxes()) is set. Every tile selects its own level of detail
+    // before it is drawn.
+    void render(const Shader& shader, const LodSelection& lodSelection, std::span<const uint8_t> visibleTiles);
 
     void setParameters(TerrainParameters params);
 
@@ -32,9 +41,18 @@ class Terrain
     bool  m_generated = false;
 
     std::map<std::pair<int, int>, std::unique_ptr<GPUMesh>> m_tiles;
+    BoundingBoxes                                           m_tileBounds;
+    // All tiles share the same grid topology, so its vertex cache optimized triangle order and the matching vertex
+    // order (new index of every row-major grid vertex) are computed once per subdivision count.
+    std::vector<glm::uvec3> m_tileTriangles;
+    std::vector<uint32_t>   m_tileVertexRemap;
+    // The terrain is flat, so the simplified levels of one tile fit every other tile as well. Their borders are kept
+    // at full resolution so that neighbouring tiles at different levels do not crack.
+    std::vector<MeshLod> m_tileLods;
     int                                                     m_lastCameraTileX = -1;
     int                                                     m_lastCameraTileZ = -1;
 
+    void    optimizeTileTopology();
     GPUMesh createTileMesh(int gridX, int gridZ);
     void    loadTiles(int centerTileX, int centerTileZ);
     void    unloadTiles(int centerTileX, int centerTileZ);
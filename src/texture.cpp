@@ -6,18 +6,131 @@ DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
 DISABLE_WARNINGS_POP()
 #include <framework/image.h>
+#include <framework/image_cache.h>
+#include <framework/mip_cache.h>
+#include <framework/render_state.h>
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <numeric>
+#include <string_view>
+#include <system_error>
+#include <vector>
 
-Texture::Texture(std::filesystem::path filePath)
+static std::optional<CompressedTexture> loadCompressedTexture(const std::filesystem::path& filePath,
+                                                              std::span<const BlockFormat> supportedFormats)
 {
-    // Load image from disk to CPU memory.
-    // Image class is defined in <framework/image.h>
-    Image cpuTexture{filePath};
+    if (!std::filesystem::exists(compressedTexturePath(filePath)) || !std::filesystem::exists(filePath))
+        return {};
 
+    auto out = CompressedTexture::load(filePath, CompressedTexture::computeSourceHash(filePath));
+    if (out && std::find(std::begin(supportedFormats), std::end(supportedFormats), out->format()) ==
+                   std::end(supportedFormats))
+        return {};
+    return out;
+}
+
+TextureLevels TextureLevels::prepare(const std::filesystem::path& filePath, const MipChainSettings& mipSettings,
+                                     std::span<const BlockFormat> supportedFormats)
+{
+    TextureLevels out;
+    // Prefer the baked copy: it skips decoding and mip-map generation and uses 4-8x less memory on the GPU.
+    out.m_compressed = loadCompressedTexture(filePath, supportedFormats);
+    if (out.m_compressed)
+        return out;
+
+    // Otherwise use the mip chain cached by a previous run, or generate it on the CPU and cache it for the next.
+    // Unlike glGenerateMipmap, this filters sRGB colors in linear space and renormalizes normal maps.
+    const uint64_t sourceHash = MipCache::computeSourceHash(filePath, mipSettings);
+    out.m_mipCache            = MipCache::load(filePath, sourceHash);
+    if (out.m_mipCache)
+    {
+        out.m_channels = out.m_mipCache->channels();
+        out.m_levels.assign(std::begin(out.m_mipCache->levels()), std::end(out.m_mipCache->levels()));
+        return out;
+    }
+
+    out.m_pSourceImage = ImageCache::global().load(filePath);
+    out.m_mipChain     = generateMipChain(*out.m_pSourceImage, mipSettings);
+    MipCache::store(filePath, sourceHash, *out.m_pSourceImage, out.m_mipChain);
+    out.m_channels = out.m_pSourceImage->channels;
+    out.m_levels   = {{out.m_pSourceImage->width, out.m_pSourceImage->height, out.m_pSourceImage->data()}};
+    for (const Image& level : out.m_mipChain)
+        out.m_levels.push_back({level.width, level.height, level.data()});
+    return out;
+}
+
+size_t TextureLevels::numLevels() const
+{
+    return m_compressed ? m_compressed->levels().size() : m_levels.size();
+}
+
+int TextureLevels::width(size_t level) const
+{
+    return m_compressed ? std::max(m_compressed->width() >> level, 1) : m_levels[level].width;
+}
+
+int TextureLevels::height(size_t level) const
+{
+    return m_compressed ? std::max(m_compressed->height() >> level, 1) : m_levels[level].height;
+}
+
+std::span<const std::byte> TextureLevels::data(size_t level) const
+{
+    return m_compressed ? m_compressed->levels()[level] : std::as_bytes(m_levels[level].pixels);
+}
+
+// Load image from disk to CPU memory (or reuse it if a mesh material already decoded the same file).
+// Image class is defined in <framework/image.h>
+Texture::Texture(std::filesystem::path filePath, TextureClass textureClass, const MipChainSettings& mipSettings)
+    : Texture(TextureLevels::prepare(filePath, mipSettings, supportedBlockFormats()), textureClass)
+{
+}
+
+Texture::Texture(const Image& cpuTexture, TextureClass textureClass)
+{
+    // Mip-maps are generated on the GPU, unless the budget requires dropping the top level(s).
+    std::vector<size_t> levelSizes;
+    for (int width = cpuTexture.width, height = cpuTexture.height;;
+         width = std::max(width / 2, 1), height = std::max(height / 2, 1))
+    {
+        levelSizes.push_back(residentSize(cpuTexture.channels, width, height));
+        if (width == 1 && height == 1)
+            break;
+    }
+    if (TextureBudget::global().selectFirstLevel(textureClass, cpuTexture.width, cpuTexture.height, levelSizes) > 0)
+    {
+        upload(cpuTexture.channels, toLevels(cpuTexture, generateMipChain(cpuTexture)), textureClass);
+        return;
+    }
+
+    upload(cpuTexture.channels, std::array{MipCache::Level{cpuTexture.width, cpuTexture.height, cpuTexture.data()}},
+           textureClass);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    TextureBudget::global().release(m_residentBytes);
+    m_residentBytes = std::accumulate(std::begin(levelSizes), std::end(levelSizes), size_t(0));
+    TextureBudget::global().acquire(m_residentBytes, false);
+}
+
+Texture::Texture(const CompressedTexture& compressedTexture, TextureClass textureClass)
+{
+    upload(compressedTexture, textureClass);
+}
+
+Texture::Texture(const TextureLevels& levels, TextureClass textureClass, bool uploadData)
+{
+    if (levels.m_compressed)
+        upload(*levels.m_compressed, textureClass, uploadData);
+    else
+        upload(levels.m_channels, levels.m_levels, textureClass, uploadData);
+}
+
+void Texture::create()
+{
     // Create a texture on the GPU and bind it for parameter setting
     glGenTextures(1, &m_texture);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    RenderState::global().bindTexture(0, GL_TEXTURE_2D, m_texture);
 
     // Set behavior for when texture coordinates are outside the [0, 1] range (wrap around).
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -26,44 +139,313 @@ Texture::Texture(std::filesystem::path filePath)
     // Set interpolation for texture sampling (bilinear interpolation across mip-maps).
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
 
-    // Define GPU texture parameters and upload corresponding data based on number of image channels
-    switch (cpuTexture.channels)
+size_t Texture::residentSize(int channels, int width, int height)
+{
+    // Drivers store RGB textures with a padding byte per pixel.
+    const size_t bytesPerPixel = channels == 3 ? 4 : static_cast<size_t>(channels);
+    return static_cast<size_t>(width) * static_cast<size_t>(height) * bytesPerPixel;
+}
+
+std::vector<MipCache::Level> Texture::toLevels(const Image& image, std::span<const Image> mipChain)
+{
+    std::vector<MipCache::Level> out{{image.width, image.height, image.data()}};
+    for (const Image& level : mipChain)
+        out.push_back({level.width, level.height, level.data()});
+    return out;
+}
+
+GLenum Texture::pixelFormat(int channels)
+{
+    switch (channels)
     {
         case 1:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, cpuTexture.width, cpuTexture.height, 0, GL_RED, GL_UNSIGNED_BYTE,
-                         cpuTexture.get_data());
-            break;
+            return GL_RED;
         case 3:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cpuTexture.width, cpuTexture.height, 0, GL_RGB, GL_UNSIGNED_BYTE,
-                         cpuTexture.get_data());
-            break;
+            return GL_RGB;
         case 4:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cpuTexture.width, cpuTexture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                         cpuTexture.get_data());
-            break;
+            return GL_RGBA;
         default:
             std::cerr << "Number of channels read for texture is not supported" << std::endl;
             throw std::exception();
     }
+}
 
-    // Generate mip-maps
-    glGenerateMipmap(GL_TEXTURE_2D);
+void Texture::upload(int channels, std::span<const MipCache::Level> levels, TextureClass textureClass, bool uploadData)
+{
+    // Define GPU texture parameters and upload corresponding data based on number of image channels
+    const GLenum format = pixelFormat(channels);
+    create();
+
+    std::vector<size_t> levelSizes;
+    for (const MipCache::Level& level : levels)
+        levelSizes.push_back(residentSize(channels, level.width, level.height));
+    const size_t firstLevel =
+        TextureBudget::global().selectFirstLevel(textureClass, levels[0].width, levels[0].height, levelSizes);
+
+    // Rows are tightly packed, which matters for the odd widths of the smaller mip-maps.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t level = firstLevel; level < levels.size(); level++)
+    {
+        glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level - firstLevel), static_cast<GLint>(format),
+                     levels[level].width, levels[level].height, 0, format, GL_UNSIGNED_BYTE,
+                     uploadData ? levels[level].pixels.data() : nullptr);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // A single level is completed by glGenerateMipmap instead.
+    if (levels.size() > 1)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size() - 1 - firstLevel));
+
+    m_firstLevel    = firstLevel;
+    m_residentBytes = std::accumulate(std::begin(levelSizes) + static_cast<std::ptrdiff_t>(firstLevel),
+                                      std::end(levelSizes), size_t(0));
+    TextureBudget::global().acquire(m_residentBytes, firstLevel > 0);
+}
+
+void Texture::upload(const CompressedTexture& compressedTexture, TextureClass textureClass, bool uploadData)
+{
+    create();
+
+    // All mip-maps are stored in the file; the data is read straight from the mapped file.
+    const auto levels = compressedTexture.levels();
+    std::vector<size_t> levelSizes;
+    for (const auto& level : levels)
+        levelSizes.push_back(level.size());
+    const size_t firstLevel = TextureBudget::global().selectFirstLevel(textureClass, compressedTexture.width(),
+                                                                       compressedTexture.height(), levelSizes);
+
+    for (size_t level = firstLevel; level < levels.size(); level++)
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level - firstLevel),
+                               compressedTexture.glInternalFormat(), std::max(compressedTexture.width() >> level, 1),
+                               std::max(compressedTexture.height() >> level, 1), 0,
+                               static_cast<GLsizei>(levels[level].size()), uploadData ? levels[level].data() : nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size() - 1 - firstLevel));
+
+    m_firstLevel    = firstLevel;
+    m_residentBytes = std::accumulate(std::begin(levelSizes) + static_cast<std::ptrdiff_t>(firstLevel),
+                                      std::end(levelSizes), size_t(0));
+    TextureBudget::global().acquire(m_residentBytes, firstLevel > 0);
 }
 
-Texture::Texture(Texture&& other) : m_texture(other.m_texture)
+size_t Texture::uploadSize(const TextureLevels& levels) const
 {
-    other.m_texture = INVALID;
+    size_t out = 0;
+    for (size_t level = m_firstLevel; level < levels.numLevels(); level++)
+        out += levels.data(level).size();
+    return out;
+}
+
+size_t Texture::uploadSlice(const TextureLevels& levels, size_t offset, size_t maxBytes)
+{
+    RenderState::global().bindTexture(0, GL_TEXTURE_2D, m_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // Find the level that contains offset and upload whole rows of it, moving on to the next level only if the budget
+    // covers the rest of this one.
+    size_t uploaded    = 0;
+    size_t levelOffset = 0;
+    for (size_t level = m_firstLevel; level < levels.numLevels() && uploaded < maxBytes; level++)
+    {
+        const auto   data        = levels.data(level);
+        const size_t levelEnd    = levelOffset + data.size();
+        const size_t sliceOffset = offset + uploaded;
+        if (sliceOffset >= levelEnd)
+        {
+            levelOffset = levelEnd;
+            continue;
+        }
+
+        const int        width     = levels.width(level);
+        const int        height    = levels.height(level);
+        const size_t     numRows   = static_cast<size_t>((height + levels.rowHeight() - 1) / levels.rowHeight());
+        const size_t     rowSize   = data.size() / numRows;
+        const size_t     firstRow  = (sliceOffset - levelOffset) / rowSize;
+        const size_t     sliceRows = std::min(std::max((maxBytes - uploaded) / rowSize, size_t(1)), numRows - firstRow);
+        const int        y         = static_cast<int>(firstRow) * levels.rowHeight();
+        const int        sliceHeight  = std::min(static_cast<int>(sliceRows) * levels.rowHeight(), height - y);
+        const GLint      textureLevel = static_cast<GLint>(level - m_firstLevel);
+        const std::byte* pSlice       = data.data() + firstRow * rowSize;
+        if (levels.m_compressed)
+        {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, textureLevel, 0, y, width, sliceHeight,
+                                      levels.m_compressed->glInternalFormat(),
+                                      static_cast<GLsizei>(sliceRows * rowSize), pSlice);
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, textureLevel, 0, y, width, sliceHeight, pixelFormat(levels.m_channels),
+                            GL_UNSIGNED_BYTE, pSlice);
+        }
+        uploaded += sliceRows * rowSize;
+        if (firstRow + sliceRows < numRows)
+            break;
+        levelOffset = levelEnd;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return uploaded;
+}
+
+Texture::Texture(Texture&& other)
+    : m_texture(other.m_texture), m_firstLevel(other.m_firstLevel), m_residentBytes(other.m_residentBytes)
+{
+    other.m_texture       = INVALID;
+    other.m_residentBytes = 0;
 }
 
 Texture::~Texture()
 {
     if (m_texture != INVALID)
+    {
+        RenderState::global().forgetTexture(m_texture);
         glDeleteTextures(1, &m_texture);
+    }
+    TextureBudget::global().release(m_residentBytes);
+}
+
+Texture& Texture::operator=(Texture&& other)
+{
+    std::swap(m_texture, other.m_texture);
+    std::swap(m_firstLevel, other.m_firstLevel);
+    std::swap(m_residentBytes, other.m_residentBytes);
+    return *this;
 }
 
 void Texture::bind(GLint textureSlot)
 {
-    glActiveTexture(textureSlot);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    RenderState::global().bindTexture(GLuint(textureSlot - GL_TEXTURE0), GL_TEXTURE_2D, m_texture);
+}
+
+TextureCache& TextureCache::global()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+std::string TextureCache::key(const std::filesystem::path& filePath)
+{
+    std::error_code error;
+    auto            canonicalPath = std::filesystem::weakly_canonical(filePath, error);
+    return (error ? filePath : canonicalPath).generic_string();
+}
+
+std::shared_ptr<Texture> TextureCache::load(const std::filesystem::path& filePath, TextureClass textureClass,
+                                            const MipChainSettings& mipSettings)
+{
+    if (auto pTexture = find(filePath))
+        return pTexture;
+
+    // The CPU image (if any) is only referenced for the duration of the upload; it stays alive only while other
+    // users (such as the Material of a CPU Mesh) still hold on to it.
+    auto pTexture = std::make_shared<Texture>(filePath, textureClass, mipSettings);
+    insert(filePath, pTexture);
+    return pTexture;
+}
+
+std::shared_ptr<Texture> TextureCache::find(const std::filesystem::path& filePath) const
+{
+    if (auto iter = m_textures.find(key(filePath)); iter != std::end(m_textures))
+        return iter->second.lock();
+    return nullptr;
+}
+
+void TextureCache::insert(const std::filesystem::path& filePath, const std::shared_ptr<Texture>& pTexture)
+{
+    m_textures[key(filePath)] = pTexture;
+}
+
+static bool hasExtension(std::string_view extension)
+{
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++)
+    {
+        const auto* pName = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+        if (pName && std::string_view(pName) == extension)
+            return true;
+    }
+    return false;
+}
+
+bool isBlockFormatSupported(BlockFormat format)
+{
+    // Queried once; all textures are created on the thread that owns the (single) OpenGL context.
+    static const bool hasS3tc = hasExtension("GL_EXT_texture_compression_s3tc");
+    // BPTC is core since OpenGL 4.2; macOS stops at 4.1.
+    static const bool hasBptc = GLAD_GL_VERSION_4_2 || hasExtension("GL_ARB_texture_compression_bptc");
+
+    switch (format)
+    {
+        case BlockFormat::BC1:
+        case BlockFormat::BC3:
+            return hasS3tc;
+        case BlockFormat::BC5:
+            // RGTC is core since OpenGL 3.0.
+            return true;
+        case BlockFormat::BC7:
+            return hasBptc;
+    }
+    return false;
+}
+
+std::vector<BlockFormat> supportedBlockFormats()
+{
+    std::vector<BlockFormat> out;
+    for (BlockFormat format : {BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC5, BlockFormat::BC7})
+    {
+        if (isBlockFormatSupported(format))
+            out.push_back(format);
+    }
+    return out;
+}
+
+std::optional<CompressedTexture> loadCompressedTexture(const std::filesystem::path& filePath)
+{
+    return loadCompressedTexture(filePath, supportedBlockFormats());
+}
+
+TextureBudget& TextureBudget::global()
+{
+    static TextureBudget budget;
+    return budget;
+}
+
+void TextureBudget::setMaxDimension(TextureClass textureClass, int maxDimension)
+{
+    m_maxDimensions[static_cast<size_t>(textureClass)] = std::max(maxDimension, 1);
+}
+
+size_t TextureBudget::selectFirstLevel(TextureClass textureClass, int width, int height,
+                                       std::span<const size_t> levelSizes) const
+{
+    // Levels below this size cost next to nothing and the texture would become useless.
+    constexpr int minDimension = 64;
+
+    const auto levelDimension = [&](size_t level)
+    { return std::max(width >> level, height >> level); };
+    size_t firstLevel = 0;
+    while (firstLevel + 1 < levelSizes.size() && levelDimension(firstLevel) > maxDimension(textureClass))
+        firstLevel++;
+
+    size_t bytes = std::accumulate(std::begin(levelSizes) + static_cast<std::ptrdiff_t>(firstLevel),
+                                   std::end(levelSizes), size_t(0));
+    while (firstLevel + 1 < levelSizes.size() && m_residentBytes + bytes > m_maxResidentBytes &&
+           levelDimension(firstLevel + 1) >= minDimension)
+        bytes -= levelSizes[firstLevel++];
+    return firstLevel;
+}
+
+void TextureBudget::acquire(size_t bytes, bool isReduced)
+{
+    m_residentBytes += bytes;
+    if (isReduced)
+        m_numReducedTextures++;
+}
+
+void TextureBudget::release(size_t bytes)
+{
+    m_residentBytes -= bytes;
 }
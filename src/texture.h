@@ -3,29 +3,177 @@
 DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
+#include <framework/compressed_texture.h>
+#include <framework/image.h>
+#include <framework/mip_cache.h>
 #include <framework/opengl_includes.h>
+#include <array>
 #include <exception>
 #include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 struct ImageLoadingException : public std::runtime_error
 {
     using std::runtime_error::runtime_error;
 };
 
+// Kinds of textures that have their own maximum resolution in the TextureBudget.
+enum class TextureClass
+{
+    // Textures of mesh materials.
+    Material,
+    // Color (and other non-normal) maps of the terrain.
+    Terrain,
+    NormalMap,
+    Count
+};
+
+// Mip levels of an image file, ready to be uploaded by a Texture: the baked block-compressed copy if there is an
+// up-to-date one in a supported format, otherwise the cached mip chain, otherwise the decoded image with a freshly
+// generated (and cached) mip chain. Preparing them makes no OpenGL calls, so it can run on a worker thread.
+class TextureLevels
+{
+   public:
+    // supportedFormats are the block formats that the GPU can sample (see supportedBlockFormats()).
+    static TextureLevels prepare(const std::filesystem::path& filePath, const MipChainSettings& mipSettings,
+                                 std::span<const BlockFormat> supportedFormats);
+
+    size_t numLevels() const;
+    int    width(size_t level) const;
+    int    height(size_t level) const;
+    // Tightly packed rows of pixels or, if compressed, rows of 4x4 blocks; top row first.
+    std::span<const std::byte> data(size_t level) const;
+    int                        rowHeight() const { return m_compressed ? 4 : 1; }
+
+   private:
+    friend class Texture;
+    TextureLevels() = default;
+
+   private:
+    std::optional<CompressedTexture> m_compressed;
+    // Uncompressed levels point into the mip cache or into the source image and its generated mip chain.
+    std::optional<MipCache>      m_mipCache;
+    std::shared_ptr<Image>       m_pSourceImage;
+    std::vector<Image>           m_mipChain;
+    int                          m_channels{0};
+    std::vector<MipCache::Level> m_levels;
+};
+
+// All constructors respect the TextureBudget: the top mip-map levels are left out if the texture is larger than the
+// maximum resolution of its class, or if it would not fit into the budget.
 class Texture
 {
    public:
-    Texture(std::filesystem::path filePath);
+    // Uploads the baked block-compressed copy of the file if there is an up-to-date one that the GPU supports, and
+    // otherwise the image with a mip chain from generateMipChain() (see TextureLevels). The mip chain is cached on disk
+    // (see mip_cache.h), so only the first load of a file decodes and filters it.
+    Texture(std::filesystem::path filePath, TextureClass textureClass = TextureClass::Material,
+            const MipChainSettings& mipSettings = {});
+    Texture(const Image& cpuTexture, TextureClass textureClass = TextureClass::Material);
+    Texture(const CompressedTexture& compressedTexture, TextureClass textureClass = TextureClass::Material);
+    // Only allocates the levels unless uploadData is set; fill them with uploadSlice() before using the texture.
+    Texture(const TextureLevels& levels, TextureClass textureClass = TextureClass::Material, bool uploadData = true);
     Texture(const Texture&) = delete;
     Texture(Texture&&);
     ~Texture();
 
     Texture& operator=(const Texture&) = delete;
-    Texture& operator=(Texture&&)      = default;
+    Texture& operator=(Texture&&);
 
     void bind(GLint textureSlot);
 
+    // Bytes of the levels that fit into the TextureBudget, which are the ones that uploadSlice() fills.
+    size_t uploadSize(const TextureLevels& levels) const;
+    // Upload the rows of the resident levels starting at byte offset (counting through the levels from the largest
+    // resident one), at most maxBytes of them but at least one row. Returns the number of bytes uploaded.
+    size_t uploadSlice(const TextureLevels& levels, size_t offset, size_t maxBytes);
+
+   private:
+    // Called by upload() once nothing can throw anymore: a constructor that throws leaves no destructor to delete the
+    // texture.
+    void create();
+    // Levels 0, 1, ... of an image with the given number of channels; left undefined unless uploadData is set.
+    void upload(int channels, std::span<const MipCache::Level> levels, TextureClass textureClass,
+                bool uploadData = true);
+    void upload(const CompressedTexture& compressedTexture, TextureClass textureClass, bool uploadData = true);
+
+    static GLenum                       pixelFormat(int channels);
+    static size_t                       residentSize(int channels, int width, int height);
+    static std::vector<MipCache::Level> toLevels(const Image& image, std::span<const Image> mipChain);
+
    private:
     static constexpr GLuint INVALID = 0xFFFFFFFF;
     GLuint                  m_texture{INVALID};
+    // Level of the source that is level 0 of the texture (see TextureBudget::selectFirstLevel()).
+    size_t m_firstLevel{0};
+    // Video memory used by the texture, as counted by the TextureBudget.
+    size_t m_residentBytes{0};
+};
+
+// Limits the video memory used by Textures, so that machines with little memory get blurrier textures instead of
+// swapping. The limits apply to textures that are created afterwards; set them before loading anything.
+// Must only be used from the thread that owns the OpenGL context.
+class TextureBudget
+{
+   public:
+    static TextureBudget& global();
+
+    // Estimated size of all textures on the GPU (uncompressed RGB counts as RGBA, as drivers pad it).
+    size_t residentBytes() const { return m_residentBytes; }
+    size_t maxResidentBytes() const { return m_maxResidentBytes; }
+    void   setMaxResidentBytes(size_t maxResidentBytes) { m_maxResidentBytes = maxResidentBytes; }
+    // Largest width or height of the textures of a class.
+    int  maxDimension(TextureClass textureClass) const { return m_maxDimensions[static_cast<size_t>(textureClass)]; }
+    void setMaxDimension(TextureClass textureClass, int maxDimension);
+    // Number of textures that were loaded at a lower resolution than their source.
+    size_t numReducedTextures() const { return m_numReducedTextures; }
+
+    // First mip-map level to upload of a texture of width x height pixels with levels of the given sizes (in bytes).
+    // Skips levels that exceed the maximum dimension and, while the texture does not fit into the remaining budget,
+    // levels that are larger than 64 pixels.
+    size_t selectFirstLevel(TextureClass textureClass, int width, int height, std::span<const size_t> levelSizes) const;
+    void   acquire(size_t bytes, bool isReduced);
+    void   release(size_t bytes);
+
+   private:
+    size_t m_residentBytes{0};
+    size_t m_maxResidentBytes{size_t(1) << 30};
+    std::array<int, static_cast<size_t>(TextureClass::Count)> m_maxDimensions{4096, 4096, 4096};
+    size_t m_numReducedTextures{0};
+};
+
+// Whether the current OpenGL context can sample textures in the given block compression format.
+bool isBlockFormatSupported(BlockFormat format);
+// All formats for which isBlockFormatSupported() holds, e.g. to prepare TextureLevels on another thread.
+std::vector<BlockFormat> supportedBlockFormats();
+// Map the compressed copy of an image file baked by framework/tools/texture_baker.cpp. Returns nothing if there is
+// no such copy, if it is outdated or if its format is not supported by the current OpenGL context.
+std::optional<CompressedTexture> loadCompressedTexture(const std::filesystem::path& filePath);
+
+// Process-wide cache of GPU textures keyed by canonical file path, so that a texture referenced by several
+// (sub)meshes is decoded and uploaded only once. Only weak references are kept: a texture is deleted when the
+// last handle is released. The decoded pixels are not kept alive after the upload.
+// Must only be used from the thread that owns the OpenGL context.
+class TextureCache
+{
+   public:
+    static TextureCache& global();
+
+    // A file is expected to be loaded with the same settings every time; the settings are not part of the key.
+    std::shared_ptr<Texture> load(const std::filesystem::path& filePath, TextureClass textureClass = TextureClass::Material,
+                                  const MipChainSettings& mipSettings = {});
+    // Texture of the file if one is loaded, nullptr otherwise.
+    std::shared_ptr<Texture> find(const std::filesystem::path& filePath) const;
+    // Share a texture of the file that was created elsewhere (e.g. uploaded in slices by GPUMeshLoad).
+    void insert(const std::filesystem::path& filePath, const std::shared_ptr<Texture>& pTexture);
+
+   private:
+    static std::string key(const std::filesystem::path& filePath);
+
+    std::unordered_map<std::string, std::weak_ptr<Texture>> m_textures;
 };